@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+"""
+Local stand-in of UberBack to test the upload formats of UberSniff
+
+Decodes the uploads sent to POST /data and prints their size and their content:
+  application/json                       full data batches
+  application/vnd.ubersniff.delta+json   strings replaced by the ids of the dictionary of the session
+  application/cbor                       full data batches in CBOR, the counts are [content, nb] pairs
+A delta upload using an id the stand-in doesn't know is answered 409, like UberBack when it lost the dictionary
+
+Point the Host and Port of the UberBack config to the stand-in, its certificate must be trusted by the system
+  python3 uberback_standin.py --cert cert.pem --key key.pem --port 8443
+"""
+import argparse
+import http.server
+import json
+import ssl
+import sys
+import threading
+
+
+class Dictionaries:
+    """Strings defined by the delta uploads, by user and epoch"""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._strings = {}
+
+    def clear(self):
+        with self._lock:
+            self._strings.clear()
+
+    def decode(self, upload):
+        """Replace the ids of the upload by their strings, raises KeyError for an unknown id"""
+        dictionary = upload["dictionary"]
+        with self._lock:
+            strings = self._strings.setdefault((upload["userId"], dictionary["epoch"]), {})
+            for string_id, string in dictionary["strings"]:
+                strings[string_id] = string
+            return [{
+                "urlSrc": strings[batch["urlSrc"]],
+                "texts": [[strings[text_id], nb] for text_id, nb in batch.get("texts", [])],
+                "images": [[strings[image_id], nb] for image_id, nb in batch.get("images", [])],
+            } for batch in upload["dataBatches"]]
+
+
+def decode_json(body, dictionaries):
+    upload = json.loads(body)
+    return [{
+        "urlSrc": batch["urlSrc"],
+        "texts": [[text["content"], text["nb"]] for text in batch.get("texts", [])],
+        "images": [[image["content"], image["nb"]] for image in batch.get("images", [])],
+    } for batch in upload["dataBatches"]]
+
+
+def decode_delta(body, dictionaries):
+    return dictionaries.decode(json.loads(body))
+
+
+def read_cbor(body, position=0):
+    """Read the CBOR data item at the position, returns the item and the position after it
+    Only the types written by the CBOR encoder are supported: integers, strings, arrays and maps of definite length"""
+    head = body[position]
+    major_type, info = head >> 5, head & 0x1f
+    position += 1
+    if info < 24:
+        value = info
+    elif info <= 27:
+        size = 1 << (info - 24)
+        value = int.from_bytes(body[position:position + size], "big")
+        position += size
+    else:
+        raise ValueError("unsupported CBOR head 0x%02x" % head)
+
+    if major_type == 0:
+        return value, position
+    if major_type == 1:
+        return -1 - value, position
+    if major_type in (2, 3):
+        data = body[position:position + value]
+        if len(data) != value:
+            raise ValueError("truncated CBOR string")
+        return (data if major_type == 2 else data.decode()), position + value
+    if major_type == 4:
+        items = []
+        for _ in range(value):
+            item, position = read_cbor(body, position)
+            items.append(item)
+        return items, position
+    if major_type == 5:
+        items = {}
+        for _ in range(value):
+            key, position = read_cbor(body, position)
+            items[key], position = read_cbor(body, position)
+        return items, position
+    raise ValueError("unsupported CBOR major type %d" % major_type)
+
+
+def decode_cbor(body, dictionaries):
+    try:
+        upload, position = read_cbor(body)
+    except IndexError as e:
+        raise ValueError("truncated CBOR body") from e
+    if position != len(body):
+        raise ValueError("%d bytes after the CBOR body" % (len(body) - position))
+    return [{
+        "urlSrc": batch["urlSrc"],
+        "texts": [[content, nb] for content, nb in batch.get("texts", [])],
+        "images": [[content, nb] for content, nb in batch.get("images", [])],
+    } for batch in upload["dataBatches"]]
+
+
+DECODERS = {
+    "application/json": decode_json,
+    "application/vnd.ubersniff.delta+json": decode_delta,
+    "application/cbor": decode_cbor,
+}
+
+
+class Stats:
+    def __init__(self):
+        self._lock = threading.Lock()
+        self.uploads = 0
+        self.bytes = 0
+
+    def add(self, size):
+        with self._lock:
+            self.uploads += 1
+            self.bytes += size
+            return self.uploads, self.bytes
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def _answer(self, status, body=b""):
+        self.send_response(status)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        server = self.server
+        if self.path != "/data":
+            return self._answer(404)
+        if server.forget_every and server.stats.uploads and server.stats.uploads % server.forget_every == 0:
+            server.dictionaries.clear()
+        if server.failures_left:
+            # UberBack unreachable: the uploads go to the spool
+            server.failures_left -= 1
+            return self._answer(503)
+
+        content_type = self.headers.get("Content-Type", "")
+        decoder = DECODERS.get(content_type)
+        if not decoder:
+            print("unknown content type %r, %d bytes" % (content_type, len(body)), file=sys.stderr)
+            return self._answer(415)
+        try:
+            batches = decoder(body, server.dictionaries)
+        except KeyError as e:
+            print("%s: unknown id %s, state lost" % (content_type, e), file=sys.stderr)
+            return self._answer(409)
+        except (ValueError, TypeError) as e:
+            print("%s: invalid body: %s" % (content_type, e), file=sys.stderr)
+            return self._answer(400)
+
+        uploads, total_bytes = server.stats.add(len(body))
+        print("%s: %d bytes, %d data batches, %d uploads, %d bytes in total"
+              % (content_type, len(body), len(batches), uploads, total_bytes))
+        if server.verbose:
+            print(json.dumps(batches, indent=1, ensure_ascii=False))
+        self._answer(200)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Local stand-in of UberBack")
+    parser.add_argument("--address", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--cert", help="certificate of the TLS server, plain HTTP without it")
+    parser.add_argument("--key")
+    parser.add_argument("--fail-first", type=int, default=0, help="answer 503 to the first uploads")
+    parser.add_argument("--forget-every", type=int, default=0, help="forget the dictionaries every n uploads")
+    parser.add_argument("--verbose", action="store_true", help="print the decoded data batches")
+    args = parser.parse_args()
+
+    server = http.server.ThreadingHTTPServer((args.address, args.port), Handler)
+    server.dictionaries = Dictionaries()
+    server.stats = Stats()
+    server.failures_left = args.fail_first
+    server.forget_every = args.forget_every
+    server.verbose = args.verbose
+    if args.cert:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.key)
+        server.socket = context.wrap_socket(server.socket, server_side=True)
+    print("UberBack stand-in listening on %s:%d" % (args.address, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
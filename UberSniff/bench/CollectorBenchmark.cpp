@@ -0,0 +1,56 @@
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "Corpus.hpp"
+
+namespace ubersniff::bench {
+	/*
+	** Cleaning of a page of the corpus by the collector, with or without the extraction cache
+	** The page is the same at each iteration: with the cache, only the first iteration cleans it
+	*/
+	static void BM_CleanPage(benchmark::State& state, const Page* page, size_t extraction_cache_size)
+	{
+		collector::DataCollector::Config config;
+		config.extraction_cache_size = extraction_cache_size;
+		collector::DataCollector data_collector(config);
+		auto exchange = make_text_exchange(*page);
+
+		for (auto _ : state) {
+			data_collector.collect_text_exchange(exchange);
+			data_collector.process_next_text_exchange();
+		}
+		state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * page->content.size()));
+	}
+
+	static const bool _are_pages_registered = []() {
+		for (const auto& page : get_corpus()) {
+			benchmark::RegisterBenchmark(("BM_CleanPage/" + page.name).c_str(), BM_CleanPage, &page, size_t(0))
+				->Unit(benchmark::kMicrosecond);
+			benchmark::RegisterBenchmark(("BM_CleanPage/" + page.name + "/cached").c_str(), BM_CleanPage, &page,
+				size_t(4096));
+		}
+		return true;
+	}();
+
+	/*
+	** Count of the lines extracted from the corpus in a new data batch, like the collector does
+	** The lines are inserted the given number of times: the first time adds them, the next times count them
+	*/
+	static void BM_DataBatchInsert(benchmark::State& state)
+	{
+		const auto& lines = get_corpus_lines();
+		auto repeats = static_cast<size_t>(state.range(0));
+
+		for (auto _ : state) {
+			collector::DataBatches data_batches;
+			auto& texts = data_batches["http://www.example.com"].texts;
+			for (size_t i = 0; i < repeats; ++i) {
+				for (const auto& line : lines)
+					++texts[line];
+			}
+			benchmark::DoNotOptimize(data_batches);
+		}
+		state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * repeats * lines.size()));
+	}
+	BENCHMARK(BM_DataBatchInsert)->Arg(1)->Arg(16);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "collector/DataBatch.hpp"
+#include "collector/DataCollector.hpp"
+
+namespace ubersniff::bench {
+	/*
+	* HTML page of the corpus checked in bench/corpus
+	*/
+	struct Page {
+		std::string name;
+		std::string content;
+	};
+
+	// Pages of the corpus, in the order of their names
+	inline const std::vector<Page>& get_corpus()
+	{
+		static const std::vector<Page> corpus = []() {
+			std::vector<Page> pages;
+			for (const auto& entry : std::filesystem::directory_iterator(UBERSNIFF_BENCH_CORPUS_DIR)) {
+				if (entry.path().extension() != ".html")
+					continue;
+				std::ifstream file(entry.path(), std::ios::binary);
+				std::ostringstream content;
+				content << file.rdbuf();
+				pages.push_back({ entry.path().stem().string(), content.str() });
+			}
+			if (pages.empty())
+				throw std::runtime_error("No page in " UBERSNIFF_BENCH_CORPUS_DIR);
+			std::sort(pages.begin(), pages.end(), [](const Page& lhs, const Page& rhs) { return lhs.name < rhs.name; });
+			return pages;
+		}();
+		return corpus;
+	}
+
+	// Text exchange of a page, as reassembled from the network
+	inline packet::Exchange make_text_exchange(const Page& page)
+	{
+		packet::Exchange exchange;
+		exchange.request.host = "http://www.example.com";
+		exchange.request.path = "/" + page.name;
+		exchange.request.uri = exchange.request.host + exchange.request.path;
+		exchange.response.status_code = "200";
+		exchange.response.content_type = packet::ContentType::TEXT;
+		exchange.response.content = page.content;
+		return exchange;
+	}
+
+	// Lines extracted from the pages of the corpus by the collector
+	inline const std::vector<std::string>& get_corpus_lines()
+	{
+		static const std::vector<std::string> lines = []() {
+			collector::DataCollector::Config config;
+			config.extraction_cache_size = 0;
+			collector::DataCollector data_collector(config);
+			for (const auto& page : get_corpus()) {
+				data_collector.collect_text_exchange(make_text_exchange(page));
+				data_collector.process_next_text_exchange();
+			}
+			std::vector<std::string> lines;
+			for (auto& data_batch : data_collector.extract_data_batches()) {
+				for (auto& text : data_batch.second.texts)
+					lines.push_back(text.first);
+			}
+			std::sort(lines.begin(), lines.end());
+			return lines;
+		}();
+		return lines;
+	}
+}
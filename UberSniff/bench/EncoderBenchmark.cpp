@@ -0,0 +1,41 @@
+#include <string>
+#include <benchmark/benchmark.h>
+#include "Corpus.hpp"
+#include "api/encoder/JsonEncoder.hpp"
+
+namespace ubersniff::bench {
+	/*
+	** Data batches of the given number of source URLs, each with the lines of the corpus and a few images
+	*/
+	static collector::DataBatches make_data_batches(size_t nb_sources)
+	{
+		collector::DataBatches data_batches;
+		for (size_t source = 0; source < nb_sources; ++source) {
+			auto& data_batch = data_batches["http://site" + std::to_string(source) + ".example.com"];
+			int count = 1;
+			for (const auto& line : get_corpus_lines())
+				data_batch.texts[line] = count++ % 7 + 1;
+			for (int image = 0; image < 16; ++image)
+				data_batch.images["http://cdn.example.com/img/" + std::to_string(image) + ".webp"] = image + 1;
+		}
+		return data_batches;
+	}
+
+	/*
+	** Serialization of the data batches of an upload in JSON, as UberBack receives them
+	*/
+	static void BM_JsonEncode(benchmark::State& state, bool is_sorted)
+	{
+		auto data_batches = make_data_batches(static_cast<size_t>(state.range(0)));
+		api::encoder::JsonEncoder encoder("user", "service", is_sorted);
+		api::Upload upload;
+
+		for (auto _ : state) {
+			encoder.encode(data_batches, upload);
+			benchmark::DoNotOptimize(upload.body.data());
+		}
+		state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * upload.body.size()));
+	}
+	BENCHMARK_CAPTURE(BM_JsonEncode, unsorted, false)->Arg(1)->Arg(16)->Unit(benchmark::kMicrosecond);
+	BENCHMARK_CAPTURE(BM_JsonEncode, sorted, true)->Arg(1)->Arg(16)->Unit(benchmark::kMicrosecond);
+}
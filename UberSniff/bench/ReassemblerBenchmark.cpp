@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "Corpus.hpp"
+#include "packet/HTTPReassembler.hpp"
+
+namespace ubersniff::bench {
+	// size of the chunks of a chunked body
+	static constexpr size_t CHUNK_SIZE = 4096;
+
+	static std::vector<uint8_t> to_bytes(const std::string& str)
+	{
+		return std::vector<uint8_t>(str.begin(), str.end());
+	}
+
+	/*
+	** Response carrying the largest page of the corpus, with a type the collector doesn't extract:
+	**  only the reassembly is measured
+	*/
+	static std::string make_response(bool is_chunked)
+	{
+		const auto& corpus = get_corpus();
+		const auto& body = std::max_element(corpus.begin(), corpus.end(), [](const Page& lhs, const Page& rhs) {
+			return lhs.content.size() < rhs.content.size();
+		})->content;
+
+		std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n";
+		if (!is_chunked)
+			return response + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+		response += "Transfer-Encoding: chunked\r\n\r\n";
+		for (size_t offset = 0; offset < body.size(); offset += CHUNK_SIZE) {
+			auto chunk = body.substr(offset, CHUNK_SIZE);
+			char chunk_size[32];
+			std::snprintf(chunk_size, sizeof(chunk_size), "%zx\r\n", chunk.size());
+			response += chunk_size + chunk + "\r\n";
+		}
+		return response + "0\r\n\r\n";
+	}
+
+	/*
+	** One exchange per iteration: the request, then the response cut in segments of the size given
+	*/
+	static void BM_ReassembleResponse(benchmark::State& state, bool is_chunked)
+	{
+		auto segment_size = static_cast<size_t>(state.range(0));
+		auto request = to_bytes("GET /page HTTP/1.1\r\nHost: www.example.com\r\nAccept: */*\r\n\r\n");
+		auto response = make_response(is_chunked);
+		std::vector<std::vector<uint8_t>> segments;
+		for (size_t offset = 0; offset < response.size(); offset += segment_size)
+			segments.push_back(to_bytes(response.substr(offset, segment_size)));
+
+		collector::DataCollector data_collector;
+		packet::HTTPReassembler::set_max_body_size(response.size());
+		packet::HTTPReassembler http_reassembler(data_collector, "http://");
+		std::chrono::microseconds timestamp(0);
+		for (auto _ : state) {
+			http_reassembler.push_client_payload(request, timestamp);
+			for (auto& segment : segments)
+				http_reassembler.push_server_payload(segment, timestamp);
+			timestamp += std::chrono::microseconds(1);
+		}
+		if (!http_reassembler.is_idle())
+			state.SkipWithError("the exchange is not complete");
+		state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * (request.size() + response.size())));
+	}
+	BENCHMARK_CAPTURE(BM_ReassembleResponse, content_length, false)->RangeMultiplier(4)->Range(64, 64 << 10);
+	BENCHMARK_CAPTURE(BM_ReassembleResponse, chunked, true)->RangeMultiplier(4)->Range(64, 64 << 10);
+}
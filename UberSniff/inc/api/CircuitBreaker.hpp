@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include "timing/Clock.hpp"
+
+namespace ubersniff::api {
+	/*
+	* Circuit breaker protecting UberBack from reconnect storms
+	* After `threshold` consecutive failures the circuit opens and no upload is allowed
+	*  until the cooldown expires, then a single trial upload is let through (half open)
+	* The cooldown runs on the clock of the pipeline
+	*/
+	class CircuitBreaker {
+	public:
+		enum class State {
+			CLOSED = 0,
+			OPEN,
+			HALF_OPEN
+		};
+
+	private:
+		const size_t _threshold;
+		const std::chrono::milliseconds _cooldown;
+
+		mutable std::mutex _mutex;
+		State _state;
+		size_t _consecutive_failures;
+		bool _is_trial_running;
+		timing::Clock::TimePoint _opened_at;
+
+	public:
+		CircuitBreaker(size_t threshold, std::chrono::milliseconds cooldown) noexcept;
+		~CircuitBreaker() = default;
+
+		/*
+		** Returns true if an upload can be started now
+		** In half open state only one trial upload is allowed at a time
+		*/
+		bool allow_request() noexcept;
+		void record_success() noexcept;
+		void record_failure() noexcept;
+
+		State get_state() const noexcept;
+		// true while the trial upload of the half open state is in progress
+		bool is_trial_running() const noexcept;
+		// time left before the circuit goes half open (zero if it is not open)
+		std::chrono::milliseconds get_remaining_cooldown() const noexcept;
+	};
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <type_traits>
+#include <new>
+#include <utility>
+
+namespace ubersniff::api {
+	/*
+	* Memory recycled for the handlers of the asynchronous operations of a session
+	* A session has only one operation chain in progress: a few slots are enough to hold
+	*  the state of an operation and of the composed operations it starts
+	* The allocations that don't fit in a slot fall back to the heap and are counted
+	*/
+	class HandlerMemory {
+		static constexpr size_t NB_SLOTS = 4;
+		static constexpr size_t SLOT_SIZE = 1024;
+
+		struct alignas(std::max_align_t) Slot {
+			unsigned char data[SLOT_SIZE];
+		};
+
+		Slot _slots[NB_SLOTS];
+		std::atomic<bool> _is_slot_used[NB_SLOTS];
+		std::atomic<size_t>& _heap_allocations;
+
+	public:
+		explicit HandlerMemory(std::atomic<size_t>& heap_allocations) noexcept :
+			_heap_allocations(heap_allocations)
+		{
+			for (auto& is_slot_used : _is_slot_used)
+				is_slot_used = false;
+		}
+		HandlerMemory(const HandlerMemory&) = delete;
+		HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+		void* allocate(size_t size)
+		{
+			if (size <= SLOT_SIZE) {
+				for (size_t i = 0; i < NB_SLOTS; ++i) {
+					if (!_is_slot_used[i].exchange(true))
+						return _slots[i].data;
+				}
+			}
+			++_heap_allocations;
+			return ::operator new(size);
+		}
+
+		void deallocate(void* pointer) noexcept
+		{
+			for (size_t i = 0; i < NB_SLOTS; ++i) {
+				if (pointer == _slots[i].data) {
+					_is_slot_used[i] = false;
+					return;
+				}
+			}
+			::operator delete(pointer);
+		}
+	};
+
+	/*
+	* Allocator associated with the handlers, it allocates in the HandlerMemory of the session
+	*/
+	template <typename T>
+	class HandlerAllocator {
+		HandlerMemory& _memory;
+
+		template <typename> friend class HandlerAllocator;
+	public:
+		using value_type = T;
+
+		explicit HandlerAllocator(HandlerMemory& memory) noexcept :
+			_memory(memory)
+		{}
+
+		template <typename U>
+		HandlerAllocator(const HandlerAllocator<U>& other) noexcept :
+			_memory(other._memory)
+		{}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(_memory.allocate(sizeof(T) * n));
+		}
+
+		void deallocate(T* pointer, size_t) noexcept
+		{
+			_memory.deallocate(pointer);
+		}
+
+		template <typename U>
+		bool operator==(const HandlerAllocator<U>& other) const noexcept
+		{
+			return &_memory == &other._memory;
+		}
+
+		template <typename U>
+		bool operator!=(const HandlerAllocator<U>& other) const noexcept
+		{
+			return &_memory != &other._memory;
+		}
+	};
+
+	/*
+	* Wrap a handler to associate it with a HandlerAllocator (found by asio::associated_allocator)
+	*/
+	template <typename Handler>
+	class AllocHandler {
+		HandlerMemory& _memory;
+		Handler _handler;
+
+	public:
+		using allocator_type = HandlerAllocator<Handler>;
+
+		AllocHandler(HandlerMemory& memory, Handler handler) :
+			_memory(memory),
+			_handler(std::move(handler))
+		{}
+
+		allocator_type get_allocator() const noexcept
+		{
+			return allocator_type(_memory);
+		}
+
+		template <typename ...Args>
+		void operator()(Args&&... args)
+		{
+			_handler(std::forward<Args>(args)...);
+		}
+	};
+
+	/*
+	* Allocator of the HTTP header fields of a session, in a memory pool of the session
+	* A field replaced by the next upload goes back to the pool and is reused, the pool only grows with the largest header
+	*/
+	template <typename T>
+	class FieldsAllocator {
+		std::pmr::memory_resource* _memory;
+
+		template <typename> friend class FieldsAllocator;
+	public:
+		using value_type = T;
+		using propagate_on_container_copy_assignment = std::true_type;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::true_type;
+
+		FieldsAllocator(std::pmr::memory_resource* memory) noexcept :
+			_memory(memory)
+		{}
+
+		template <typename U>
+		FieldsAllocator(const FieldsAllocator<U>& other) noexcept :
+			_memory(other._memory)
+		{}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(_memory->allocate(sizeof(T) * n, alignof(T)));
+		}
+
+		void deallocate(T* pointer, size_t n) noexcept
+		{
+			_memory->deallocate(pointer, sizeof(T) * n, alignof(T));
+		}
+
+		template <typename U>
+		bool operator==(const FieldsAllocator<U>& other) const noexcept
+		{
+			return _memory == other._memory;
+		}
+
+		template <typename U>
+		bool operator!=(const FieldsAllocator<U>& other) const noexcept
+		{
+			return _memory != other._memory;
+		}
+	};
+
+	template <typename Handler>
+	inline AllocHandler<Handler> make_alloc_handler(HandlerMemory& memory, Handler handler)
+	{
+		return AllocHandler<Handler>(memory, std::move(handler));
+	}
+}
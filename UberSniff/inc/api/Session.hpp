@@ -1,21 +1,33 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <optional>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/connect.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ssl/error.hpp>
 #include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/certify/extensions.hpp>
 #include <boost/certify/https_verification.hpp>
+#include "api/HandlerAllocator.hpp"
 
 namespace ubersniff::api {
 	using tcp = boost::asio::ip::tcp;
 	namespace ssl = boost::asio::ssl;
 	namespace http = boost::beast::http;
 
-	class Session: public std::enable_shared_from_this<Session> {
+	/*
+	* HTTPS session used to post the uploads to UberBack
+	* A session is recycled between the uploads: the connection is kept alive when the server allows it
+	*  and the memory of the handlers is reused
+	* The handlers of a session run in its strand, so a session never needs a lock
+	*/
+	class Session {
 	public:
 		struct Request {
 			const char* host;
@@ -27,16 +39,52 @@ namespace ubersniff::api {
 			size_t content_length;
 		};
 
+		// Called once per upload when it is over, with true if the server accepted it
+		// and the HTTP status of the response (0 if no response has been received)
+		using CompletionHandler = std::function<void(Session&, bool, unsigned)>;
+
 	private:
-		ssl::context _ctx;
+		using Strand = boost::asio::strand<boost::asio::io_context::executor_type>;
+		using Fields = http::basic_fields<FieldsAllocator<char>>;
+
+		// all the handlers of the session are serialized by its strand, bound to each handler:
+		//  the I/O objects use the executor of the io context, which fits in their type-erased executor
+		Strand _strand;
+		ssl::context& _ctx;
 		tcp::resolver _resolver;
-		ssl::stream<tcp::socket> _socket;
-        boost::beast::flat_buffer _buffer; // (Must persist between reads)
-		http::request<http::string_body> _request;
-		http::response<http::string_body> _response;
+		std::optional<ssl::stream<tcp::socket>> _socket;
+		boost::beast::flat_buffer _buffer; // (Must persist between reads)
+		std::pmr::unsynchronized_pool_resource _fields_memory;
+		http::request<http::string_body, Fields> _request;
+		http::response<http::string_body, Fields> _response;
+		HandlerMemory _handler_memory;
+		const CompletionHandler _completion_handler;
+		std::atomic<size_t>& _connections;
+
+		const char* _host;
+		const char* _port;
+		bool _is_running;
+		bool _is_connected;
+		bool _is_reused_connection;
+		bool _is_success;
+		unsigned _status;
+
+		void _start();
+		void _connect();
+		void _write();
+		bool _is_connection_idle() noexcept;
+		void _close() noexcept;
+		void _fail(boost::system::error_code ec, char const* what);
+		void _complete(bool is_success);
 
+		template <typename Handler>
+		boost::asio::executor_binder<AllocHandler<Handler>, Strand> _make_handler(Handler handler)
+		{
+			return boost::asio::bind_executor(_strand, make_alloc_handler(_handler_memory, std::move(handler)));
+		}
 	public:
-		explicit Session(boost::asio::io_context& ioc);
+		Session(boost::asio::io_context& ioc, ssl::context& ctx, CompletionHandler completion_handler,
+			std::atomic<size_t>& connections, std::atomic<size_t>& handler_heap_allocations);
 		~Session() = default;
 
 		void on_shutdown(boost::system::error_code ec);
@@ -45,6 +93,6 @@ namespace ubersniff::api {
 		void on_handshake(boost::system::error_code ec);
 		void on_connect(boost::system::error_code ec);
 		void on_resolve(boost::system::error_code ec, tcp::resolver::results_type results);
-		void send_post_async(Session::Request request);
+		void send_post_async(const Session::Request& request);
 	};
 }
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace ubersniff::api {
+	/*
+	* Durable spool of serialized uploads
+	* The uploads are appended to a log of fixed-size memory-mapped segments on the local disk
+	* Each record is framed with its length and a CRC so a torn write is detected on recovery
+	* When the spool is full the oldest segment is evicted, except the segment of the record being replayed
+	* The writes are flushed to the disk in batches by a dedicated thread, every sync interval:
+	*  a crash of the process loses nothing, a crash of the system loses the last interval
+	* The flush runs outside the lock of the spool, the appends don't wait for the disk
+	*/
+	class Spool {
+	public:
+		// Identifier of a record, increasing in the order of the records
+		using RecordId = uint64_t;
+
+		struct Config {
+			// Directory of the segments, the spool is disabled when it is empty
+			std::string directory;
+			size_t segment_size = 4 * 1024 * 1024;
+			size_t max_size = 256 * 1024 * 1024;
+			std::chrono::milliseconds sync_interval{ 1000 };
+		};
+
+	private:
+		static constexpr uint32_t RECORD_MAGIC = 0x55534e46; // "USNF"
+
+		enum class RecordState : uint32_t {
+			PENDING = 0,
+			CONSUMED = 1
+		};
+
+		/*
+		* Header written before the payload of each record
+		* The magic is written last: a record without magic doesn't exist
+		*/
+		struct RecordHeader {
+			uint32_t magic;
+			uint32_t state;
+			uint32_t length;
+			uint32_t crc;
+		};
+
+		struct Segment {
+			uint64_t id;
+			std::filesystem::path path;
+			boost::interprocess::file_mapping file;
+			boost::interprocess::mapped_region region;
+			size_t write_offset = 0;
+			size_t pending_records = 0;
+			// range written since the last sync, empty when dirty_end is 0
+			size_t dirty_begin = 0;
+			size_t dirty_end = 0;
+			// flushed outside the lock: the segment is not unmapped until the flush is over
+			bool is_syncing = false;
+		};
+
+		struct DirtyRange {
+			Segment* segment;
+			size_t offset;
+			size_t size;
+		};
+
+		struct RecordPosition {
+			RecordId id;
+			Segment* segment;
+			size_t offset;
+		};
+
+		const Config _config;
+
+		mutable std::mutex _mutex_spool;
+		std::map<uint64_t, std::unique_ptr<Segment>> _segments;
+		// segments removed while they were flushed, unmapped and deleted once the flush is over
+		std::vector<std::unique_ptr<Segment>> _removed_segments;
+		std::deque<RecordPosition> _records;
+		RecordId _next_record_id;
+		// record read by front() and not popped yet, its segment is not evicted
+		std::optional<RecordId> _replayed_record_id;
+		size_t _pending_bytes;
+		size_t _evicted_bytes;
+
+		std::mutex _mutex_stop;
+		std::condition_variable _stop_condition;
+		bool _is_stopping;
+		std::thread _sync_thread;
+
+		std::filesystem::path _get_segment_path(uint64_t id) const;
+		Segment& _create_segment(uint64_t id);
+		void _open_segment(uint64_t id);
+		void _recover_segment(Segment& segment);
+		void _remove_segment(uint64_t id);
+		static void _delete_segment(std::unique_ptr<Segment> segment);
+		void _evict_segment(Segment& segment);
+		bool _evict_oldest_segment();
+		Segment* _get_writable_segment(size_t record_size);
+		static void _mark_dirty(Segment& segment, size_t offset, size_t size) noexcept;
+		void _sync_segments();
+		void _run_sync();
+
+		static size_t _get_record_size(size_t length) noexcept;
+		static uint32_t _compute_crc(const char* data, size_t length) noexcept;
+	public:
+		explicit Spool(const Spool::Config& config);
+		Spool(const Spool&) = delete;
+		Spool& operator=(const Spool&) = delete;
+		~Spool();
+
+		/*
+		** Append a record at the end of the spool
+		** Returns false if the record is bigger than a segment, or if the spool is full of the record being replayed
+		*/
+		bool append(const std::string& record);
+		/*
+		** Read the oldest pending record, returns false if the spool is empty
+		** The record is kept until it is popped, its segment is not evicted meanwhile
+		*/
+		bool front(std::string& record, RecordId& id);
+		// Mark the record read by front() as consumed, nothing is done if it is not pending anymore
+		void pop(RecordId id);
+
+		size_t depth() const noexcept;
+		// size in bytes of the pending records
+		size_t size() const noexcept;
+		// size in bytes of the records lost by eviction
+		size_t evicted_size() const noexcept;
+	};
+}
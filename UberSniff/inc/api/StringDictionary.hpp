@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ubersniff::api {
+	/*
+	* Dictionary of the strings shared with UberBack for the delta upload format
+	* Each string gets a small integer id, its definition is sent until UberBack acknowledges it
+	* The dictionary is identified by an epoch, a new epoch starts when the dictionary is full
+	*/
+	class StringDictionary {
+		const size_t _max_size;
+
+		mutable std::mutex _mutex_dictionary;
+		uint64_t _epoch;
+		std::unordered_map<std::string, uint32_t> _ids;
+		std::vector<const std::string*> _strings;
+		std::vector<bool> _is_acknowledged;
+
+		void _reset() noexcept;
+	public:
+		explicit StringDictionary(size_t max_size);
+		~StringDictionary() = default;
+
+		/*
+		** Get the id of the string, a new id is assigned if the string is unknown
+		** is_defined is set at false when the definition must be sent with the id
+		*/
+		uint32_t intern(const std::string& str, bool& is_defined);
+		// Returns false if the id doesn't belong to the epoch
+		bool get(uint64_t epoch, uint32_t id, std::string& str) const;
+
+		// Ensure the dictionary can take new strings, starts a new epoch when it is full
+		uint64_t prepare(size_t nb_new_strings);
+		uint64_t get_epoch() const noexcept;
+
+		// UberBack knows the definitions of the ids
+		void acknowledge(uint64_t epoch, const std::vector<uint32_t>& ids);
+		// UberBack has lost the dictionary: every definition has to be sent again
+		void forget_acknowledgements(uint64_t epoch) noexcept;
+
+		size_t size() const noexcept;
+	};
+}
@@ -1,9 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <set>
 #include <boost/asio.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/thread/thread.hpp>
+#include "api/CircuitBreaker.hpp"
 #include "api/Session.hpp"
+#include "api/Spool.hpp"
+#include "api/encoder/IEncoder.hpp"
+#include "api/UploadQueue.hpp"
 #include "collector/DataBatch.hpp"
+#include "metrics/Registry.hpp"
+#include "timing/Clock.hpp"
 
 namespace ubersniff::api {
 	class UberBack {
@@ -14,23 +25,147 @@ namespace ubersniff::api {
 			std::string port;
 			std::string token;
 			std::string userId;
+
+			// Threads running the network I/O and the serialization of the batches
+			size_t network_threads = 2;
+			size_t serialization_threads = 1;
+
+			// Upload policy
+			size_t max_queue_size = 16 * 1024 * 1024;
+			size_t max_concurrent_uploads = 2;
+			size_t max_retries = 5;
+			std::chrono::milliseconds retry_base_delay{ 500 };
+			std::chrono::milliseconds retry_max_delay{ 60000 };
+			size_t circuit_breaker_threshold = 5;
+			std::chrono::milliseconds circuit_breaker_cooldown{ 30000 };
+
+			// Format of the uploads: "json", "delta" (dictionary of strings shared with UberBack) or "cbor"
+			std::string format = "json";
+			size_t dictionary_size = 65536;
+
+			// Disk spool used while UberBack is unreachable
+			Spool::Config spool;
+		};
+
+		/*
+		* Counters of the upload pipeline
+		*/
+		struct Metrics {
+			std::atomic<size_t> network_threads{ 0 };
+			std::atomic<size_t> serialization_threads{ 0 };
+			std::atomic<size_t> serializations{ 0 };
+			std::atomic<size_t> pending_batches{ 0 };
+			std::atomic<size_t> queue_depth{ 0 };
+			std::atomic<size_t> queue_bytes{ 0 };
+			std::atomic<size_t> in_flight{ 0 };
+			std::atomic<size_t> uploads{ 0 };
+			std::atomic<size_t> failures{ 0 };
+			std::atomic<size_t> retries{ 0 };
+			std::atomic<size_t> dropped_uploads{ 0 };
+			std::atomic<size_t> dropped_bytes{ 0 };
+			std::atomic<size_t> spooled_uploads{ 0 };
+			std::atomic<size_t> spool_depth{ 0 };
+			std::atomic<size_t> spool_bytes{ 0 };
+			std::atomic<size_t> spool_evicted_bytes{ 0 };
+			std::atomic<size_t> sessions{ 0 };
+			std::atomic<size_t> connections{ 0 };
+			std::atomic<size_t> handler_heap_allocations{ 0 };
 		};
 
 	private:
+		static constexpr std::chrono::milliseconds FLUSH_POLL_INTERVAL{ 10 };
+		// format of the spool records, the records of version 1 have no header
+		static constexpr unsigned SPOOL_RECORD_VERSION = 2;
+
 		const Config _config;
 		boost::asio::io_context _io_context;
 		boost::asio::executor_work_guard<boost::asio::io_context::executor_type> _work;
 		boost::thread_group _worker_threads;
-		
-		std::string _convert_data_batch_to_json(const collector::DataBatches& data_batches) const;
-		void _convert_texts_to_json(const std::unordered_map<std::string, int>& texts, std::stringstream& body) const;
-		void _convert_images_to_json(const std::unordered_map<std::string, int>& images, std::stringstream& body) const;
+		// CPU-heavy work (serialization) is kept away from the network threads
+		boost::asio::thread_pool _serialization_pool;
+
+		/*
+		* Session recycled between the uploads, with the upload it is sending
+		*/
+		struct UploadSlot {
+			std::unique_ptr<Session> session;
+			std::shared_ptr<Upload> upload;
+			std::chrono::steady_clock::time_point started_at;
+		};
+
+		/*
+		* Export of a counter of Metrics in the metrics registry
+		*/
+		struct ExportedMetric {
+			const char* name;
+			const char* help;
+			bool is_counter;
+			std::atomic<size_t> Metrics::* value;
+		};
+		static const ExportedMetric _exported_metrics[];
+
+		ssl::context _ssl_context;
+		std::mutex _mutex_upload_slots;
+		std::vector<std::unique_ptr<UploadSlot>> _upload_slots;
+		std::vector<UploadSlot*> _idle_upload_slots;
+
+		UploadQueue _upload_queue;
+		CircuitBreaker _circuit_breaker;
+		std::unique_ptr<Spool> _spool;
+		std::atomic<bool> _is_spool_replaying;
+		std::unique_ptr<encoder::IEncoder> _encoder;
+		Metrics _metrics;
+		metrics::Counter& _upload_bytes;
+		// duration of the serialization of the data batches in nanoseconds
+		metrics::Histogram& _serialization_latency;
+		// duration of an upload attempt in nanoseconds
+		metrics::Histogram& _upload_latency;
+		std::atomic<bool> _is_stopping;
+
+		std::mutex _mutex_timers;
+		std::set<std::shared_ptr<boost::asio::steady_timer>> _timers;
+		std::atomic<bool> _is_wake_up_scheduled;
+
+		std::mutex _mutex_jitter_generator;
+		std::mt19937 _jitter_generator;
+
+		static std::unique_ptr<encoder::IEncoder> _make_encoder(const UberBack::Config& config);
 
 		void _analyze_data_async(collector::DataBatches data_batches);
+
+		void _enqueue_upload(std::shared_ptr<Upload> upload, bool front = false);
+		void _pump_uploads();
+		void _start_upload(std::shared_ptr<Upload> upload);
+		UploadSlot& _acquire_upload_slot();
+		void _on_session_complete(UploadSlot& upload_slot, bool is_success, unsigned status);
+		void _on_upload_complete(std::shared_ptr<Upload> upload, bool is_success, unsigned status);
+		void _drop_upload(const Upload& upload);
+		bool _make_self_contained(Upload& upload) const;
+		bool _spool_upload(const Upload& upload);
+		static bool _parse_spooled_upload(Upload& upload);
+		bool _pop_spooled_upload(std::shared_ptr<Upload>& upload);
+		void _on_spooled_upload_complete(const Upload& upload, bool is_success);
+		void _update_queue_metrics() noexcept;
+		void _register_metrics();
+		void _unregister_metrics();
+
+		std::chrono::milliseconds _get_retry_delay(size_t attempt);
+		void _schedule(std::chrono::milliseconds delay, std::function<void()> callback,
+			std::function<void()> cancel_callback = nullptr);
+		void _wait_timer(std::shared_ptr<boost::asio::steady_timer> timer, timing::Clock::TimePoint deadline,
+			std::function<void()> callback, std::function<void()> cancel_callback);
 	public:
-		explicit UberBack(const UberBack::Config& confi) noexcept;
+		explicit UberBack(const UberBack::Config& config);
 		~UberBack();
 
 		void analyze_data(collector::DataBatches data_batches);
+
+		/*
+		** Wait until the data batches given are serialized and uploaded, or the deadline is reached
+		** Returns false if uploads are still pending, they are written in the spool when UberBack is destroyed
+		*/
+		bool flush(std::chrono::steady_clock::time_point deadline);
+
+		const Metrics& get_metrics() const noexcept;
 	};
 }
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "collector/DataBatch.hpp"
+#include "trace/Record.hpp"
+
+namespace ubersniff::api {
+	/*
+	* Represent a serialized batch waiting to be uploaded to UberBack
+	*/
+	struct Upload {
+		std::string content_type;
+		std::string body;
+		// number of attempts already made for this upload
+		size_t attempt = 0;
+		// true if the upload is replayed from the spool
+		bool is_spooled = false;
+		// record of the spool replayed
+		uint64_t spool_record_id = 0;
+
+		// Delta format: ids of the dictionary used by the body
+		uint64_t dictionary_epoch = 0;
+		std::vector<uint32_t> dictionary_ids;
+		// position of the data batches in the body, after the dictionary definitions
+		size_t payload_offset = 0;
+		// data batches encoded, to encode them again as JSON when the dictionary has lost their strings
+		std::shared_ptr<const collector::DataBatches> data_batches;
+
+		// Sampled exchanges included in the upload
+		std::vector<trace::RecordPtr> traces;
+	};
+
+	/*
+	* Queue of uploads bounded in memory
+	* When the limit is reached the oldest uploads are dropped to make room for the new ones
+	*/
+	class UploadQueue {
+		const size_t _max_size;
+
+		mutable std::mutex _mutex_uploads;
+		std::deque<std::shared_ptr<Upload>> _uploads;
+		size_t _size;
+
+	public:
+		explicit UploadQueue(size_t max_size) noexcept;
+		~UploadQueue() = default;
+
+		/*
+		** Push an upload at the end of the queue (or at the front for a retried upload)
+		** Returns the uploads dropped to respect the memory limit
+		*/
+		std::deque<std::shared_ptr<Upload>> push(std::shared_ptr<Upload> upload, bool front = false);
+		bool pop(std::shared_ptr<Upload>& upload) noexcept;
+
+		size_t depth() const noexcept;
+		// total size in bytes of the queued bodies
+		size_t size() const noexcept;
+	};
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include "api/encoder/IEncoder.hpp"
+
+namespace ubersniff::api::encoder {
+	/*
+	* Binary encoder: the data batches are sent as CBOR (RFC 7049)
+	* Strings are length-prefixed and integers use the variable-length CBOR heads
+	* The counts are [content, nb] pairs like in the delta encoder, instead of the {"content":..,"nb":..} objects of JSON
+	* {"userId":..,"service":..,"dataBatches":[{"urlSrc":..,"texts":[[content,nb],..],"images":[[content,nb],..]},..]}
+	*/
+	class CborEncoder : public IEncoder {
+		enum class MajorType : uint8_t {
+			UNSIGNED_INTEGER = 0,
+			NEGATIVE_INTEGER = 1,
+			BYTE_STRING = 2,
+			TEXT_STRING = 3,
+			ARRAY = 4,
+			MAP = 5
+		};
+
+		const std::string _user_id;
+		const std::string _service;
+
+		void _convert_counts_to_cbor(const char* name, const std::unordered_map<std::string, int>& counts, std::string& body) const;
+
+		static void _write_head(MajorType type, uint64_t value, std::string& body);
+		static void _write_string(const char* str, size_t size, std::string& body);
+		static void _write_string(const char* str, std::string& body);
+		static void _write_string(const std::string& str, std::string& body);
+		static void _write_integer(long long value, std::string& body);
+	public:
+		CborEncoder(const std::string& user_id, const std::string& service);
+		virtual ~CborEncoder() = default;
+
+		void encode(const collector::DataBatches& data_batches, Upload& upload);
+	};
+}
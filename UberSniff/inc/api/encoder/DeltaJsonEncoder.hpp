@@ -0,0 +1,39 @@
+#pragma once
+
+#include <mutex>
+#include "api/StringDictionary.hpp"
+#include "api/encoder/IEncoder.hpp"
+
+namespace ubersniff::api::encoder {
+	/*
+	* Delta encoder: the strings are replaced by their id in a dictionary shared with UberBack
+	* The definitions of the ids not acknowledged yet are sent in the header:
+	* {"userId":..,"service":..,"dictionary":{"epoch":..,"strings":[[id,"string"],..]},
+	*  "dataBatches":[{"urlSrc":id,"texts":[[id,nb],..],"images":[[id,nb],..]},..]}
+	* The counts are the ones collected since the previous extraction of the data batches
+	*/
+	class DeltaJsonEncoder : public IEncoder {
+		const std::string _user_id;
+		const std::string _service;
+
+		std::mutex _mutex_encoding;
+		StringDictionary _dictionary;
+
+		void _convert_counts_to_delta_json(const char* name, const std::unordered_map<std::string, int>& counts,
+			std::string& body, std::vector<uint32_t>& definitions, Upload& upload);
+		uint32_t _intern_string(const std::string& str, std::vector<uint32_t>& definitions, Upload& upload);
+		std::string _get_header(uint64_t epoch, const std::vector<uint32_t>& definitions) const;
+	public:
+		DeltaJsonEncoder(const std::string& user_id, const std::string& service, size_t dictionary_size);
+		virtual ~DeltaJsonEncoder() = default;
+
+		void encode(const collector::DataBatches& data_batches, Upload& upload);
+
+		// Rewrite the header with the definitions of all the strings used by the upload
+		bool make_self_contained(Upload& upload);
+		// Acknowledge the ids of the upload
+		void on_upload_accepted(const Upload& upload);
+		// Every definition has to be sent again
+		void on_state_lost(const Upload& upload);
+	};
+}
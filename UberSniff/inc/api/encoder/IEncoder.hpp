@@ -0,0 +1,27 @@
+#pragma once
+
+#include "api/UploadQueue.hpp"
+#include "collector/DataBatch.hpp"
+
+namespace ubersniff::api::encoder {
+	/*
+	* Encoder of the data batches sent to UberBack
+	*/
+	class IEncoder {
+	public:
+		virtual ~IEncoder() = default;
+
+		// Fill the content type and the body of the upload with the data batches
+		virtual void encode(const collector::DataBatches& data_batches, Upload& upload) = 0;
+
+		/*
+		** Rewrite the upload to be readable by UberBack without any state shared with it
+		** Returns false if the upload can't be rewritten anymore
+		*/
+		virtual bool make_self_contained(Upload&) { return true; }
+		// UberBack accepted the upload
+		virtual void on_upload_accepted(const Upload&) {}
+		// UberBack lost the state shared with the encoder
+		virtual void on_state_lost(const Upload&) {}
+	};
+}
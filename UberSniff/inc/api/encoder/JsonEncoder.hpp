@@ -0,0 +1,27 @@
+#pragma once
+
+#include "api/encoder/IEncoder.hpp"
+
+namespace ubersniff::api::encoder {
+	/*
+	* Default encoder: the data batches are sent as JSON
+	*/
+	class JsonEncoder : public IEncoder {
+		const std::string _user_id;
+		const std::string _service;
+		// the batches and the counts are written in the order of their keys
+		const bool _is_sorted;
+
+		void _convert_counts_to_json(const char* name, const std::unordered_map<std::string, int>& counts, std::string& body) const;
+	public:
+		// sorted gives the same output for the same data batches, at the cost of a sort
+		JsonEncoder(const std::string& user_id, const std::string& service, bool is_sorted = false);
+		virtual ~JsonEncoder() = default;
+
+		void encode(const collector::DataBatches& data_batches, Upload& upload);
+
+		// Append the string as a JSON string, quoted and escaped
+		static void write_string(const std::string& str, std::string& body);
+		static void write_integer(long long value, std::string& body);
+	};
+}
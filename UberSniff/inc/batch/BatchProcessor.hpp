@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "collector/DataBatch.hpp"
+#include "collector/DataCollector.hpp"
+#include "metrics/Registry.hpp"
+#include "sniffer/http/Sniffer.hpp"
+
+namespace ubersniff::batch {
+	/*
+	* Extraction of a set of capture files, in parallel
+	* Each file is replayed by its own pipeline, a sniffer reading the file as fast as possible and a collector,
+	*  so the throughput grows with the number of files processed at once
+	* The data batches of the files are merged in the order of the files: the result doesn't depend on the timing
+	*/
+	class BatchProcessor {
+	public:
+		// Returns true when the processing should stop
+		using CancellationCheck = std::function<bool()>;
+
+	private:
+		static constexpr std::chrono::milliseconds POLL_INTERVAL{ 1 };
+
+		struct Metrics {
+			metrics::Counter& processed_files;
+			metrics::Counter& failed_files;
+		};
+
+		sniffer::http::Sniffer::Config _sniffer_config;
+		const collector::DataCollector::Config _collector_config;
+		const size_t _parallelism;
+
+		Metrics _metrics;
+
+		collector::DataBatches _process_file(const std::string& filename, const CancellationCheck& is_cancelled);
+	public:
+		// parallelism is the number of files processed at once, the number of hardware threads at 0
+		BatchProcessor(const sniffer::http::Sniffer::Config& sniffer_config,
+			const collector::DataCollector::Config& collector_config, size_t parallelism);
+		~BatchProcessor() = default;
+
+		/*
+		** The regular files of a directory, or the files matching a glob pattern (* and ?) on the file name
+		** Returns the paths in lexicographic order
+		*/
+		static std::vector<std::string> find_files(const std::string& pattern);
+
+		/*
+		** Replay the files and merge their data batches
+		** A file which can't be read is skipped, the files left are skipped when the processing is cancelled
+		*/
+		collector::DataBatches process(const std::vector<std::string>& filenames, const CancellationCheck& is_cancelled);
+
+		// Add the counts of the data batches to the merged data batches
+		static void merge(collector::DataBatches& merged_data_batches, collector::DataBatches&& data_batches);
+
+		size_t get_parallelism() const noexcept { return _parallelism; }
+	};
+}
@@ -3,6 +3,8 @@
 #include <string>
 #include <list>
 #include <unordered_map>
+#include <vector>
+#include "trace/Record.hpp"
 
 namespace ubersniff::collector {
     /*
@@ -13,6 +15,8 @@ namespace ubersniff::collector {
         std::unordered_map<std::string, int> images;
         // Batch of images: key is the text itself and the value is the number of time it appears
         std::unordered_map<std::string, int> texts;
+        // Sampled exchanges included in the batch
+        std::vector<trace::RecordPtr> traces;
     };
 
     /*
@@ -1,14 +1,52 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <mutex>
 #include <queue>
 #include "packet/Exchange.hpp"
 #include "collector/DataBatch.hpp"
+#include "collector/ExtractionCache.hpp"
+#include "metrics/Registry.hpp"
+#include "timing/Clock.hpp"
 
 namespace ubersniff::collector {
 	class DataCollector {
+	public:
+		struct Config {
+			// text pages whose extracted lines are kept, the cache is disabled at 0
+			size_t extraction_cache_size = 4096;
+		};
+
+	private:
+		struct Metrics {
+			metrics::Gauge& text_queue_depth;
+			metrics::Gauge& image_queue_depth;
+			// processing time of an exchange in nanoseconds
+			metrics::Histogram& text_latency;
+			metrics::Histogram& image_latency;
+			metrics::Counter& skipped_text_exchanges;
+		};
+
+		// the gauges are the sum of the queues of all the collectors
+		Metrics _metrics;
+		// exchanges waiting in the queues of this collector
+		std::atomic<size_t> _queue_depth;
+
+		// 1 text exchange out of the ratio is extracted
+		std::atomic<size_t> _extraction_ratio;
+		size_t _text_exchanges_count;
+
 		std::mutex _mutex_data_batches;
 		DataBatches _data_batches;
+		// length of the batch windows, the exchanges are collected without window at 0
+		timing::Clock::Duration _batch_window;
+		// data batches of the windows, by start of the window
+		std::map<timing::Clock::TimePoint, DataBatches> _windows;
+
+		// used by the thread processing the exchanges
+		ExtractionCache _extraction_cache;
 
 		std::mutex _mutex_text_exchanges_queue;
 		std::queue<packet::Exchange> _text_exchanges_queue;
@@ -22,12 +60,15 @@ namespace ubersniff::collector {
 		void _push_text_exchange(packet::Exchange exchange);
 		bool _pop_text_exchange(packet::Exchange& exchange) noexcept;
 
+		DataBatches& _get_data_batches(const packet::Exchange& exchange);
+
 		void _remove_html_tag(std::string& str) const noexcept;
 		void _remove_multiple_space(std::string& str)  const noexcept;
 		std::list<std::string> _get_list_of_content(std::string str) const noexcept;
 	public:
-		DataCollector() = default;
-		~DataCollector() = default;
+		DataCollector();
+		explicit DataCollector(const DataCollector::Config& config);
+		~DataCollector();
 
 		/* 
 		** process_next_*_exchange will process the next exchange in the queue
@@ -42,7 +83,27 @@ namespace ubersniff::collector {
 		void collect_image_exchange(packet::Exchange exchange);
 		void collect_text_exchange(packet::Exchange exchange);
 
+		// Extract the content of 1 text exchange out of extraction_ratio, the others are dropped
+		void set_extraction_ratio(size_t extraction_ratio) noexcept;
+
+		// exchanges waiting in the queues to be processed
+		size_t get_queue_depth() const noexcept;
+
+		/*
+		** Cut the data batches by windows of the clock, on the time of the packets which completed the exchanges
+		** With the packet time, the exchanges of a replay fall in the same windows run after run
+		** Must be called before the exchanges are collected
+		*/
+		void set_batch_window(timing::Clock::Duration batch_window) noexcept;
+
+		/*
+		** Extract the data batches of the oldest window ended at the given time
+		** Returns false when no window is ended
+		*/
+		bool extract_ended_window(timing::Clock::TimePoint now, DataBatches& data_batches);
+
 		void dump() noexcept;
+		// Extract the data batches collected without window
 		DataBatches extract_data_batches();
 	};
 }
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "metrics/Registry.hpp"
+
+namespace ubersniff::collector {
+	/*
+	* LRU cache of the lines extracted from the text pages, a page reloaded unchanged is not cleaned again
+	* A page is found by a 64-bit hash of its host, its path and its body,
+	*  the last page extracted for a URI is also found by the URI to answer a 304 Not Modified
+	* Used by the thread processing the exchanges only
+	*/
+	class ExtractionCache {
+	public:
+		using Lines = std::vector<std::string>;
+
+	private:
+		struct Entry {
+			uint64_t hash;
+			std::string uri;
+			Lines lines;
+			// time saved by each hit
+			std::chrono::nanoseconds extraction_time;
+		};
+
+		struct Metrics {
+			metrics::Counter& hits;
+			metrics::Counter& misses;
+			metrics::Counter& saved_time;
+			metrics::Gauge& hit_ratio;
+		};
+
+		const size_t _max_size;
+		// most recently used first
+		std::list<Entry> _entries;
+		std::unordered_map<uint64_t, std::list<Entry>::iterator> _entries_by_hash;
+		std::unordered_map<std::string, std::list<Entry>::iterator> _entries_by_uri;
+
+		Metrics _metrics;
+
+		const Lines* _hit(std::list<Entry>::iterator entry) noexcept;
+		void _miss() noexcept;
+		void _update_hit_ratio() noexcept;
+	public:
+		// max_size is the number of pages kept, the cache is disabled at 0
+		explicit ExtractionCache(size_t max_size);
+		~ExtractionCache() = default;
+
+		bool is_enabled() const noexcept { return _max_size > 0; }
+
+		// Hash of the page, 8 bytes at a time
+		static uint64_t get_hash(const std::string& host, const std::string& path, const std::string& body) noexcept;
+
+		/*
+		** Returns the lines of the page or the last page of the URI, nullptr if it is not cached
+		** The lines stay valid until the next insert
+		*/
+		const Lines* find(uint64_t hash) noexcept;
+		const Lines* find_by_uri(const std::string& uri) noexcept;
+
+		// Add the lines extracted from a page, the least recently used page is evicted when the cache is full
+		const Lines& insert(uint64_t hash, const std::string& uri, Lines lines, std::chrono::nanoseconds extraction_time);
+
+		size_t size() const noexcept { return _entries.size(); }
+	};
+}
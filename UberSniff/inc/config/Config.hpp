@@ -1,16 +1,55 @@
 #pragma once
 
+#include <chrono>
 #include <pugixml.hpp>
 #include "api/UberBack.hpp"
+#include "collector/DataCollector.hpp"
+#include "governor/CpuGovernor.hpp"
+#include "ipc/PrivilegeSeparation.hpp"
+#include "metrics/MetricsServer.hpp"
+#include "sniffer/http/Sniffer.hpp"
+#include "trace/FlightRecorder.hpp"
+#include "trace/Tracer.hpp"
 
 namespace ubersniff::config {
 	class Config {
 		ubersniff::api::UberBack::Config _uberback_config;
+		ubersniff::collector::DataCollector::Config _collector_config;
+		ubersniff::metrics::MetricsServer::Config _metrics_config;
+		ubersniff::sniffer::http::Sniffer::Config _sniffer_config;
+		ubersniff::trace::Tracer::Config _trace_config;
+		ubersniff::trace::FlightRecorder::Config _flight_recorder_config;
+		ubersniff::governor::CpuGovernor::Config _cpu_governor_config;
+		ubersniff::ipc::PrivilegeSeparation::Config _privilege_separation_config;
+		// time to process the exchanges and to upload the batches left on quit
+		std::chrono::milliseconds _drain_timeout{ 5000 };
+		// length of the batch windows of a replay, in packet time
+		std::chrono::milliseconds _replay_batch_window{ 10000 };
+
+		void _parse_threads_config(const pugi::xml_node& threads_config);
+		void _parse_upload_config(const pugi::xml_node& upload_config);
+		void _parse_spool_config(const pugi::xml_node& spool_config);
+		void _parse_metrics_config(const pugi::xml_node& metrics_config);
+		void _parse_sniffer_config(const pugi::xml_node& sniffer_config);
+		void _parse_collector_config(const pugi::xml_node& collector_config);
+		void _parse_trace_config(const pugi::xml_node& trace_config);
+		void _parse_flight_recorder_config(const pugi::xml_node& flight_recorder_config);
+		void _parse_cpu_governor_config(const pugi::xml_node& cpu_governor_config);
+		void _parse_privilege_separation_config(const pugi::xml_node& privilege_separation_config);
 
 	public:
 		Config(const std::string& filename);
 		virtual ~Config() = default;
 
 		const ubersniff::api::UberBack::Config &get_uberback_config() const noexcept;
+		const ubersniff::metrics::MetricsServer::Config &get_metrics_config() const noexcept;
+		const ubersniff::sniffer::http::Sniffer::Config &get_sniffer_config() const noexcept;
+		const ubersniff::collector::DataCollector::Config &get_collector_config() const noexcept;
+		const ubersniff::trace::Tracer::Config &get_trace_config() const noexcept;
+		const ubersniff::trace::FlightRecorder::Config &get_flight_recorder_config() const noexcept;
+		const ubersniff::governor::CpuGovernor::Config &get_cpu_governor_config() const noexcept;
+		const ubersniff::ipc::PrivilegeSeparation::Config &get_privilege_separation_config() const noexcept;
+		std::chrono::milliseconds get_drain_timeout() const noexcept;
+		std::chrono::milliseconds get_replay_batch_window() const noexcept;
 	};
 }
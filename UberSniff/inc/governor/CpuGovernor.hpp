@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include "metrics/Registry.hpp"
+
+namespace ubersniff::governor {
+	/*
+	* Keep the CPU time of the process under a budget, to stay in the background of the computer
+	* The CPU time used during each interval sets a level of throttling:
+	*  at the level L, 1 text exchange out of 2^L is extracted, the bodies are capped to max_body_size / 2^L
+	*  and the data batches are uploaded at most every L * batch_interval_step
+	* The level goes up when the budget is exceeded and down when less than half of the budget is used
+	*/
+	class CpuGovernor {
+	public:
+		struct Config {
+			// fraction of one core, the governor is disabled at 0
+			double budget = 0;
+			std::chrono::milliseconds interval{ 1000 };
+			size_t max_level = 4;
+			// bytes of body kept at the level 0
+			size_t max_body_size = 30000;
+			std::chrono::milliseconds batch_interval_step{ 2000 };
+		};
+
+	private:
+		const Config _config;
+		size_t _level;
+		std::chrono::steady_clock::time_point _last_update;
+		std::chrono::nanoseconds _last_cpu_time;
+
+		metrics::Gauge& _level_gauge;
+		metrics::Gauge& _usage_gauge;
+
+		static std::chrono::nanoseconds _get_process_cpu_time() noexcept;
+	public:
+		explicit CpuGovernor(const CpuGovernor::Config& config);
+		~CpuGovernor() = default;
+
+		/*
+		** Measure the CPU time used since the last interval, does nothing before the end of the interval
+		** Returns true if the level changed
+		*/
+		bool update() noexcept;
+
+		size_t get_level() const noexcept { return _level; }
+		// 1 text exchange out of the ratio is extracted
+		size_t get_extraction_ratio() const noexcept;
+		size_t get_max_body_size() const noexcept;
+		// minimum time between two uploads of the data batches
+		std::chrono::milliseconds get_batch_interval() const noexcept;
+	};
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace ubersniff::ipc {
+	/*
+	* Ring of captured frames in shared memory, between the capture process and the worker process
+	* Single producer single consumer: the frames are copied once from the pcap buffer into the ring
+	*  and read in place by the worker, the positions are published with atomics and the consumer is woken up
+	*  by an eventfd only when it sleeps
+	* The memory is created by memfd and mapped before the fork, Linux only
+	*/
+	class FrameRing {
+	public:
+		/*
+		* Header of a frame in the ring, followed by the bytes of the frame
+		*/
+		struct Frame {
+			uint32_t size;
+			int32_t link_type;
+			// capture time in microseconds since epoch
+			int64_t timestamp;
+			// length of the frame on the wire, size is the number of bytes captured
+			uint32_t length;
+
+			const uint8_t* data() const noexcept { return reinterpret_cast<const uint8_t*>(this + 1); }
+		};
+
+		/*
+		* Counters of the capture process, read by the worker
+		*/
+		struct Stats {
+			uint64_t kernel_accepted = 0;
+			uint64_t kernel_drops = 0;
+			uint64_t interface_drops = 0;
+			// frames dropped because the ring was full
+			uint64_t ring_drops = 0;
+		};
+
+	private:
+		static constexpr uint64_t MAGIC = 0x55424552524e4731ull;
+		// size of a frame marking the end of the ring, the next frame is at the beginning
+		static constexpr uint32_t PADDING = UINT32_MAX;
+
+		struct Header {
+			uint64_t magic;
+			uint64_t capacity;
+			// bytes written by the producer and read by the consumer since the creation, on their own cache line
+			alignas(64) std::atomic<uint64_t> head;
+			alignas(64) std::atomic<uint64_t> tail;
+			alignas(64) std::atomic<uint32_t> is_consumer_waiting;
+			std::atomic<uint32_t> is_closed;
+			// monotonic time of the last wake up, in nanoseconds
+			std::atomic<int64_t> notified_at;
+			std::atomic<uint64_t> kernel_accepted;
+			std::atomic<uint64_t> kernel_drops;
+			std::atomic<uint64_t> interface_drops;
+			std::atomic<uint64_t> ring_drops;
+		};
+		static_assert(std::atomic<uint64_t>::is_always_lock_free, "the atomics of the ring are shared between processes");
+
+		Header* _header;
+		uint8_t* _data;
+		uint64_t _mask;
+		int _event_fd;
+		// last positions read of the other side, the shared cache line is only read again when they are reached
+		uint64_t _cached_tail;
+		uint64_t _cached_head;
+
+		// the capture threads of the producer process are serialized, the ring has one producer
+		std::mutex _mutex_producer;
+
+		static uint64_t _get_record_size(uint32_t frame_size) noexcept;
+		static int64_t _get_monotonic_time() noexcept;
+		void _notify() noexcept;
+	public:
+		// capacity in bytes, rounded up to a power of 2
+		explicit FrameRing(size_t capacity);
+		FrameRing(const FrameRing&) = delete;
+		FrameRing& operator=(const FrameRing&) = delete;
+		~FrameRing();
+
+		/*
+		** Producer: copy the bytes captured of a frame into the ring
+		** Returns false if the frame is dropped because the ring is full
+		*/
+		bool push(int link_type, int64_t timestamp, const uint8_t* data, uint32_t size, uint32_t length);
+		// Producer: no frame follows, the consumer is woken up
+		void close() noexcept;
+		// Producer: publish the counters of the captures
+		void set_stats(const FrameRing::Stats& stats) noexcept;
+
+		// Consumer: next frame in place in the ring, nullptr when the ring is empty
+		const Frame* front() noexcept;
+		// Consumer: release the frame returned by front
+		void pop() noexcept;
+		/*
+		** Consumer: wait until a frame is available, the ring is closed or the timeout
+		** Returns the time from the wake up by the producer to the return, negative when not woken up
+		*/
+		std::chrono::nanoseconds wait(std::chrono::milliseconds timeout) noexcept;
+		// Consumer: true once the ring is closed and all its frames are read
+		bool is_finished() const noexcept;
+		FrameRing::Stats get_stats() const noexcept;
+
+		// Wake up the consumer from the consumer process, on stop
+		void interrupt() noexcept { _notify(); }
+	};
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include "ipc/FrameRing.hpp"
+
+namespace ubersniff::ipc {
+	/*
+	* Split of the sniffer in two processes, Linux only
+	* The process started with the capture privileges keeps only the capture and forwards the frames to a frame ring,
+	*  the worker process drops the privileges and runs the reassembly, the extraction and the uploads
+	* The capture process needs the rights to change of user (root or CAP_SETUID and CAP_SETGID)
+	*/
+	class PrivilegeSeparation {
+	public:
+		struct Config {
+			// user of the worker process, the privilege separation is disabled when empty
+			std::string user;
+			// bytes of the frame ring
+			size_t ring_size = 64 * 1024 * 1024;
+		};
+
+	private:
+		const PrivilegeSeparation::Config _config;
+		FrameRing _frame_ring;
+		// pid of the worker in the capture process, 0 in the worker process or once the worker exited
+		int _worker_pid;
+		int _worker_status;
+
+		void _drop_privileges() const;
+	public:
+		explicit PrivilegeSeparation(const PrivilegeSeparation::Config& config);
+		PrivilegeSeparation(const PrivilegeSeparation&) = delete;
+		PrivilegeSeparation& operator=(const PrivilegeSeparation&) = delete;
+		~PrivilegeSeparation();
+
+		/*
+		** Fork the worker process, must be called before any thread is started
+		** Returns true in the capture process, false in the worker process once its privileges are dropped
+		*/
+		bool fork_worker();
+
+		FrameRing& get_frame_ring() noexcept { return _frame_ring; }
+
+		// Capture process: false once the worker exited
+		bool is_worker_running();
+
+		/*
+		** Capture process: close the ring, ask the worker to drain its pipeline and wait for its exit
+		** Returns the exit code of the worker
+		*/
+		int stop_worker();
+	};
+}
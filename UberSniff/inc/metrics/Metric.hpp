@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ubersniff::metrics {
+	/*
+	* Index of the shard used by the current thread, assigned round-robin to the threads
+	*/
+	size_t get_shard_index() noexcept;
+
+	/*
+	* Monotonic counter sharded per thread: each thread increments its own cache line
+	*/
+	class Counter {
+	public:
+		static constexpr size_t NB_SHARDS = 16;
+
+	private:
+		struct alignas(64) Shard {
+			std::atomic<uint64_t> value{ 0 };
+		};
+
+		std::array<Shard, NB_SHARDS> _shards;
+
+	public:
+		Counter() = default;
+		Counter(const Counter&) = delete;
+		Counter& operator=(const Counter&) = delete;
+
+		void inc(uint64_t value = 1) noexcept
+		{
+			_shards[get_shard_index()].value.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		uint64_t value() const noexcept;
+	};
+
+	/*
+	* Value that can go up and down
+	*/
+	class Gauge {
+		std::atomic<int64_t> _value{ 0 };
+
+	public:
+		Gauge() = default;
+		Gauge(const Gauge&) = delete;
+		Gauge& operator=(const Gauge&) = delete;
+
+		void set(int64_t value) noexcept { _value.store(value, std::memory_order_relaxed); }
+		void inc(int64_t value = 1) noexcept { _value.fetch_add(value, std::memory_order_relaxed); }
+		void dec(int64_t value = 1) noexcept { _value.fetch_sub(value, std::memory_order_relaxed); }
+		int64_t value() const noexcept { return _value.load(std::memory_order_relaxed); }
+	};
+
+	/*
+	* HDR-style histogram: log-linear buckets with SUB_BUCKETS buckets per power of two
+	* The relative error of a recorded value is lower than 1 / SUB_BUCKETS
+	* The buckets are sharded per thread like the counters, the count is the total of the buckets
+	*/
+	class Histogram {
+	public:
+		static constexpr size_t SUB_BUCKETS_BITS = 7;
+		static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKETS_BITS;
+		static constexpr size_t NB_BUCKETS = (64 - SUB_BUCKETS_BITS + 1) * SUB_BUCKETS;
+		// 58 KB of buckets per shard, fewer shards than the counters
+		static constexpr size_t NB_SHARDS = 4;
+
+		// Counts read in one pass over the shards
+		struct Snapshot {
+			std::vector<uint64_t> buckets;
+			uint64_t count = 0;
+			uint64_t sum = 0;
+		};
+
+	private:
+		struct alignas(64) Shard {
+			std::array<std::atomic<uint64_t>, NB_BUCKETS> buckets;
+			std::atomic<uint64_t> sum;
+		};
+
+		std::array<Shard, NB_SHARDS> _shards;
+
+	public:
+		Histogram() noexcept;
+		Histogram(const Histogram&) = delete;
+		Histogram& operator=(const Histogram&) = delete;
+
+		void observe(uint64_t value) noexcept
+		{
+			auto& shard = _shards[get_shard_index() % NB_SHARDS];
+			shard.buckets[get_bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+			shard.sum.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		Snapshot snapshot() const;
+
+		static size_t get_bucket_index(uint64_t value) noexcept;
+		// highest value recorded in the bucket
+		static uint64_t get_bucket_upper_bound(size_t index) noexcept;
+	};
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/http/status.hpp>
+#include <boost/beast/http/verb.hpp>
+#include "metrics/Registry.hpp"
+
+namespace ubersniff::metrics {
+	/*
+	* HTTP endpoint exporting the metrics of a registry on GET /metrics
+	* Other handlers can be added for control commands, with POST for the commands which change the state
+	* The server runs in its own thread and should only listen on a local address
+	*/
+	class MetricsServer {
+	public:
+		struct Config {
+			std::string address = "127.0.0.1";
+			// the server is disabled when the port is empty
+			std::string port;
+		};
+
+		// Returns the body of the response
+		using Handler = std::function<std::string()>;
+
+	private:
+		class Connection;
+
+		struct Route {
+			boost::beast::http::verb method;
+			Handler handler;
+		};
+
+		Registry& _registry;
+		boost::asio::io_context _io_context;
+		boost::asio::ip::tcp::acceptor _acceptor;
+		// delays the next accept after an error, out of file descriptors the error repeats at once
+		boost::asio::steady_timer _accept_timer;
+		std::thread _thread;
+
+		std::mutex _mutex_handlers;
+		std::map<std::string, MetricsServer::Route> _handlers;
+
+		void _accept();
+		// Returns the status of the response, allowed_method is set when the method is not allowed
+		boost::beast::http::status _handle(boost::beast::http::verb method, const std::string& target, std::string& body,
+			boost::beast::http::verb& allowed_method);
+	public:
+		MetricsServer(const MetricsServer::Config& config, Registry& registry);
+		~MetricsServer();
+
+		// The handler is called by the server thread for the requests of the method on target
+		void add_handler(const std::string& target, Handler handler,
+			boost::beast::http::verb method = boost::beast::http::verb::get);
+	};
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "metrics/Metric.hpp"
+
+namespace ubersniff::metrics {
+	/*
+	* Registry of the metrics of the process, exported in the Prometheus text format
+	* A metric is identified by its name, labels can be given in the name: name{label="value"}
+	* The metrics are never removed: the references returned stay valid for the whole process
+	*/
+	class Registry {
+		enum class Type {
+			COUNTER,
+			GAUGE,
+			HISTOGRAM
+		};
+
+		struct Entry {
+			Type type;
+			std::string help;
+			std::unique_ptr<Counter> counter;
+			std::unique_ptr<Gauge> gauge;
+			std::unique_ptr<Histogram> histogram;
+			// value read at each export
+			std::function<double()> callback;
+		};
+
+		// Sort the metrics by family then by name, so the metrics of a family are exported together
+		struct FamilyLess {
+			bool operator()(const std::string& lhs, const std::string& rhs) const;
+		};
+
+		mutable std::mutex _mutex_entries;
+		std::map<std::string, Entry, FamilyLess> _entries;
+
+		Entry& _get_entry(const std::string& name, Type type, const std::string& help);
+		static std::string _get_family(const std::string& name);
+		static std::string _add_label(const std::string& name, const std::string& label);
+		static const char* _get_type_name(Type type) noexcept;
+		void _serialize_histogram(const std::string& name, const Histogram& histogram, std::string& output) const;
+	public:
+		Registry() = default;
+		~Registry() = default;
+
+		// Registry of the process
+		static Registry& get_default();
+
+		Counter& counter(const std::string& name, const std::string& help);
+		Gauge& gauge(const std::string& name, const std::string& help);
+		Histogram& histogram(const std::string& name, const std::string& help);
+
+		// Metrics owned by an other component, the callback must stay valid until unregister
+		void counter_callback(const std::string& name, const std::string& help, std::function<double()> callback);
+		void gauge_callback(const std::string& name, const std::string& help, std::function<double()> callback);
+		void unregister_callback(const std::string& name);
+
+		std::string serialize() const;
+	};
+}
@@ -2,6 +2,7 @@
 
 #include "packet/Response.hpp"
 #include "packet/Request.hpp"
+#include "timing/Clock.hpp"
 
 namespace ubersniff::packet {
 	/*
@@ -10,5 +11,7 @@ namespace ubersniff::packet {
 	struct Exchange {
 		Request request;
 		Response response;
+		// time of the packet which completed the exchange, it sets the batch window of the exchange
+		timing::Clock::TimePoint timestamp;
 	};
 }
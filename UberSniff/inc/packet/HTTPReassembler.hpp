@@ -1,8 +1,11 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <boost/regex.hpp>
 #include "collector/DataCollector.hpp"
+#include "metrics/Registry.hpp"
 #include "packet/Exchange.hpp"
 #include "packet/Response.hpp"
 #include "packet/Request.hpp"
@@ -21,11 +24,19 @@ namespace ubersniff::packet {
 			FINISHED
 		};
 
+		struct Metrics {
+			metrics::Counter& exchanges;
+			metrics::Counter& parse_errors;
+			metrics::Gauge& buffered_bytes;
+		};
+
 		static const boost::regex _http_request_regex;
 		static const boost::regex _http_response_regex;
 		// End of line delimiter
 		static constexpr std::array<uint8_t, 2> _eol_delimiter{ '\r', '\n' };
 		static constexpr std::array<char, 2> _header_value_delimiter{ ':', ' ' };
+		// bytes of a response body kept, the rest of the body is dropped
+		static std::atomic<size_t> _max_body_size;
 
 		const std::string _scheme;
 
@@ -37,6 +48,8 @@ namespace ubersniff::packet {
 		Request _request;
 		Response _response;
 		size_t _response_content_length;
+		// bytes of the body past the cap still to receive, they are dropped without being parsed
+		size_t _response_skipped_size = 0;
 		bool _response_is_chunked;
 
 		std::queue<Request> _reassembled_request;
@@ -45,6 +58,16 @@ namespace ubersniff::packet {
 		ReassembleState _request_state;
 		ReassembleState _response_state;
 
+		// timestamp of the last packet pushed, the exchanges it completes are stamped with it
+		std::chrono::microseconds _packet_timestamp{ 0 };
+
+		// bytes of the buffers reported in the buffered_bytes gauge
+		size_t _buffered_size = 0;
+		bool _is_header_only = false;
+
+		static Metrics& _get_metrics();
+		void _update_buffered_size() noexcept;
+
 		void _reassemble_request();
 		bool _search_http_request();
 		bool _reassemble_request_headers();
@@ -63,11 +86,27 @@ namespace ubersniff::packet {
 		bool _reassemble_response_body_chunked();
 
 		void _send_exchange_to_collector();
+		trace::Record* _get_response_trace() noexcept;
 	public:
 		HTTPReassembler(collector::DataCollector &_data_collector, const std::string &scheme);
-		~HTTPReassembler() = default;
+		~HTTPReassembler();
+
+		// timestamp is the time of the packet carrying the payload
+		void push_client_payload(std::vector<uint8_t>& client_payload, std::chrono::microseconds timestamp);
+		void push_server_payload(std::vector<uint8_t>& server_payload, std::chrono::microseconds timestamp);
+
+		// true when no exchange is in progress
+		bool is_idle() const noexcept;
+		// Drop the exchange in progress
+		void reset() noexcept;
+		// End of the stream: the response in progress is sent with the part of the body received
+		void finish();
+
+		size_t get_buffered_size() const noexcept { return _buffered_size; }
+		// Stop the reassembly of the response bodies, the body in progress is dropped
+		void set_header_only();
 
-		void push_client_payload(std::vector<uint8_t>& client_payload);
-		void push_server_payload(std::vector<uint8_t>& server_payload);
+		// Cap of the response bodies of all the reassemblers, can be changed while sniffing
+		static void set_max_body_size(size_t max_body_size) noexcept;
 	};
 }
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "collector/DataCollector.hpp"
+#include "metrics/Registry.hpp"
+#include "packet/HTTPReassembler.hpp"
+
+namespace ubersniff::packet {
+	/*
+	* Pool of the HTTPReassembler used by the streams
+	* A stream only holds a reassembler while an exchange is in progress,
+	*  so the idle keep-alive connections don't keep their buffers and the memory is recycled between the streams
+	* Not thread safe: a pool is used by one capture thread
+	*/
+	class HTTPReassemblerPool {
+		collector::DataCollector& _data_collector;
+		const std::string _scheme;
+		const size_t _max_idle_reassemblers;
+
+		std::vector<std::unique_ptr<HTTPReassembler>> _idle_reassemblers;
+
+		metrics::Gauge& _active_reassemblers;
+		metrics::Gauge& _pooled_reassemblers;
+	public:
+		HTTPReassemblerPool(collector::DataCollector& data_collector, const std::string& scheme, size_t max_idle_reassemblers);
+		~HTTPReassemblerPool();
+
+		std::unique_ptr<HTTPReassembler> acquire();
+		// The reassembler is reset, the exchange in progress is lost
+		void release(std::unique_ptr<HTTPReassembler> reassembler) noexcept;
+	};
+}
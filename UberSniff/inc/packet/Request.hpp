@@ -1,6 +1,7 @@
 #pragma once
 
 #include <unordered_map>
+#include "trace/Record.hpp"
 
 namespace ubersniff::packet {
 	/*
@@ -14,5 +15,8 @@ namespace ubersniff::packet {
 		std::string host;
 		std::string path;
 		std::string method;
+
+		// timestamps of the exchange when it is sampled by the tracer
+		trace::RecordPtr trace;
 	};
 }
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <tins/tcp_ip/stream_identifier.h>
+
+namespace ubersniff::sniffer {
+	/*
+	* Hash table of the TCP flows, indexed by their 4-tuple
+	* Open addressing with linear probing: the flows are stored in one array, without allocation per flow
+	* Erase shifts back the following entries, so the table never contains tombstones
+	*/
+	template <typename Value>
+	class FlowTable {
+	public:
+		using Key = Tins::TCPIP::StreamIdentifier;
+
+	private:
+		static constexpr size_t MIN_CAPACITY = 64;
+		// hash of the keys hashed to 0
+		static constexpr uint64_t EMPTY_HASH_SUBSTITUTE = 0x9e3779b97f4a7c15ull;
+
+		struct Slot {
+			// hash of the key, 0 for an empty slot
+			uint64_t hash = 0;
+			Key key;
+			Value value;
+		};
+
+		std::vector<Slot> _slots;
+		size_t _mask;
+		size_t _size;
+
+		size_t _find_index(const Key& key, uint64_t hash) const noexcept
+		{
+			for (size_t index = hash & _mask;; index = (index + 1) & _mask) {
+				const auto& slot = _slots[index];
+				if (!slot.hash || (slot.hash == hash && slot.key == key))
+					return index;
+			}
+		}
+
+		void _grow()
+		{
+			std::vector<Slot> slots(_slots.size() * 2);
+			std::swap(slots, _slots);
+			_mask = _slots.size() - 1;
+			for (auto& slot : slots) {
+				if (slot.hash)
+					_slots[_find_index(slot.key, slot.hash)] = std::move(slot);
+			}
+		}
+
+	public:
+		FlowTable() :
+			_slots(MIN_CAPACITY),
+			_mask(MIN_CAPACITY - 1),
+			_size(0)
+		{}
+		~FlowTable() = default;
+
+		// Returns nullptr if the flow is not in the table
+		Value* find(const Key& key) noexcept
+		{
+			auto& slot = _slots[_find_index(key, get_hash(key))];
+			return slot.hash ? &slot.value : nullptr;
+		}
+
+		// Insert or replace the value of the flow
+		Value& insert(const Key& key, Value value)
+		{
+			// keep the load factor under 1/2
+			if ((_size + 1) * 2 > _slots.size())
+				_grow();
+
+			auto hash = get_hash(key);
+			auto& slot = _slots[_find_index(key, hash)];
+			if (!slot.hash) {
+				slot.hash = hash;
+				slot.key = key;
+				++_size;
+			}
+			slot.value = std::move(value);
+			return slot.value;
+		}
+
+		bool erase(const Key& key)
+		{
+			auto index = _find_index(key, get_hash(key));
+			if (!_slots[index].hash)
+				return false;
+			// the value is destroyed once the table is consistent
+			auto value = std::move(_slots[index].value);
+
+			// move back the entries of the cluster which can take the free slot
+			auto hole = index;
+			for (auto next = (index + 1) & _mask; _slots[next].hash; next = (next + 1) & _mask) {
+				auto ideal = _slots[next].hash & _mask;
+				if (((next - ideal) & _mask) >= ((next - hole) & _mask)) {
+					_slots[hole] = std::move(_slots[next]);
+					hole = next;
+				}
+			}
+			_slots[hole] = Slot();
+			--_size;
+			return true;
+		}
+
+		void clear()
+		{
+			std::vector<Slot> slots(MIN_CAPACITY);
+			std::swap(slots, _slots);
+			_mask = MIN_CAPACITY - 1;
+			_size = 0;
+		}
+
+		size_t size() const noexcept { return _size; }
+
+		// Call the function with each value, the table must not be modified meanwhile
+		template <typename Function>
+		void for_each(Function function)
+		{
+			for (auto& slot : _slots) {
+				if (slot.hash)
+					function(slot.value);
+			}
+		}
+
+		// Hash of the 4-tuple, the same for both directions of the flow
+		static uint64_t get_hash(const Key& key) noexcept
+		{
+			// FNV-1a on the addresses and the ports
+			uint64_t hash = 0xcbf29ce484222325ull;
+			auto mix = [&hash](const uint8_t* data, size_t size) {
+				for (size_t i = 0; i < size; ++i)
+					hash = (hash ^ data[i]) * 0x100000001b3ull;
+			};
+			mix(key.min_address.data(), key.min_address.size());
+			mix(key.max_address.data(), key.max_address.size());
+			uint8_t ports[4];
+			std::memcpy(ports, &key.min_address_port, 2);
+			std::memcpy(ports + 2, &key.max_address_port, 2);
+			mix(ports, sizeof(ports));
+			// the low bits of a multiply only depend on the low bits of the bytes: fold the high bits into the index
+			hash ^= hash >> 32;
+			// 0 marks the empty slots, the only hash moved
+			return hash ? hash : EMPTY_HASH_SUBSTITUTE;
+		}
+	};
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace ubersniff::sniffer {
+	/*
+	* Watch the default interface in a dedicated thread
+	* On Linux the routing table is read again only when an rtnetlink notification of a route or a link arrives,
+	*  the other platforms poll the default interface at a slow interval
+	* The changes are posted to the thread of the sniffer, which only reads an atomic flag
+	*/
+	class RouteWatcher {
+	public:
+		static constexpr std::chrono::milliseconds DEFAULT_POLL_INTERVAL{ 5000 };
+
+	private:
+		const std::chrono::milliseconds _poll_interval;
+
+		std::mutex _mutex_interface_name;
+		std::string _interface_name;
+		std::atomic<bool> _has_changed;
+
+		std::mutex _mutex_stop;
+		std::condition_variable _stop_condition;
+		std::atomic<bool> _is_stopping;
+#ifdef __linux__
+		// netlink socket and eventfd waking up the thread on stop, -1 when not opened
+		int _netlink_fd;
+		int _stop_fd;
+#endif // __linux__
+		std::thread _watcher_thread;
+
+		static std::string _get_default_interface_name();
+		void _check_default_interface();
+		bool _open_netlink() noexcept;
+		void _watch_netlink();
+		void _watch_polling();
+	public:
+		explicit RouteWatcher(std::chrono::milliseconds poll_interval = DEFAULT_POLL_INTERVAL);
+		RouteWatcher(const RouteWatcher&) = delete;
+		RouteWatcher& operator=(const RouteWatcher&) = delete;
+		~RouteWatcher();
+
+		// Default interface when the watcher started or at the last change
+		std::string get_interface_name();
+
+		/*
+		** Returns true and the new default interface if it changed since the last call
+		** Costs one atomic load when nothing changed
+		*/
+		bool poll_change(std::string& interface_name);
+	};
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace ubersniff::sniffer {
+	/*
+	* Hierarchical timer wheel: schedule, cancel and expire a timer in O(1)
+	* The time is given by the caller (the timestamps of the captured packets),
+	*  the timers expire with a precision of one tick
+	*/
+	class TimerWheel {
+		static constexpr size_t LEVEL_BITS = 6;
+		static constexpr size_t SLOTS = size_t(1) << LEVEL_BITS;
+		static constexpr size_t LEVELS = 4;
+
+	public:
+		using Duration = std::chrono::milliseconds;
+
+		/*
+		* Node of an intrusive list: the timer is stored in the object it belongs to
+		* A timer is cancelled when it is destroyed
+		*/
+		class Timer {
+			friend class TimerWheel;
+
+			TimerWheel* _wheel = nullptr;
+			Timer* _previous = nullptr;
+			Timer* _next = nullptr;
+			uint64_t _expiration_tick = 0;
+		public:
+			Timer() = default;
+			Timer(const Timer&) = delete;
+			Timer& operator=(const Timer&) = delete;
+			~Timer() { cancel(); }
+
+			bool is_scheduled() const noexcept { return _wheel != nullptr; }
+			void cancel() noexcept;
+		};
+
+		using ExpirationCallback = std::function<void(Timer&)>;
+
+	private:
+		const Duration _resolution;
+		// sentinels of the lists of timers
+		std::array<std::array<Timer, SLOTS>, LEVELS> _slots;
+		uint64_t _current_tick;
+		bool _is_started;
+		size_t _size;
+
+		void _link(Timer& timer) noexcept;
+		void _cascade(size_t level) noexcept;
+	public:
+		explicit TimerWheel(Duration resolution) noexcept;
+		~TimerWheel();
+
+		// Schedule or reschedule the timer to expire at the given time
+		void schedule(Timer& timer, Duration expiration_time) noexcept;
+
+		// Move the wheel to the given time and call the callback for each expired timer
+		void advance(Duration now, const ExpirationCallback& on_expired);
+
+		size_t size() const noexcept { return _size; }
+	};
+}
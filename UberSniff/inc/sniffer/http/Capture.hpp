@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tins/sniffer.h>
+#include "ipc/FrameRing.hpp"
+#include "metrics/Registry.hpp"
+
+namespace ubersniff::sniffer::http {
+	/*
+	* Capture of the HTTP packets of one network interface or of one capture file, in its own thread
+	* The packets are read by batch with pcap_dispatch and each batch is given to the handler in the capture thread
+	* With privilege separation, the capture process forwards the frames to a frame ring
+	*  and the worker process reads them back from the ring as its only capture
+	*/
+	class Capture {
+	public:
+		enum class Source {
+			INTERFACE,
+			FILE,
+			// frames forwarded by the capture process
+			RING
+		};
+
+		// the packets can be moved out of the batch, the batch is cleared after the call
+		using BatchHandler = std::function<void(std::vector<Tins::Packet>& packets)>;
+
+		struct Config {
+			// packets read by a call to pcap_dispatch
+			size_t batch_size = 64;
+			// size of the kernel buffer of pcap in bytes, 0 keeps the default of pcap
+			unsigned buffer_size = 0;
+			// bytes captured of each packet
+			unsigned snap_len = 65535;
+		};
+
+		/*
+		* Counters of pcap since the capture was opened
+		*/
+		struct Stats {
+			// packets accepted by the filter
+			uint64_t received = 0;
+			uint64_t kernel_drops = 0;
+			uint64_t interface_drops = 0;
+		};
+
+	private:
+		static constexpr size_t TIMEOUT = 100;
+
+		const std::string _name;
+		const Source _source;
+		const Capture::Config _config;
+		const BatchHandler _batch_handler;
+
+		Tins::SnifferConfiguration _sniffer_config;
+		// nullptr for a ring
+		std::unique_ptr<Tins::BaseSniffer> _sniffer;
+		int _link_type;
+		// frames read from the ring or forwarded to it, nullptr otherwise
+		ipc::FrameRing* _ring;
+		// packets read by the current call to pcap_dispatch
+		std::vector<Tins::Packet> _batch;
+
+		std::thread _capture_thread;
+		std::atomic<bool> _is_capturing;
+		std::atomic<uint64_t> _received_packets;
+
+		// filter replaced by the capture thread, between two reads
+		std::mutex _mutex_filter;
+		std::string _pending_filter;
+		std::atomic<bool> _has_pending_filter;
+
+		// nullptr when the capture doesn't read a ring
+		metrics::Histogram* _ring_wake_up_latency;
+
+		std::unique_ptr<Tins::BaseSniffer> _make_sniffer();
+		void _capture();
+		bool _read_batch();
+		bool _read_ring_batch();
+		static void _on_packet(u_char* user, const pcap_pkthdr* header, const u_char* data);
+		static void _record_frame(const Tins::PDU& pdu, int link_type, int64_t timestamp, const uint8_t* data, uint32_t size,
+			uint32_t length);
+		void _apply_pending_filter();
+	public:
+		// The interface or the file is opened at once, an invalid interface or filter throws
+		Capture(const std::string& name, Source source, const Capture::Config& config, const std::string& filter,
+			BatchHandler batch_handler);
+		// Capture of the frames of a ring, in the worker process
+		Capture(ipc::FrameRing& ring, const Capture::Config& config, BatchHandler batch_handler);
+		Capture(const Capture&) = delete;
+		Capture& operator=(const Capture&) = delete;
+		~Capture();
+
+		const std::string& get_name() const noexcept { return _name; }
+		// packets read since the capture was opened
+		uint64_t get_received_packets() const noexcept { return _received_packets.load(std::memory_order_relaxed); }
+		// false once stopped or at the end of the capture file
+		bool is_capturing() const noexcept { return _is_capturing; }
+
+		void start();
+		// Interrupt the capture in progress and wait for the capture thread
+		void stop();
+
+		// Write the frames captured in the ring instead of giving them to the handler, must be called before start
+		void forward_to(ipc::FrameRing& ring) noexcept { _ring = &ring; }
+
+		// Replace the filter of the capture, the packets are never read without filter
+		void set_filter(const std::string& filter);
+		// Throws std::invalid_argument if pcap can't compile the filter
+		static void check_filter(const std::string& filter);
+
+		// false for a file, the counters of the capture process for a ring
+		bool get_stats(Capture::Stats& stats);
+	};
+}
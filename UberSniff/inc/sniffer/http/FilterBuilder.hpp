@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ubersniff::sniffer::http {
+	/*
+	* Build the BPF filter of the captures, to keep in the kernel the packets the reassembly doesn't need
+	* Only the TCP packets of the ports carrying a payload or a SYN, FIN or RST flag are kept:
+	*  the pure ACKs and the packets of the denied networks are not copied to the user space
+	* pcap can't read the TCP header behind an IPv6 header, all the IPv6 packets of the ports are kept
+	*/
+	class FilterBuilder {
+		std::vector<uint16_t> _ports;
+		// hosts or CIDR networks, checked
+		std::vector<std::string> _denied_networks;
+
+		static void _check_network(const std::string& network);
+	public:
+		explicit FilterBuilder(const std::vector<uint16_t>& ports);
+		~FilterBuilder() = default;
+
+		/*
+		** Throws std::invalid_argument if a network is not an IPv4 or an IPv6 address with an optional prefix length,
+		**  or if the address has bits set past the prefix
+		*/
+		void set_denied_networks(const std::vector<std::string>& denied_networks);
+		const std::vector<std::string>& get_denied_networks() const noexcept { return _denied_networks; }
+
+		std::string build() const;
+	};
+}
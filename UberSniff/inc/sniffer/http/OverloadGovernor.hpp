@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "metrics/Registry.hpp"
+
+namespace ubersniff::sniffer::http {
+	/*
+	* Degrade the capture in a controlled way when the pipeline can't follow the traffic,
+	*  instead of letting the kernel drop packets at random in the middle of the streams
+	* The pressure is measured at each interval with the depth of the collector queues and the packets dropped:
+	*  NORMAL -> HEADER_ONLY (the bodies are not extracted) -> SAMPLING (only 1 new stream out of N is followed)
+	* The governor goes back one mode after a number of calm intervals in a row
+	* update is called by one thread, the mode is read by the reassembly threads
+	*/
+	class OverloadGovernor {
+	public:
+		enum class Mode {
+			NORMAL = 0,
+			HEADER_ONLY,
+			SAMPLING
+		};
+
+		struct Config {
+			// exchanges waiting in the collector to raise the pressure
+			size_t high_queue_depth = 1000;
+			// exchanges waiting in the collector to calm down
+			size_t low_queue_depth = 100;
+			// calm intervals in a row to go back one mode
+			size_t recovery_intervals = 5;
+			// 1 stream out of sampling_ratio is followed in SAMPLING mode
+			size_t sampling_ratio = 4;
+		};
+
+	private:
+		const Config _config;
+		std::atomic<Mode> _mode;
+		size_t _calm_intervals;
+		uint64_t _dropped_packets;
+
+		metrics::Gauge& _mode_gauge;
+		metrics::Counter& _escalations;
+		metrics::Counter& _recoveries;
+		metrics::Counter& _sampled_out_flows;
+
+		void _set_mode(Mode mode) noexcept;
+	public:
+		explicit OverloadGovernor(const OverloadGovernor::Config& config);
+		~OverloadGovernor() = default;
+
+		/*
+		** Measure the pressure of the last interval
+		** dropped_packets is the total of the packets dropped since the start of the capture
+		** Returns true if the mode changed
+		*/
+		bool update(size_t queue_depth, uint64_t dropped_packets) noexcept;
+
+		Mode get_mode() const noexcept { return _mode.load(std::memory_order_relaxed); }
+		// Returns true if a new stream with this hash of its 4-tuple must be followed
+		bool is_admitted(uint64_t flow_hash) noexcept;
+	};
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <queue>
 #include <regex>
 #include <tins/tcp_ip/stream.h>
@@ -8,6 +9,9 @@
 #include "packet/Response.hpp"
 #include "packet/Request.hpp"
 #include "packet/HTTPReassembler.hpp"
+#include "packet/HTTPReassemblerPool.hpp"
+#include "sniffer/TimerWheel.hpp"
+#include "sniffer/http/ReassemblyBudget.hpp"
 
 namespace ubersniff::sniffer::http {
 	using Exchanges = ubersniff::packet::Exchange;
@@ -18,14 +22,60 @@ namespace ubersniff::sniffer::http {
 	/*
 	* This class reassemble the HTTP packet exchanges captured by the the sniffer
 	* Each reassembled exchange will be send to the DataCollector
+	* The HTTPReassembler is taken from the pool only while an exchange is in progress
+	* The timer of the stream expires it when it stays inactive
+	* In header only mode the bodies are not reassembled: only the URIs and the headers are extracted
 	*/
-	class PacketReassembler {
-		packet::HTTPReassembler _http_reassembler;
+	class PacketReassembler : public TimerWheel::Timer {
+		friend class ReassemblyBudget;
+
+	public:
+		enum class State {
+			// no data received yet
+			HANDSHAKE,
+			// an exchange is in progress
+			ACTIVE,
+			// keep-alive connection between two exchanges
+			IDLE,
+			// one side has closed the connection
+			CLOSING
+		};
+
+	private:
+		Tins::TCPIP::Stream& _stream;
+		// timestamp of the packet being reassembled by the shard
+		const std::chrono::microseconds& _packet_timestamp;
+		packet::HTTPReassemblerPool& _http_reassembler_pool;
+		std::unique_ptr<packet::HTTPReassembler> _http_reassembler;
+		bool _has_data = false;
+		bool _is_header_only = false;
+
+		// position of the stream in the budget
+		ReassemblyBudget& _reassembly_budget;
+		PacketReassembler* _less_recent = nullptr;
+		PacketReassembler* _more_recent = nullptr;
+		size_t _accounted_size = 0;
+
+		packet::HTTPReassembler& _get_http_reassembler();
+		void _release_idle_http_reassembler() noexcept;
 
 		void _on_server_data(Tins::TCPIP::Stream& stream);
 		void _on_client_data(Tins::TCPIP::Stream& stream);
 	public:
-		PacketReassembler(Tins::TCPIP::Stream& stream, collector::DataCollector& data_collector);
+		PacketReassembler(Tins::TCPIP::Stream& stream, const std::chrono::microseconds& packet_timestamp,
+			packet::HTTPReassemblerPool& http_reassembler_pool, ReassemblyBudget& reassembly_budget);
 		~PacketReassembler();
+
+		Tins::TCPIP::Stream& get_stream() noexcept { return _stream; }
+		State get_state() const noexcept;
+
+		// bytes buffered by the HTTP reassembly and by the out of order data of the stream
+		size_t get_buffered_size() const noexcept;
+
+		bool is_header_only() const noexcept { return _is_header_only; }
+		// Stop the reassembly of the bodies, the body in progress is dropped
+		void set_header_only();
+		// Complete the exchange in progress with the data received, when the stream won't receive more
+		void finish();
 	};
 }
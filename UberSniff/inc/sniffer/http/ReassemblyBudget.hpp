@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+
+namespace ubersniff::sniffer::http {
+	class PacketReassembler;
+
+	/*
+	* Bytes buffered by the reassembly of the streams
+	* The streams are kept in the order of their last activity, to find the least recently active ones
+	* Not thread safe: used by the capture thread
+	*/
+	class ReassemblyBudget {
+		size_t _size;
+		PacketReassembler* _least_recent;
+		PacketReassembler* _most_recent;
+
+		void _unlink(PacketReassembler& packet_reassembler) noexcept;
+	public:
+		ReassemblyBudget() noexcept;
+		~ReassemblyBudget() = default;
+
+		// Mark the stream as the most recently active
+		void touch(PacketReassembler& packet_reassembler) noexcept;
+		// Account the bytes currently buffered by the stream
+		void update(PacketReassembler& packet_reassembler) noexcept;
+		// Forget the stream and its bytes
+		void remove(PacketReassembler& packet_reassembler) noexcept;
+
+		PacketReassembler* get_least_recent() const noexcept { return _least_recent; }
+		size_t size() const noexcept { return _size; }
+	};
+}
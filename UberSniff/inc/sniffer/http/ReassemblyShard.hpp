@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <tins/packet.h>
+#include <tins/tcp_ip/stream_follower.h>
+#include "sniffer/FlowTable.hpp"
+#include "sniffer/TimerWheel.hpp"
+#include "sniffer/http/OverloadGovernor.hpp"
+#include "sniffer/http/PacketReassembler.hpp"
+#include "sniffer/http/ReassemblyBudget.hpp"
+#include "collector/DataCollector.hpp"
+#include "metrics/Registry.hpp"
+#include "timing/Clock.hpp"
+
+namespace ubersniff::sniffer::http {
+	/*
+	* Reassembly of a share of the TCP streams, in its own thread
+	* The captures give each packet to the shard of its stream, so a stream is always reassembled by the same thread
+	*  whatever the interface it is captured on
+	*/
+	class ReassemblyShard {
+	public:
+		/*
+		* Inactivity timeouts of the streams, depending on their state, and memory budget of the reassembly
+		*/
+		struct Config {
+			std::chrono::milliseconds handshake_timeout{ 10000 };
+			std::chrono::milliseconds active_timeout{ 120000 };
+			std::chrono::milliseconds idle_timeout{ 60000 };
+			std::chrono::milliseconds closing_timeout{ 10000 };
+
+			// bytes buffered by the reassembly of all the streams of the shard
+			size_t max_buffered_size = 64 * 1024 * 1024;
+			// bytes buffered by the reassembly of one stream
+			size_t max_flow_buffered_size = 2 * 1024 * 1024;
+		};
+
+	private:
+		// reassemblers kept for the next exchanges
+		static constexpr size_t MAX_IDLE_HTTP_REASSEMBLERS = 256;
+		static constexpr TimerWheel::Duration TIMER_RESOLUTION{ 100 };
+
+		struct Metrics {
+			metrics::Gauge& flows;
+			metrics::Counter& opened_flows;
+			metrics::Counter& closed_flows;
+			metrics::Counter& timeout_evictions;
+			metrics::Counter& buffered_data_evictions;
+			metrics::Counter& sacked_segments_evictions;
+			metrics::Counter& handshake_expirations;
+			metrics::Counter& active_expirations;
+			metrics::Counter& idle_expirations;
+			metrics::Counter& closing_expirations;
+			metrics::Gauge& buffered_bytes;
+			metrics::Counter& header_only_downgrades;
+			metrics::Counter& budget_evictions;
+			metrics::Counter& flow_cap_evictions;
+			// processing time of a packet in nanoseconds, only measured in replay
+			metrics::Histogram& packet_processing;
+		};
+
+		const Config _config;
+		OverloadGovernor& _overload_governor;
+		// the packets are timed and never dropped or sampled out in replay
+		const bool _is_replay;
+		const size_t _max_queued_packets;
+
+		Tins::TCPIP::StreamFollower _stream_follower;
+		packet::HTTPReassemblerPool _http_reassembler_pool;
+		// declared before the streams which are accounted in it
+		ReassemblyBudget _reassembly_budget;
+		FlowTable<std::unique_ptr<PacketReassembler>> _packet_reassemblers;
+		TimerWheel _flow_timers;
+		// timestamp of the packet being reassembled, the exchanges it completes are stamped with it
+		std::chrono::microseconds _packet_timestamp;
+		// published for the other threads once the exchanges of the previous packets are collected
+		std::atomic<std::chrono::microseconds::rep> _packet_time;
+		// bytes of the budget reported in the buffered_bytes gauge
+		size_t _reported_buffered_size;
+
+		// packets published by the captures, waiting to be reassembled
+		std::mutex _mutex_packets;
+		std::condition_variable _packets_condition;
+		std::condition_variable _space_condition;
+		std::vector<Tins::Packet> _packets;
+		std::atomic<size_t> _pending_packets;
+		std::atomic<bool> _is_header_only_requested;
+		// the packets queued and the exchanges in progress are completed until the deadline when the shard stops
+		std::chrono::steady_clock::time_point _drain_deadline;
+
+		std::thread _reassembly_thread;
+		std::atomic<bool> _is_running;
+
+		Metrics _metrics;
+
+		void _init_stream_follower();
+		void _reassemble();
+		void _follow_packet(Tins::Packet& packet);
+		bool _erase_flow(const Tins::TCPIP::StreamIdentifier& stream_id);
+		std::chrono::milliseconds _get_flow_timeout(const PacketReassembler& packet_reassembler) const noexcept;
+		void _on_flow_expired(TimerWheel::Timer& timer);
+		void _forget_flow(PacketReassembler& packet_reassembler);
+		void _enforce_flow_cap(PacketReassembler& packet_reassembler);
+		void _enforce_budget();
+		void _switch_to_header_only();
+		void _update_buffered_bytes() noexcept;
+
+		// stream follower callbacks
+		void _on_new_connection(Tins::TCPIP::Stream& stream);
+		void _on_connection_terminated(Tins::TCPIP::Stream& stream, Tins::TCPIP::StreamFollower::TerminationReason reason);
+	public:
+		ReassemblyShard(collector::DataCollector& data_collector, const ReassemblyShard::Config& config,
+			OverloadGovernor& overload_governor, size_t max_queued_packets, bool is_replay);
+		ReassemblyShard(const ReassemblyShard&) = delete;
+		ReassemblyShard& operator=(const ReassemblyShard&) = delete;
+		~ReassemblyShard();
+
+		void start();
+		/*
+		** Stop the reassembly thread
+		** Until the drain deadline, the packets queued are reassembled and the exchanges in progress are completed
+		**  with the data received, the rest is lost
+		*/
+		void stop(std::chrono::steady_clock::time_point drain_deadline = std::chrono::steady_clock::time_point::min());
+
+		/*
+		** Publish a batch of packets from a capture thread, under one lock and with one notification
+		** Returns the number of packets published, the packets beyond the space of the queue are dropped
+		**  while a replay waits for the space instead
+		*/
+		size_t push_packets(std::vector<Tins::Packet>& packets);
+
+		// true when all the packets published are reassembled
+		bool is_idle() const noexcept { return !_pending_packets; }
+		// Time of the packet being reassembled, the exchanges of the packets before it are collected
+		timing::Clock::TimePoint get_packet_time() const noexcept;
+
+		// Switch the streams followed to header only mode, from any thread
+		void request_header_only() noexcept;
+
+		// Hash of the stream of the packet, the same for both directions, 0 for a packet which is not TCP over IP
+		static uint64_t get_flow_hash(const Tins::PDU& pdu) noexcept;
+	};
+}
@@ -1,44 +1,168 @@
 #pragma once
 
-#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
 #include <map>
-#include <tins/tcp_ip/stream_follower.h>
-#include <tins/sniffer.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 #include "sniffer/ISniffer.hpp"
-#include "sniffer/http/PacketReassembler.hpp"
+#include "sniffer/http/Capture.hpp"
+#include "sniffer/http/FilterBuilder.hpp"
+#include "sniffer/http/OverloadGovernor.hpp"
+#include "sniffer/http/ReassemblyShard.hpp"
 #include "collector/DataCollector.hpp"
+#include "metrics/Registry.hpp"
+#include "timing/Clock.hpp"
 
 namespace ubersniff::sniffer::http {
 	/*
 	* HTTP Sniffer
+	* Captures the packets of network interfaces, or replays a capture file as fast as possible
+	* Each interface is captured by its own thread, the packets are reassembled by shards shared by all the interfaces:
+	*  an interface can be added or removed without losing the streams of the other interfaces
+	* With privilege separation, the sniffer of the capture process only forwards the frames to a frame ring
+	*  and the sniffer of the worker process reassembles the frames of the ring
 	*/
 	class Sniffer : public ISniffer {
-		static constexpr size_t TIMEOUT = 100;
+	public:
+		using Source = Capture::Source;
+
+		struct Config {
+			// names or glob patterns (* and ?) of the interfaces captured, the default interface is captured when empty
+			std::vector<std::string> interfaces;
+			// threads reassembling the streams
+			size_t reassembly_threads = 1;
+			// packets waiting for each reassembly thread, the packets beyond are dropped
+			size_t max_queued_packets = 65536;
+
+			// reading of the packets by batch
+			Capture::Config capture;
+
+			// HTTP ports captured
+			std::vector<uint16_t> ports = { 80 };
+			// hosts or CIDR networks not captured
+			std::vector<std::string> denied_networks;
+			// file of the denied networks (one per line), read again when it changes
+			std::string deny_list_file;
+
+			// timeouts and memory budget, the budget is shared by the reassembly threads
+			ReassemblyShard::Config reassembly;
+
+			// shedding of the load when the pipeline is overloaded
+			OverloadGovernor::Config overload;
+		};
+
+	private:
+		static constexpr std::chrono::seconds STATS_INTERVAL{ 1 };
+		static constexpr std::chrono::seconds INTERFACES_REFRESH_INTERVAL{ 5 };
+		// time given to the capture of a new default interface to receive its first packet before the old one is closed
+		static constexpr std::chrono::milliseconds WARM_UP_TIMEOUT{ 1000 };
+		static constexpr std::chrono::milliseconds WARM_UP_POLL_INTERVAL{ 10 };
 
-		collector::DataCollector &_data_collector;
+		struct Metrics {
+			// packets processed in user space
+			metrics::Counter& packets;
+			metrics::Counter& bytes;
+			// packets accepted by the filters in the kernel
+			metrics::Gauge& kernel_accepted;
+			metrics::Gauge& kernel_drops;
+			metrics::Gauge& interface_drops;
+			metrics::Counter& queue_drops;
+			metrics::Gauge& interfaces;
+			metrics::Counter& interface_switches;
+			metrics::Gauge& max_buffered_bytes;
+		};
 
-		// Sniffer
-		Tins::SnifferConfiguration _sniffer_config;
-		Tins::Sniffer _sniffer;
-		Tins::TCPIP::StreamFollower _stream_follower;
-		std::map<Tins::TCPIP::StreamIdentifier, std::unique_ptr<PacketReassembler>> _packet_reassemblers;
+		// nullptr when the frames are forwarded to the ring
+		collector::DataCollector* _data_collector;
+		// ring read by the worker or written by the capture process, nullptr without privilege separation
+		ipc::FrameRing* _ring;
 
-		std::thread _sniffer_thread;
-		bool _is_sniffing = false;
+		const Sniffer::Config _config;
+		const Source _source;
+		// default interface or capture file, used when no interface is configured
+		std::string _source_name;
 
-		// sniffer callbacks
-		void _on_new_connection(Tins::TCPIP::Stream& stream);
+		OverloadGovernor _overload_governor;
+		std::vector<std::unique_ptr<ReassemblyShard>> _shards;
+
+		std::mutex _mutex_filter;
+		FilterBuilder _filter_builder;
+		std::string _filter;
+		std::filesystem::file_time_type _deny_list_write_time;
+
+		std::mutex _mutex_captures;
+		std::map<std::string, std::unique_ptr<Capture>> _captures;
+
+		// refresh of the statistics and of the interfaces
+		std::mutex _mutex_monitor;
+		std::condition_variable _monitor_condition;
+		std::thread _monitor_thread;
+		std::atomic<bool> _is_sniffing;
+
+		Metrics _metrics;
+
+		void _dispatch_packets(std::vector<Tins::Packet>& packets);
+		std::unique_ptr<Capture> _make_capture(const std::string& name);
+		void _reload_deny_list();
+		void _add_capture(const std::string& name);
+		void _refresh_interfaces();
+		bool _is_interface_configured(const std::string& name) const noexcept;
+		void _monitor();
+		void _update_capture_stats();
+		void _update_overload_mode();
+
+		Sniffer(const std::string& source_name, collector::DataCollector* data_collector, ipc::FrameRing* ring,
+			const Sniffer::Config& config, Source source);
 	public:
-		Sniffer(const std::string &interface_name, collector::DataCollector &data_collector);
+		/*
+		** source_name is the name of the default interface or the path of the capture file
+		** A replay stops sniffing at the end of the file
+		*/
+		Sniffer(const std::string &source_name, collector::DataCollector &data_collector, const Sniffer::Config &config,
+			Source source = Source::INTERFACE);
+		// Reassemble the frames forwarded by the capture process
+		Sniffer(ipc::FrameRing& input_ring, collector::DataCollector& data_collector, const Sniffer::Config& config);
+		// Capture the interfaces and forward their frames to the worker process, without reassembly
+		Sniffer(const std::string& source_name, ipc::FrameRing& output_ring, const Sniffer::Config& config);
 		virtual ~Sniffer();
-	
-		bool is_sniffing() { return _is_sniffing; }
 
-		// start the sniffing of the packets in a different thread
+		// A replay is sniffing until its packets are reassembled
+		bool is_sniffing();
+		/*
+		** Packet time reached by all the reassembly threads
+		** The exchanges completed by the packets before it are collected already: the windows ended are complete
+		*/
+		timing::Clock::TimePoint get_packet_time() const noexcept;
+
+		/*
+		** Replace the denied networks and the filter of all the captures
+		** Throws std::invalid_argument for an invalid network or a filter pcap can't compile, the filter is not changed
+		*/
+		void set_denied_networks(const std::vector<std::string>& denied_networks);
+
+		// start the sniffing of the packets in different threads
 		void start_sniffing();
-		// stop the sniffing of the packets
+		// stop the sniffing of the packets, the captures in progress are interrupted
 		void stop_sniffing();
+		/*
+		** Stop the sniffing of the packets, the captures in progress are interrupted
+		** The packets captured and the exchanges in progress are reassembled until the drain deadline
+		*/
+		void stop_sniffing(std::chrono::steady_clock::time_point drain_deadline);
 
+		/*
+		** Follow the default interface when no interface is configured
+		** The new interface is captured before the old one is closed, the streams are kept
+		*/
 		void change_interface(const std::string &interface_name);
+
+		// Glob matching of a name, * matches any sequence of characters and ? one character
+		static bool match_pattern(const std::string& pattern, const std::string& name) noexcept;
 	};
 }
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+namespace ubersniff::timing {
+	/*
+	* Time of the pipeline, read by the batch windows of the collector and the scheduling of the uploads
+	* The system source is the steady clock, the packets source is the timestamp of the latest packet reassembled:
+	*  a replay at full speed sees the time go by like the live capture, and its batches are cut at the same packets
+	*  run after run
+	* Once the replay is finished, the packet time runs on from the last packet at the pace of the steady clock
+	*/
+	class Clock {
+	public:
+		using Duration = std::chrono::steady_clock::duration;
+		// time since epoch of the packets, or time of the steady clock
+		using TimePoint = std::chrono::steady_clock::time_point;
+
+		enum class Source {
+			SYSTEM = 0,
+			PACKETS
+		};
+
+	private:
+		std::atomic<Source> _source;
+		std::atomic<Duration::rep> _packet_time;
+		// steady time of the end of the packets, 0 while the packets drive the clock
+		std::atomic<Duration::rep> _released_at;
+
+	public:
+		Clock() noexcept;
+		~Clock() = default;
+
+		// Clock of the process
+		static Clock& get_default();
+
+		// Must be called before the clock is used by the other threads
+		void configure(Source source) noexcept;
+		bool is_packet_time() const noexcept { return _source.load(std::memory_order_relaxed) == Source::PACKETS; }
+
+		TimePoint now() const noexcept;
+		// Time of a packet: its timestamp with the packets source, now with the system source
+		TimePoint at(std::chrono::microseconds timestamp) const noexcept;
+
+		/*
+		** Move the packet time to the timestamp of a packet, before the packet is reassembled
+		** The time never goes back, does nothing with the system source
+		*/
+		void advance(std::chrono::microseconds timestamp) noexcept;
+
+		// Called after the last packet: the packet time runs on at the pace of the steady clock
+		void release() noexcept;
+	};
+}
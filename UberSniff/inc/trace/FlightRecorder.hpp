@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ubersniff::trace {
+	/*
+	* Flight recorder of the last frames captured, to reproduce an extraction offline
+	* The frames are copied in a pre-allocated ring of fixed size slots: a capture thread takes a slot with an atomic
+	*  increment and writes it under the sequence number of the slot, without lock (the oldest frames are overwritten)
+	* The frames of the streams which are not followed by the reassembly (sampled out or forgotten) are not recorded
+	* The dump writes the frames of the ring, oldest first, in a pcap file, the dumps are serialized
+	*/
+	class FlightRecorder {
+	public:
+		struct Config {
+			// bytes of the ring, the recorder is disabled at 0
+			size_t size = 0;
+			// age of the oldest frame dumped compared to the newest, all the frames of the ring at 0
+			std::chrono::seconds duration{ 0 };
+			// file written on dump
+			std::string file = "ubersniff-flight.pcap";
+		};
+
+		static constexpr size_t SLOT_SIZE = 2048;
+
+	private:
+		// streams not followed, indexed by the low bits of their hash
+		static constexpr size_t IGNORED_FLOWS = 65536;
+
+		/*
+		* Slot of the ring, protected by a sequence number:
+		*  odd while a frame is written, 2 * (index + 1) once the frame of the index is written
+		*/
+		struct alignas(64) Slot {
+			std::atomic<uint64_t> sequence{ 0 };
+			int64_t timestamp = 0;
+			// bytes kept and length of the frame on the wire
+			uint32_t size = 0;
+			uint32_t length = 0;
+			int32_t link_type = 0;
+			uint8_t data[SLOT_SIZE - 28];
+		};
+		static_assert(sizeof(Slot) == SLOT_SIZE, "a slot is padded to its size");
+
+	public:
+		// bytes kept of a frame, the longer frames are truncated
+		static constexpr size_t MAX_FRAME_SIZE = sizeof(Slot::data);
+
+	private:
+		Config _config;
+		std::unique_ptr<Slot[]> _slots;
+		size_t _mask;
+		std::atomic<uint64_t> _head;
+		std::atomic<uint64_t> _dropped;
+		// hash of the last stream ignored in each entry, 0 when empty
+		std::unique_ptr<std::atomic<uint64_t>[]> _ignored_flows;
+		// the endpoint and the signal can request a dump at the same time
+		mutable std::mutex _mutex_dump;
+
+	public:
+		FlightRecorder();
+		~FlightRecorder() = default;
+
+		// Flight recorder of the process
+		static FlightRecorder& get_default();
+
+		// Must be called before the recorder is used by the other threads
+		void configure(const FlightRecorder::Config& config);
+		const FlightRecorder::Config& get_config() const noexcept;
+
+		bool is_enabled() const noexcept { return _slots != nullptr; }
+
+		// Called by the reassembly when it stops or starts following a stream
+		void ignore_flow(uint64_t flow_hash) noexcept;
+		void follow_flow(uint64_t flow_hash) noexcept;
+
+		/*
+		** Copy a frame in the next slot, from any capture thread
+		** flow_hash is 0 for a frame which is not TCP, such a frame is always recorded
+		** The timestamp is in microseconds since epoch, the frame is truncated to MAX_FRAME_SIZE
+		** size is the number of bytes captured and length the length of the frame on the wire
+		*/
+		void record(uint64_t flow_hash, int link_type, int64_t timestamp, const uint8_t* data, uint32_t size,
+			uint32_t length) noexcept;
+
+		// frames not recorded because a writer which has lapped the ring was still writing in the slot
+		uint64_t dropped() const noexcept;
+
+		/*
+		** Write the frames of the ring in a pcap file, with the link type of the first frame
+		** A truncated frame keeps its length on the wire in the file
+		** Returns the number of frames written
+		*/
+		size_t dump(const std::string& filename) const;
+	};
+}
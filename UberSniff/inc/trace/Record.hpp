@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace ubersniff::trace {
+	/*
+	* Stages of an exchange, from its first segment to its upload
+	*/
+	enum Stage : size_t {
+		FIRST_SEGMENT = 0,
+		HEADERS_COMPLETE,
+		BODY_COMPLETE,
+		QUEUED,
+		PROCESSED,
+		BATCHED,
+		UPLOADED,
+		NB_STAGES
+	};
+
+	/*
+	* Timestamps of a sampled exchange, in nanoseconds of the steady clock (0 when the stage is not reached)
+	* The stages are marked by one thread at a time, following the exchange through the pipeline
+	*/
+	struct Record {
+		uint64_t id = 0;
+		std::array<int64_t, NB_STAGES> timestamps{};
+
+		void mark(Stage stage) noexcept
+		{
+			timestamps[stage] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+	};
+
+	// Shared by the copies of the exchange, the record is committed to the tracer with its last reference
+	using RecordPtr = std::shared_ptr<Record>;
+
+	// Mark the stage if the exchange is sampled
+	inline void mark(Record* record, Stage stage) noexcept
+	{
+		if (record)
+			record->mark(stage);
+	}
+
+	inline void mark(const RecordPtr& record, Stage stage) noexcept
+	{
+		mark(record.get(), stage);
+	}
+}
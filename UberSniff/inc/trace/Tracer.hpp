@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include "trace/Record.hpp"
+
+namespace ubersniff::trace {
+	/*
+	* Sampled tracing of the exchanges
+	* The records of the finished exchanges are kept in a lock-free ring buffer (the oldest are overwritten)
+	*  and are exported in the Chrome trace event format, readable by chrome://tracing and Perfetto
+	*/
+	class Tracer {
+	public:
+		struct Config {
+			// probability for an exchange to be traced, tracing is disabled at 0
+			double sampling_rate = 0;
+			// number of records kept, rounded up to a power of 2
+			size_t capacity = 4096;
+			// file written on dump
+			std::string file = "ubersniff-trace.json";
+		};
+
+	private:
+		/*
+		* Slot of the ring buffer, protected by a sequence number:
+		*  odd while a record is written, 2 * (index + 1) once the record of the index is written
+		*/
+		struct alignas(64) Slot {
+			std::atomic<uint64_t> sequence{ 0 };
+			std::atomic<uint64_t> id{ 0 };
+			std::array<std::atomic<int64_t>, NB_STAGES> timestamps;
+		};
+
+		Config _config;
+		// probability scaled on 32 bits
+		std::atomic<uint64_t> _sampling_threshold;
+		std::atomic<uint64_t> _next_id;
+
+		std::unique_ptr<Slot[]> _slots;
+		size_t _mask;
+		std::atomic<uint64_t> _head;
+		std::atomic<uint64_t> _dropped;
+
+		bool _should_sample() noexcept;
+		void _commit(const Record& record) noexcept;
+		static void _write_microseconds(std::string& output, int64_t nanoseconds);
+	public:
+		Tracer();
+		~Tracer() = default;
+
+		// Tracer of the process
+		static Tracer& get_default();
+
+		// Must be called before the tracer is used by the other threads
+		void configure(const Tracer::Config& config);
+		const Tracer::Config& get_config() const noexcept;
+
+		// Returns the record of a new exchange when it is sampled, nullptr otherwise
+		RecordPtr start();
+
+		// records overwritten while they were written
+		uint64_t dropped() const noexcept;
+
+		std::string serialize() const;
+		void dump(const std::string& filename) const;
+	};
+}
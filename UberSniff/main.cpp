@@ -4,14 +4,26 @@
 
 #include <atomic>
 #include <csignal>
+#include <cstdlib>
 #include <iostream>
 #include <stdexcept>
 #include <chrono>
+#include <fstream>
+#include <memory>
 #include <thread>
-#include <tins/network_interface.h>
 #include "api/UberBack.hpp"
+#include "api/encoder/JsonEncoder.hpp"
+#include "batch/BatchProcessor.hpp"
 #include "collector/DataCollector.hpp"
 #include "config/Config.hpp"
+#include "governor/CpuGovernor.hpp"
+#include "ipc/PrivilegeSeparation.hpp"
+#include "metrics/MetricsServer.hpp"
+#include "packet/HTTPReassembler.hpp"
+#include "trace/FlightRecorder.hpp"
+#include "timing/Clock.hpp"
+#include "trace/Tracer.hpp"
+#include "sniffer/RouteWatcher.hpp"
 #include "sniffer/http/Sniffer.hpp"
 
 /* Bollean flag that will quit the program when set at true */
@@ -23,6 +35,17 @@ void got_signal(int)
     quit.store(true);
 }
 
+/* Set when the flight recorder should be dumped by the main loop */
+volatile std::atomic<bool> flight_dump_requested(false);
+
+#ifndef _WIN32
+/* Request a dump of the flight recorder on SIGUSR1 */
+void got_dump_signal(int)
+{
+    flight_dump_requested.store(true);
+}
+#endif // !_WIN32
+
 #ifdef _WIN32
 /* Catch Ctrl+C for windows */
 BOOL WINAPI got_ctrl_routine(_In_ DWORD dwCtrlType)
@@ -37,18 +60,123 @@ BOOL WINAPI got_ctrl_routine(_In_ DWORD dwCtrlType)
 }
 #endif // !_WIN32
 
-/* get the default interface */
-std::string get_interface_name()
+/* write the metrics of a replay, in the Prometheus text format, in the report file or on the standard output */
+void write_replay_report(const std::string& report_file, std::chrono::nanoseconds elapsed_time)
 {
-    auto iface = Tins::NetworkInterface::default_interface();
-    auto interface_name = std::string(iface.name());
-    return interface_name;
+    auto& registry = ubersniff::metrics::Registry::get_default();
+    registry.gauge("ubersniff_replay_nanoseconds", "Duration of the replay of the capture file").set(elapsed_time.count());
+    // throughput of the capture, to compare the batch sizes
+    auto packets = registry.counter("ubersniff_capture_packets_total", "Packets processed in user space").value();
+    if (elapsed_time.count() > 0)
+        registry.gauge("ubersniff_replay_packets_per_second", "Packets replayed per second")
+            .set(static_cast<int64_t>(packets * 1000000000.0 / elapsed_time.count()));
+    auto report = registry.serialize();
+
+    if (report_file.empty()) {
+        std::cout << report;
+        return;
+    }
+    std::ofstream file(report_file, std::ios::binary | std::ios::trunc);
+    if (!file)
+        throw std::runtime_error("Can not create the report file " + report_file);
+    file << report;
+}
+
+/* extract the capture files in parallel, then write the merged batches in the output file or upload them */
+int run_batch(const ubersniff::config::Config& config, const std::string& pattern, const std::string& output_file,
+    size_t jobs, const std::string& report_file)
+{
+    auto filenames = ubersniff::batch::BatchProcessor::find_files(pattern);
+    if (filenames.empty())
+        throw std::runtime_error("No capture file matches " + pattern);
+    auto batch_processor = ubersniff::batch::BatchProcessor(config.get_sniffer_config(), config.get_collector_config(),
+        jobs);
+    std::cout << "Starting batch of " << filenames.size() << " files with " << batch_processor.get_parallelism()
+        << " jobs" << std::endl;
+
+    auto started_at = std::chrono::steady_clock::now();
+    auto data_batches = batch_processor.process(filenames, []() { return quit.load(); });
+    auto elapsed_time = std::chrono::steady_clock::now() - started_at;
+
+    if (!output_file.empty()) {
+        // sorted, the output of the same files is the same whatever the number of jobs
+        auto& uberback_config = config.get_uberback_config();
+        ubersniff::api::Upload upload;
+        ubersniff::api::encoder::JsonEncoder(uberback_config.userId, uberback_config.service, true)
+            .encode(data_batches, upload);
+        std::ofstream file(output_file, std::ios::binary | std::ios::trunc);
+        if (!file)
+            throw std::runtime_error("Can not create the output file " + output_file);
+        file << upload.body;
+    } else {
+        auto uberback = ubersniff::api::UberBack(config.get_uberback_config());
+        uberback.analyze_data(std::move(data_batches));
+        uberback.flush(std::chrono::steady_clock::time_point::max());
+    }
+    write_replay_report(report_file, elapsed_time);
+    return EXIT_SUCCESS;
+}
+
+/* capture the interfaces and forward their frames to the worker process, until the quit or the exit of the worker */
+int run_capture_process(const ubersniff::config::Config& config, ubersniff::ipc::PrivilegeSeparation& privilege_separation)
+{
+    std::unique_ptr<ubersniff::sniffer::RouteWatcher> route_watcher;
+    if (config.get_sniffer_config().interfaces.empty())
+        route_watcher = std::make_unique<ubersniff::sniffer::RouteWatcher>();
+    auto interface_name = route_watcher ? route_watcher->get_interface_name() : "";
+    auto http_sniffer = ubersniff::sniffer::http::Sniffer(interface_name, privilege_separation.get_frame_ring(),
+        config.get_sniffer_config());
+    http_sniffer.start_sniffing();
+
+    while (!quit.load() && privilege_separation.is_worker_running()) {
+        // check default interface
+        if (route_watcher && route_watcher->poll_change(interface_name)) {
+            std::cout << "Change capture on interface " << interface_name << std::endl;
+            http_sniffer.change_interface(interface_name);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    http_sniffer.stop_sniffing();
+    return privilege_separation.stop_worker();
 }
 
 int main(int argc, char* argv[])
 {
     if (argc < 2) {
-        std::cerr << "Invalid number of argument: " << argv[0] << " <config_file.xml>" << std::endl;
+        std::cerr << "Invalid number of argument: " << argv[0]
+            << " <config_file.xml> [--replay <capture.pcap> | --batch <directory|glob> [--output <batches.json>]"
+            << " [--jobs <n>]] [--report <report.txt>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // replay of a capture file instead of the live capture
+    std::string replay_file;
+    std::string report_file;
+    // extraction of a set of capture files, in parallel
+    std::string batch_pattern;
+    std::string output_file;
+    size_t jobs = 0;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        if (option == "--replay") {
+            replay_file = argv[i + 1];
+        } else if (option == "--batch") {
+            batch_pattern = argv[i + 1];
+        } else if (option == "--output") {
+            output_file = argv[i + 1];
+        } else if (option == "--jobs") {
+            jobs = std::strtoul(argv[i + 1], nullptr, 10);
+        } else if (option == "--report") {
+            report_file = argv[i + 1];
+        } else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    bool is_replay = !replay_file.empty();
+    if (is_replay && !batch_pattern.empty()) {
+        std::cerr << "--replay and --batch are exclusive" << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -58,42 +186,162 @@ int main(int argc, char* argv[])
         SetConsoleCtrlHandler(got_ctrl_routine, TRUE);
 #else
         std::signal(SIGINT, got_signal);
+        std::signal(SIGUSR1, got_dump_signal);
 #endif // !_WIN32
 
         auto config = ubersniff::config::Config(argv[1]);
-        auto interface_name = get_interface_name();
-        auto uberback = ubersniff::api::UberBack(config.get_uberback_config());
-        auto data_collector = ubersniff::collector::DataCollector();
-        auto http_sniffer = ubersniff::sniffer::http::Sniffer(interface_name, data_collector);
-        std::cout << "Starting capture on interface " << interface_name << std::endl;
-
-        http_sniffer.start_sniffing();
-        auto is_analysed = false;
-
-        while (!quit.load()) {
-            // check default interface
-            auto new_interface_name = get_interface_name();
-            if (interface_name != new_interface_name) {
-                interface_name = new_interface_name;
-                std::cout << "Change capture on interface " << interface_name << std::endl;
-                http_sniffer.change_interface(interface_name);
-            }
-            if (!data_collector.process_next_exchanges()) {
-                if (!is_analysed) {
-                    //data_collector.dump();
-                    is_analysed = true;
-                    // analyse the collected data
-                    uberback.analyze_data(std::move(data_collector.extract_data_batches()));
+        if (!batch_pattern.empty())
+            return run_batch(config, batch_pattern, output_file, jobs, report_file);
+        // the capture keeps the privileges in this process, the rest of the pipeline runs in a worker process
+        std::unique_ptr<ubersniff::ipc::PrivilegeSeparation> privilege_separation;
+        if (!is_replay && !config.get_privilege_separation_config().user.empty()) {
+            privilege_separation = std::make_unique<ubersniff::ipc::PrivilegeSeparation>(
+                config.get_privilege_separation_config());
+            // forked before any thread is started
+            if (privilege_separation->fork_worker())
+                return run_capture_process(config, *privilege_separation);
+        }
+        auto& tracer = ubersniff::trace::Tracer::get_default();
+        tracer.configure(config.get_trace_config());
+        // the last frames captured are kept in memory to be dumped on demand
+        auto& flight_recorder = ubersniff::trace::FlightRecorder::get_default();
+        flight_recorder.configure(config.get_flight_recorder_config());
+        // a replay runs on the time of its packets, whatever the speed of the replay
+        auto& pipeline_clock = ubersniff::timing::Clock::get_default();
+        pipeline_clock.configure(is_replay ? ubersniff::timing::Clock::Source::PACKETS
+            : ubersniff::timing::Clock::Source::SYSTEM);
+        // the metrics endpoint is optional
+        std::unique_ptr<ubersniff::metrics::MetricsServer> metrics_server;
+        if (!config.get_metrics_config().port.empty())
+            metrics_server = std::make_unique<ubersniff::metrics::MetricsServer>(config.get_metrics_config(),
+                ubersniff::metrics::Registry::get_default());
+        // dump the sampled exchanges and the last frames on demand, with a POST
+        if (metrics_server) {
+            metrics_server->add_handler("/trace/dump", [&tracer]() {
+                tracer.dump(tracer.get_config().file);
+                return "Trace written in " + tracer.get_config().file + "\n";
+            }, boost::beast::http::verb::post);
+            metrics_server->add_handler("/flight/dump", [&flight_recorder]() {
+                auto frames = flight_recorder.dump(flight_recorder.get_config().file);
+                return std::to_string(frames) + " frames written in " + flight_recorder.get_config().file + "\n";
+            }, boost::beast::http::verb::post);
+        }
+        std::chrono::nanoseconds elapsed_time;
+        std::chrono::steady_clock::time_point shutdown_started_at;
+        {
+            // the default interface is watched in the background when no interface is configured
+            std::unique_ptr<ubersniff::sniffer::RouteWatcher> route_watcher;
+            if (!is_replay && !privilege_separation && config.get_sniffer_config().interfaces.empty())
+                route_watcher = std::make_unique<ubersniff::sniffer::RouteWatcher>();
+            auto interface_name = is_replay ? replay_file : route_watcher ? route_watcher->get_interface_name() : "";
+            auto uberback = ubersniff::api::UberBack(config.get_uberback_config());
+            auto data_collector = ubersniff::collector::DataCollector(config.get_collector_config());
+            // the batches of a replay are cut by windows of packet time, at the same exchanges run after run
+            if (is_replay)
+                data_collector.set_batch_window(config.get_replay_batch_window());
+            // the worker process reassembles the frames forwarded by the capture process
+            auto http_sniffer = privilege_separation
+                ? ubersniff::sniffer::http::Sniffer(privilege_separation->get_frame_ring(), data_collector,
+                    config.get_sniffer_config())
+                : ubersniff::sniffer::http::Sniffer(interface_name, data_collector, config.get_sniffer_config(),
+                    is_replay ? ubersniff::sniffer::http::Sniffer::Source::FILE : ubersniff::sniffer::http::Sniffer::Source::INTERFACE);
+            if (is_replay)
+                std::cout << "Starting replay of " << interface_name << std::endl;
+            else if (privilege_separation)
+                std::cout << "Starting worker as user " << config.get_privilege_separation_config().user << std::endl;
+            else if (route_watcher)
+                std::cout << "Starting capture on interface " << interface_name << std::endl;
+            else
+                std::cout << "Starting capture on the configured interfaces" << std::endl;
+
+            // throttle the extraction, the bodies and the uploads to hold the CPU budget
+            auto cpu_governor = ubersniff::governor::CpuGovernor(config.get_cpu_governor_config());
+            auto apply_cpu_governor_level = [&]() {
+                data_collector.set_extraction_ratio(cpu_governor.get_extraction_ratio());
+                ubersniff::packet::HTTPReassembler::set_max_body_size(cpu_governor.get_max_body_size());
+            };
+            apply_cpu_governor_level();
+
+            auto started_at = std::chrono::steady_clock::now();
+            http_sniffer.start_sniffing();
+            auto is_analysed = false;
+            auto last_analysis_time = started_at;
+
+            while (!quit.load()) {
+                // the CPU used by a replay at full speed would throttle it differently run after run
+                if (!is_replay && cpu_governor.update())
+                    apply_cpu_governor_level();
+                if (flight_dump_requested.exchange(false) && flight_recorder.is_enabled()) {
+                    auto frames = flight_recorder.dump(flight_recorder.get_config().file);
+                    std::cout << frames << " frames written in " << flight_recorder.get_config().file << std::endl;
+                }
+
+                // the replay is finished when the whole file is read and its exchanges are processed
+                bool is_replay_finished = is_replay && !http_sniffer.is_sniffing();
+
+                // check default interface
+                if (route_watcher && route_watcher->poll_change(interface_name)) {
+                    std::cout << "Change capture on interface " << interface_name << std::endl;
+                    http_sniffer.change_interface(interface_name);
+                }
+                // the exchanges completed before the packet time of all the reassembly threads are queued already
+                auto packet_time = http_sniffer.get_packet_time();
+                if (!data_collector.process_next_exchanges()) {
+                    // the batches grow between the uploads when the CPU is throttled
+                    bool is_batch_due = !is_replay
+                        && std::chrono::steady_clock::now() - last_analysis_time >= cpu_governor.get_batch_interval();
+                    if (is_replay) {
+                        // the queues are drained: the windows ended at the packet time are complete
+                        ubersniff::collector::DataBatches data_batches;
+                        while (data_collector.extract_ended_window(packet_time, data_batches))
+                            uberback.analyze_data(std::move(data_batches));
+                    } else if (!is_analysed && is_batch_due) {
+                        //data_collector.dump();
+                        is_analysed = true;
+                        last_analysis_time = std::chrono::steady_clock::now();
+                        // analyse the collected data
+                        uberback.analyze_data(std::move(data_collector.extract_data_batches()));
+                    }
+                    if (is_replay_finished)
+                        break;
+                    auto sleeping_time = std::chrono::milliseconds(is_replay ? 1 : 100);
+                    std::this_thread::sleep_for(sleeping_time);
+                } else {
+                    is_analysed = false;
                 }
-                auto sleeping_time = std::chrono::milliseconds(100);
-                std::this_thread::sleep_for(sleeping_time);
-            } else {
-                is_analysed = false;
             }
+            elapsed_time = std::chrono::steady_clock::now() - started_at;
+
+            std::cout << "quit" << std::endl;
+            shutdown_started_at = std::chrono::steady_clock::now();
+            auto drain_deadline = shutdown_started_at + config.get_drain_timeout();
+            http_sniffer.stop_sniffing(drain_deadline);
+            // the retries and the cooldown of the uploads go on at the pace of the steady clock
+            if (is_replay)
+                pipeline_clock.release();
+
+            // drain the exchanges left and upload the last batches before the deadline
+            while (std::chrono::steady_clock::now() < drain_deadline) {
+                if (!data_collector.process_next_exchanges())
+                    break;
+            }
+            ubersniff::collector::DataBatches data_batches;
+            while (data_collector.extract_ended_window(ubersniff::timing::Clock::TimePoint::max(), data_batches))
+                uberback.analyze_data(std::move(data_batches));
+            uberback.analyze_data(data_collector.extract_data_batches());
+            if (!uberback.flush(drain_deadline))
+                std::cout << "Drain timeout reached, the uploads left are spooled" << std::endl;
         }
- 
-        std::cout << "quit" << std::endl;
-        http_sniffer.stop_sniffing();
+        // the uploads left are spooled when UberBack is destroyed
+        auto shutdown_time = std::chrono::steady_clock::now() - shutdown_started_at;
+        ubersniff::metrics::Registry::get_default().gauge("ubersniff_shutdown_nanoseconds",
+            "Duration of the shutdown, from the quit to the end of the uploads")
+            .set(std::chrono::duration_cast<std::chrono::nanoseconds>(shutdown_time).count());
+        // the uploads of the replay are finished
+        if (is_replay)
+            write_replay_report(report_file, elapsed_time);
+        if (config.get_trace_config().sampling_rate > 0)
+            tracer.dump(config.get_trace_config().file);
     }
     catch (std::exception& ex) {
         std::cerr << "Error: " << ex.what() << std::endl;
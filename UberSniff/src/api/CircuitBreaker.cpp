@@ -0,0 +1,80 @@
+#include "api/CircuitBreaker.hpp"
+
+namespace ubersniff::api {
+	CircuitBreaker::CircuitBreaker(size_t threshold, std::chrono::milliseconds cooldown) noexcept :
+		_threshold(threshold ? threshold : 1),
+		_cooldown(cooldown),
+		_state(State::CLOSED),
+		_consecutive_failures(0),
+		_is_trial_running(false),
+		_opened_at()
+	{}
+
+	bool CircuitBreaker::allow_request() noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		switch (_state) {
+		case State::CLOSED:
+			return true;
+		case State::OPEN:
+			if (timing::Clock::get_default().now() - _opened_at < _cooldown)
+				return false;
+			// cooldown expired: let a trial upload through
+			_state = State::HALF_OPEN;
+			_is_trial_running = true;
+			return true;
+		case State::HALF_OPEN:
+			if (_is_trial_running)
+				return false;
+			_is_trial_running = true;
+			return true;
+		}
+		return false;
+	}
+
+	void CircuitBreaker::record_success() noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_state = State::CLOSED;
+		_consecutive_failures = 0;
+		_is_trial_running = false;
+	}
+
+	void CircuitBreaker::record_failure() noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		++_consecutive_failures;
+		// a failed trial reopens the circuit immediately
+		if (_state == State::HALF_OPEN || _consecutive_failures >= _threshold) {
+			_state = State::OPEN;
+			_opened_at = timing::Clock::get_default().now();
+		}
+		_is_trial_running = false;
+	}
+
+	CircuitBreaker::State CircuitBreaker::get_state() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _state;
+	}
+
+	bool CircuitBreaker::is_trial_running() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _is_trial_running;
+	}
+
+	std::chrono::milliseconds CircuitBreaker::get_remaining_cooldown() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_state != State::OPEN)
+			return std::chrono::milliseconds(0);
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+			timing::Clock::get_default().now() - _opened_at);
+		return elapsed >= _cooldown ? std::chrono::milliseconds(0) : _cooldown - elapsed;
+	}
+}
@@ -6,51 +6,125 @@
 #include "api/Session.hpp"
 
 namespace ubersniff::api {
+    Session::Session(boost::asio::io_context& ioc, ssl::context& ctx, CompletionHandler completion_handler,
+            std::atomic<size_t>& connections, std::atomic<size_t>& handler_heap_allocations) :
+        _strand(boost::asio::make_strand(ioc)),
+        _ctx(ctx),
+        _resolver(_strand.get_inner_executor()),
+        _request(std::piecewise_construct, std::make_tuple(), std::make_tuple(&_fields_memory)),
+        _response(std::piecewise_construct, std::make_tuple(), std::make_tuple(&_fields_memory)),
+        _handler_memory(handler_heap_allocations),
+        _completion_handler(std::move(completion_handler)),
+        _connections(connections),
+        _host(nullptr),
+        _port(nullptr),
+        _is_running(false),
+        _is_connected(false),
+        _is_reused_connection(false),
+        _is_success(false),
+        _status(0)
+    {
+    }
+
     // Report a failure
-    void fail(boost::system::error_code ec, char const* what)
+    void Session::_fail(boost::system::error_code ec, char const* what)
     {
         std::cerr << what << ": " << ec.message() << "\n";
+        _close();
+        _complete(false);
+    }
+
+    // Notify the end of the upload, only the first call is taken into account
+    void Session::_complete(bool is_success)
+    {
+        if (!_is_running)
+            return;
+        _is_running = false;
+        _completion_handler(*this, is_success, _status);
     }
 
-    Session::Session(boost::asio::io_context& ioc) :
-        _ctx(ssl::context::sslv23_client),
-        _resolver(ioc),
-        _socket(ioc, 
-            (_ctx.set_verify_mode(ssl::context::verify_peer),
-                boost::certify::enable_native_https_server_verification(_ctx),
-                _ctx))
+    void Session::_close() noexcept
     {
+        boost::system::error_code ec;
+        if (_socket)
+            _socket->next_layer().close(ec);
+        _is_connected = false;
     }
 
     // Start the asynchronous operation
-    void Session::send_post_async(Session::Request request)
+    void Session::send_post_async(const Session::Request& request)
     {
-        // Set SNI Hostname (many hosts need this to handshake successfully)
-        if (!SSL_set_tlsext_host_name(_socket.native_handle(), request.host)) {
-            boost::system::error_code ec{ static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category() };
-            throw boost::system::system_error{ ec };
-        }
+        _is_running = true;
+        _is_success = false;
+        _status = 0;
+        _host = request.host;
+        _port = request.port;
 
-        // Set up an HTTP POST request message
+        // Set up an HTTP POST request message, the buffers of the previous upload are reused
         _request.version(11);
         _request.method(http::verb::post);
         _request.target(request.target);
         _request.set(http::field::host, request.host);
         _request.set(http::field::content_type, request.content_type);
-        _request.set(http::field::content_length, request.content_length);
         _request.set("token", request.token);
-        _request.body() = request.body;
+        _request.content_length(request.content_length);
+        _request.keep_alive(true);
+        _request.body().assign(request.body, request.content_length);
+
+        // Continue in the strand of the session
+        boost::asio::dispatch(_strand, _make_handler([this]() {
+            _start();
+        }));
+    }
+
+    void Session::_start()
+    {
+        // Reuse the connection of the previous upload
+        if (_is_connected && !_is_connection_idle())
+            _close();
+        _is_reused_connection = _is_connected;
+        if (_is_reused_connection)
+            _write();
+        else
+            _connect();
+    }
+
+    /*
+    ** Check that nothing was received since the last response: the server has not closed the connection kept alive
+    ** A TLS close notify or an end of stream is readable, an idle connection would block
+    */
+    bool Session::_is_connection_idle() noexcept
+    {
+        auto& socket = _socket->next_layer();
+        boost::system::error_code ec;
+        char byte;
+
+        socket.non_blocking(true, ec);
+        if (ec)
+            return false;
+        socket.receive(boost::asio::buffer(&byte, sizeof(byte)), tcp::socket::message_peek, ec);
+        return ec == boost::asio::error::would_block;
+    }
+
+    // Open a new connection to the server
+    void Session::_connect()
+    {
+        _socket.emplace(_strand.get_inner_executor(), _ctx);
+        _buffer.consume(_buffer.size());
+
+        // Set SNI Hostname (many hosts need this to handshake successfully)
+        if (!SSL_set_tlsext_host_name(_socket->native_handle(), _host)) {
+            boost::system::error_code ec{ static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category() };
+            return _fail(ec, "sni");
+        }
 
         // Look up the domain name
         _resolver.async_resolve(
-            request.host,
-            request.port,
-            std::bind(
-                &Session::on_resolve,
-                shared_from_this(),
-                std::placeholders::_1,
-                std::placeholders::_2
-            ));
+            _host,
+            _port,
+            _make_handler([this](boost::system::error_code ec, tcp::resolver::results_type results) {
+                on_resolve(ec, std::move(results));
+            }));
     }
 
     void Session::on_resolve(
@@ -58,79 +132,95 @@ namespace ubersniff::api {
             tcp::resolver::results_type results)
     {
         if (ec)
-            return fail(ec, "resolve");
+            return _fail(ec, "resolve");
 
         // Make the connection on the IP address we get from a lookup
         boost::asio::async_connect(
-            _socket.next_layer(),
+            _socket->next_layer(),
             results.begin(),
             results.end(),
-            std::bind(
-                &Session::on_connect,
-                shared_from_this(),
-                std::placeholders::_1
-            ));
+            _make_handler([this](boost::system::error_code ec, tcp::resolver::results_type::iterator) {
+                on_connect(ec);
+            }));
     }
 
     void Session::on_connect(boost::system::error_code ec)
     {
         if (ec)
-            return fail(ec, "connect");
+            return _fail(ec, "connect");
 
         // Perform the SSL handshake
-        _socket.async_handshake(
+        _socket->async_handshake(
             ssl::stream_base::client,
-            std::bind(
-                &Session::on_handshake,
-                shared_from_this(),
-                std::placeholders::_1));
+            _make_handler([this](boost::system::error_code ec) {
+                on_handshake(ec);
+            }));
     }
 
     void Session::on_handshake(boost::system::error_code ec)
     {
         if (ec)
-            return fail(ec, "on_handshake");
-
-        // Send the HTTP request to the remote host
-        http::async_write(_socket, _request,
-            std::bind(
-                &Session::on_write,
-                shared_from_this(),
-                std::placeholders::_1,
-                std::placeholders::_2
-            ));
+            return _fail(ec, "on_handshake");
+
+        ++_connections;
+        _is_connected = true;
+        _write();
+    }
+
+    // Send the HTTP request to the remote host
+    void Session::_write()
+    {
+        http::async_write(*_socket, _request,
+            _make_handler([this](boost::system::error_code ec, std::size_t bytes_transferred) {
+                on_write(ec, bytes_transferred);
+            }));
     }
 
     void Session::on_write(boost::system::error_code ec, std::size_t bytes_transferred)
     {
         boost::ignore_unused(bytes_transferred);
 
+        if (ec && _is_reused_connection) {
+            // the server has closed the connection kept alive before the request: open a new one
+            _close();
+            _is_reused_connection = false;
+            return _connect();
+        }
         if (ec)
-            return fail(ec, "write");
-
-        // Receive the HTTP response
-        http::async_read(_socket, _buffer, _response,
-            std::bind(
-                &Session::on_read,
-                shared_from_this(),
-                std::placeholders::_1,
-                std::placeholders::_2
-            ));
+            return _fail(ec, "write");
+
+        // Receive the HTTP response, the body keeps its capacity
+        _response.clear();
+        _response.body().clear();
+        http::async_read(*_socket, _buffer, _response,
+            _make_handler([this](boost::system::error_code ec, std::size_t bytes_transferred) {
+                on_read(ec, bytes_transferred);
+            }));
     }
 
     void Session::on_read(boost::system::error_code ec, std::size_t bytes_transferred)
     {
         boost::ignore_unused(bytes_transferred);
 
+        // the request may have been processed: it is not sent again, even on a connection kept alive
         if (ec)
-            return fail(ec, "read");
+            return _fail(ec, "read");
+
+        // Only a 2xx status means that UberBack accepted the data
+        _status = _response.result_int();
+        _is_success = _status / 100 == 2;
+        if (!_is_success)
+            std::cerr << "upload: rejected with status " << _status << "\n";
+
+        // Keep the connection for the next upload
+        if (_response.keep_alive())
+            return _complete(_is_success);
 
         // Gracefully close the stream
-        _socket.async_shutdown(
-            std::bind(
-                &Session::on_shutdown,
-                shared_from_this(),
-                std::placeholders::_1));
+        _socket->async_shutdown(
+            _make_handler([this](boost::system::error_code ec) {
+                on_shutdown(ec);
+            }));
     }
 
     void Session::on_shutdown(boost::system::error_code ec)
@@ -138,6 +228,9 @@ namespace ubersniff::api {
         if (ec == boost::asio::error::eof)
             ec.assign(0, ec.category());
         if (ec)
-            return fail(ec, "shutdown");
+            // the data has already been delivered, only report the error
+            std::cerr << "shutdown: " << ec.message() << "\n";
+        _close();
+        _complete(_is_success);
     }
 }
@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <boost/crc.hpp>
+#include "api/Spool.hpp"
+
+namespace ubersniff::api {
+	Spool::Spool(const Spool::Config& config) :
+		_config(config),
+		_next_record_id(0),
+		_pending_bytes(0),
+		_evicted_bytes(0),
+		_is_stopping(false)
+	{
+		if (_config.segment_size <= sizeof(RecordHeader))
+			throw std::invalid_argument("Invalid Spool config: SegmentSize is too small");
+		std::filesystem::create_directories(_config.directory);
+
+		// list the existing segments
+		for (auto& entry : std::filesystem::directory_iterator(_config.directory)) {
+			auto filename = entry.path().filename().string();
+			if (filename.rfind("segment-", 0) != 0 || entry.path().extension() != ".spool")
+				continue;
+			try {
+				_open_segment(std::stoull(filename.substr(8)));
+			} catch (std::exception&) {
+				// not a segment of the spool
+			}
+		}
+
+		// recover the pending records in order
+		for (auto& segment : _segments)
+			_recover_segment(*segment.second);
+
+		// remove the consumed segments, except the last one which is still writable
+		while (_segments.size() > 1 && !_segments.begin()->second->pending_records)
+			_remove_segment(_segments.begin()->first);
+
+		_sync_thread = std::thread(&Spool::_run_sync, this);
+	}
+
+	Spool::~Spool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex_stop);
+			_is_stopping = true;
+		}
+		_stop_condition.notify_all();
+		_sync_thread.join();
+
+		_sync_segments();
+	}
+
+	/*
+	** Flush the ranges written since the last sync and wait for the disk
+	** The ranges are taken under the lock and flushed without it: the appends and the pops go on during the flush,
+	**  their writes are flushed by the next sync
+	** Called by the sync thread only, then by the destructor
+	*/
+	void Spool::_sync_segments()
+	{
+		std::vector<DirtyRange> dirty_ranges;
+		{
+			std::lock_guard<std::mutex> lock(_mutex_spool);
+			for (auto& segment : _segments) {
+				auto& dirty_segment = *segment.second;
+				if (!dirty_segment.dirty_end)
+					continue;
+				dirty_ranges.push_back({ &dirty_segment, dirty_segment.dirty_begin,
+					dirty_segment.dirty_end - dirty_segment.dirty_begin });
+				dirty_segment.dirty_begin = 0;
+				dirty_segment.dirty_end = 0;
+				dirty_segment.is_syncing = true;
+			}
+		}
+		for (auto& dirty_range : dirty_ranges)
+			dirty_range.segment->region.flush(dirty_range.offset, dirty_range.size, false);
+
+		std::lock_guard<std::mutex> lock(_mutex_spool);
+		for (auto& segment : _segments)
+			segment.second->is_syncing = false;
+		for (auto& removed_segment : _removed_segments)
+			_delete_segment(std::move(removed_segment));
+		_removed_segments.clear();
+	}
+
+	void Spool::_run_sync()
+	{
+		std::unique_lock<std::mutex> stop_lock(_mutex_stop);
+		while (!_stop_condition.wait_for(stop_lock, _config.sync_interval, [this]() { return _is_stopping; }))
+			_sync_segments();
+	}
+
+	void Spool::_mark_dirty(Segment& segment, size_t offset, size_t size) noexcept
+	{
+		if (!segment.dirty_end) {
+			segment.dirty_begin = offset;
+			segment.dirty_end = offset + size;
+			return;
+		}
+		segment.dirty_begin = std::min(segment.dirty_begin, offset);
+		segment.dirty_end = std::max(segment.dirty_end, offset + size);
+	}
+
+	std::filesystem::path Spool::_get_segment_path(uint64_t id) const
+	{
+		std::stringstream filename;
+		filename << "segment-" << std::setw(16) << std::setfill('0') << id << ".spool";
+		return std::filesystem::path(_config.directory) / filename.str();
+	}
+
+	/*
+	** Create a new segment file filled with zeros and map it
+	*/
+	Spool::Segment& Spool::_create_segment(uint64_t id)
+	{
+		auto path = _get_segment_path(id);
+		{
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			if (!file)
+				throw std::runtime_error("Can not create the spool segment " + path.string());
+		}
+		std::filesystem::resize_file(path, _config.segment_size);
+		_open_segment(id);
+		return *_segments.at(id);
+	}
+
+	void Spool::_open_segment(uint64_t id)
+	{
+		auto segment = std::make_unique<Segment>();
+		segment->id = id;
+		segment->path = _get_segment_path(id);
+		// ignore the segments of an other size (incomplete creation)
+		if (std::filesystem::file_size(segment->path) != _config.segment_size)
+			return;
+		segment->file = boost::interprocess::file_mapping(segment->path.string().c_str(), boost::interprocess::read_write);
+		segment->region = boost::interprocess::mapped_region(segment->file, boost::interprocess::read_write);
+		_segments[id] = std::move(segment);
+	}
+
+	/*
+	** Scan the records of a segment and index the pending ones
+	** The scan stops at the first invalid record, next writes will overwrite it
+	*/
+	void Spool::_recover_segment(Segment& segment)
+	{
+		auto data = static_cast<char*>(segment.region.get_address());
+		size_t offset = 0;
+
+		while (offset + sizeof(RecordHeader) <= _config.segment_size) {
+			RecordHeader header;
+			std::memcpy(&header, data + offset, sizeof(RecordHeader));
+			if (header.magic != RECORD_MAGIC
+				|| offset + _get_record_size(header.length) > _config.segment_size
+				|| header.crc != _compute_crc(data + offset + sizeof(RecordHeader), header.length))
+				break;
+
+			if (header.state == static_cast<uint32_t>(RecordState::PENDING)) {
+				_records.push_back({ _next_record_id++, &segment, offset });
+				++segment.pending_records;
+				_pending_bytes += header.length;
+			}
+			offset += _get_record_size(header.length);
+		}
+		segment.write_offset = offset;
+	}
+
+	/*
+	** A segment being flushed is kept mapped until the end of the flush
+	*/
+	void Spool::_remove_segment(uint64_t id)
+	{
+		auto segment = std::move(_segments.at(id));
+		_segments.erase(id);
+		if (segment->is_syncing)
+			_removed_segments.push_back(std::move(segment));
+		else
+			_delete_segment(std::move(segment));
+	}
+
+	void Spool::_delete_segment(std::unique_ptr<Segment> segment)
+	{
+		auto path = segment->path;
+		// unmapped before the file is deleted
+		segment.reset();
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+	}
+
+	/*
+	** Remove a segment and its pending records
+	** The records of a segment are contiguous in the records
+	*/
+	void Spool::_evict_segment(Segment& segment)
+	{
+		auto data = static_cast<const char*>(segment.region.get_address());
+		auto is_in_segment = [&segment](const RecordPosition& position) { return position.segment == &segment; };
+		auto first_record = std::find_if(_records.begin(), _records.end(), is_in_segment);
+		auto last_record = std::find_if_not(first_record, _records.end(), is_in_segment);
+
+		for (auto record = first_record; record != last_record; ++record) {
+			RecordHeader header;
+			std::memcpy(&header, data + record->offset, sizeof(RecordHeader));
+			_pending_bytes -= header.length;
+			_evicted_bytes += header.length;
+		}
+		_records.erase(first_record, last_record);
+		_remove_segment(segment.id);
+	}
+
+	/*
+	** Remove the oldest segment, or the next one if the oldest holds the record being replayed
+	** Returns false if there is no segment to evict
+	*/
+	bool Spool::_evict_oldest_segment()
+	{
+		for (auto& segment : _segments) {
+			bool is_replayed = _replayed_record_id && !_records.empty()
+				&& _records.front().id == *_replayed_record_id && _records.front().segment == segment.second.get();
+			if (!is_replayed) {
+				_evict_segment(*segment.second);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*
+	** Return the segment where the record will be written
+	** A new segment is created when the last one is full, evicting the oldest ones to respect the size limit
+	** Returns nullptr if the size limit can't be respected
+	*/
+	Spool::Segment* Spool::_get_writable_segment(size_t record_size)
+	{
+		if (!_segments.empty()) {
+			auto& last_segment = *_segments.rbegin()->second;
+			if (last_segment.write_offset + record_size <= _config.segment_size)
+				return &last_segment;
+		}
+
+		uint64_t id = _segments.empty() ? 0 : _segments.rbegin()->first + 1;
+		while (!_segments.empty() && (_segments.size() + 1) * _config.segment_size > _config.max_size) {
+			if (!_evict_oldest_segment())
+				return nullptr;
+		}
+		return &_create_segment(id);
+	}
+
+	bool Spool::append(const std::string& record)
+	{
+		auto record_size = _get_record_size(record.size());
+		if (record_size > _config.segment_size)
+			return false;
+
+		std::lock_guard<std::mutex> lock(_mutex_spool);
+		auto* writable_segment = _get_writable_segment(record_size);
+		if (!writable_segment)
+			return false;
+		auto& segment = *writable_segment;
+		auto data = static_cast<char*>(segment.region.get_address()) + segment.write_offset;
+
+		// write the payload and the header, the magic at the end validates the record
+		RecordHeader header = {
+			0,
+			static_cast<uint32_t>(RecordState::PENDING),
+			static_cast<uint32_t>(record.size()),
+			_compute_crc(record.data(), record.size())
+		};
+		std::memcpy(data + sizeof(RecordHeader), record.data(), record.size());
+		std::memcpy(data, &header, sizeof(RecordHeader));
+		header.magic = RECORD_MAGIC;
+		std::memcpy(data + offsetof(RecordHeader, magic), &header.magic, sizeof(header.magic));
+		// synced by the sync thread, the network threads don't wait for the disk
+		_mark_dirty(segment, segment.write_offset, record_size);
+
+		_records.push_back({ _next_record_id++, &segment, segment.write_offset });
+		segment.write_offset += record_size;
+		++segment.pending_records;
+		_pending_bytes += record.size();
+		return true;
+	}
+
+	bool Spool::front(std::string& record, RecordId& id)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_spool);
+
+		if (_records.empty())
+			return false;
+		auto& position = _records.front();
+		id = position.id;
+		_replayed_record_id = id;
+		auto data = static_cast<const char*>(position.segment->region.get_address()) + position.offset;
+		RecordHeader header;
+		std::memcpy(&header, data, sizeof(RecordHeader));
+		record.assign(data + sizeof(RecordHeader), header.length);
+		return true;
+	}
+
+	void Spool::pop(RecordId id)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_spool);
+
+		if (_replayed_record_id == id)
+			_replayed_record_id.reset();
+		if (_records.empty() || _records.front().id != id)
+			return;
+		auto position = _records.front();
+		_records.pop_front();
+
+		// mark the record as consumed
+		auto data = static_cast<char*>(position.segment->region.get_address()) + position.offset;
+		RecordHeader header;
+		std::memcpy(&header, data, sizeof(RecordHeader));
+		header.state = static_cast<uint32_t>(RecordState::CONSUMED);
+		std::memcpy(data + offsetof(RecordHeader, state), &header.state, sizeof(header.state));
+		_mark_dirty(*position.segment, position.offset, sizeof(RecordHeader));
+
+		_pending_bytes -= header.length;
+		// remove the segment when all of its records are consumed, except the writable one
+		if (!--position.segment->pending_records && position.segment != _segments.rbegin()->second.get())
+			_remove_segment(position.segment->id);
+	}
+
+	size_t Spool::depth() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex_spool);
+		return _records.size();
+	}
+
+	size_t Spool::size() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex_spool);
+		return _pending_bytes;
+	}
+
+	size_t Spool::evicted_size() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex_spool);
+		return _evicted_bytes;
+	}
+
+	size_t Spool::_get_record_size(size_t length) noexcept
+	{
+		// records are aligned on 4 bytes
+		return (sizeof(RecordHeader) + length + 3) & ~static_cast<size_t>(3);
+	}
+
+	uint32_t Spool::_compute_crc(const char* data, size_t length) noexcept
+	{
+		boost::crc_32_type crc;
+		crc.process_bytes(data, length);
+		return crc.checksum();
+	}
+}
@@ -0,0 +1,85 @@
+#include <chrono>
+#include "api/StringDictionary.hpp"
+
+namespace ubersniff::api {
+	StringDictionary::StringDictionary(size_t max_size) :
+		_max_size(max_size),
+		_epoch(static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()))
+	{}
+
+	void StringDictionary::_reset() noexcept
+	{
+		++_epoch;
+		_ids.clear();
+		_strings.clear();
+		_is_acknowledged.clear();
+	}
+
+	uint32_t StringDictionary::intern(const std::string& str, bool& is_defined)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_dictionary);
+
+		auto it = _ids.find(str);
+		if (it == _ids.end()) {
+			// new string
+			auto id = static_cast<uint32_t>(_strings.size());
+			it = _ids.emplace(str, id).first;
+			_strings.push_back(&it->first);
+			_is_acknowledged.push_back(false);
+		}
+		is_defined = _is_acknowledged[it->second];
+		return it->second;
+	}
+
+	bool StringDictionary::get(uint64_t epoch, uint32_t id, std::string& str) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex_dictionary);
+
+		if (epoch != _epoch || id >= _strings.size())
+			return false;
+		str = *_strings[id];
+		return true;
+	}
+
+	uint64_t StringDictionary::prepare(size_t nb_new_strings)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_dictionary);
+
+		if (_strings.size() + nb_new_strings > _max_size)
+			_reset();
+		return _epoch;
+	}
+
+	uint64_t StringDictionary::get_epoch() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex_dictionary);
+		return _epoch;
+	}
+
+	void StringDictionary::acknowledge(uint64_t epoch, const std::vector<uint32_t>& ids)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_dictionary);
+
+		if (epoch != _epoch)
+			return;
+		for (auto id : ids) {
+			if (id < _is_acknowledged.size())
+				_is_acknowledged[id] = true;
+		}
+	}
+
+	void StringDictionary::forget_acknowledgements(uint64_t epoch) noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex_dictionary);
+
+		if (epoch != _epoch)
+			return;
+		std::fill(_is_acknowledged.begin(), _is_acknowledged.end(), false);
+	}
+
+	size_t StringDictionary::size() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex_dictionary);
+		return _strings.size();
+	}
+}
@@ -1,14 +1,70 @@
+#include <algorithm>
+#include <iostream>
 #include <sstream>
+#include <thread>
 #include "api/UberBack.hpp"
+#include "api/encoder/CborEncoder.hpp"
+#include "api/encoder/DeltaJsonEncoder.hpp"
+#include "api/encoder/JsonEncoder.hpp"
 
 namespace ubersniff::api {
-	UberBack::UberBack(const UberBack::Config &config) noexcept :
+	const UberBack::ExportedMetric UberBack::_exported_metrics[] = {
+		{ "ubersniff_uberback_network_threads", "Threads running the network I/O", false, &Metrics::network_threads },
+		{ "ubersniff_uberback_serialization_threads", "Threads serializing the data batches", false, &Metrics::serialization_threads },
+		{ "ubersniff_uberback_serializations_total", "Data batches serialized", true, &Metrics::serializations },
+		{ "ubersniff_uberback_pending_batches", "Data batches waiting to be serialized", false, &Metrics::pending_batches },
+		{ "ubersniff_uberback_queue_depth", "Uploads waiting in memory", false, &Metrics::queue_depth },
+		{ "ubersniff_uberback_queue_bytes", "Bytes of the uploads waiting in memory", false, &Metrics::queue_bytes },
+		{ "ubersniff_uberback_in_flight", "Uploads in progress", false, &Metrics::in_flight },
+		{ "ubersniff_uberback_uploads_total", "Uploads accepted by UberBack", true, &Metrics::uploads },
+		{ "ubersniff_uberback_failures_total", "Failed upload attempts", true, &Metrics::failures },
+		{ "ubersniff_uberback_retries_total", "Upload attempts retried", true, &Metrics::retries },
+		{ "ubersniff_uberback_dropped_uploads_total", "Uploads lost", true, &Metrics::dropped_uploads },
+		{ "ubersniff_uberback_dropped_bytes_total", "Bytes of the uploads lost", true, &Metrics::dropped_bytes },
+		{ "ubersniff_uberback_spooled_uploads_total", "Uploads written in the spool", true, &Metrics::spooled_uploads },
+		{ "ubersniff_uberback_spool_depth", "Uploads waiting in the spool", false, &Metrics::spool_depth },
+		{ "ubersniff_uberback_spool_bytes", "Bytes used by the spool", false, &Metrics::spool_bytes },
+		{ "ubersniff_uberback_spool_evicted_bytes_total", "Bytes evicted from the spool", true, &Metrics::spool_evicted_bytes },
+		{ "ubersniff_uberback_sessions", "Sessions opened", false, &Metrics::sessions },
+		{ "ubersniff_uberback_connections_total", "TLS connections established", true, &Metrics::connections },
+		{ "ubersniff_uberback_handler_heap_allocations_total", "Handler allocations not served by the session memory", true, &Metrics::handler_heap_allocations }
+	};
+
+	UberBack::UberBack(const UberBack::Config &config) :
+		_config(config),
 		_io_context(),
 		_work(boost::asio::make_work_guard(_io_context)),
 		_worker_threads(),
-		_config(config)
+		_serialization_pool(config.serialization_threads),
+		_ssl_context(ssl::context::sslv23_client),
+		_upload_queue(config.max_queue_size),
+		_circuit_breaker(config.circuit_breaker_threshold, config.circuit_breaker_cooldown),
+		_spool(config.spool.directory.empty() ? nullptr : std::make_unique<Spool>(config.spool)),
+		_is_spool_replaying(false),
+		_encoder(_make_encoder(config)),
+		_upload_bytes(metrics::Registry::get_default().counter("ubersniff_uberback_upload_bytes_total",
+			"Bytes sent to UberBack")),
+		_serialization_latency(metrics::Registry::get_default().histogram("ubersniff_uberback_serialization_nanoseconds",
+			"Duration of the serialization of the data batches")),
+		_upload_latency(metrics::Registry::get_default().histogram("ubersniff_uberback_upload_nanoseconds",
+			"Duration of an upload attempt")),
+		_is_stopping(false),
+		_is_wake_up_scheduled(false),
+		// the retries of a replay are drawn again run after run
+		_jitter_generator(timing::Clock::get_default().is_packet_time()
+			? 0 : static_cast<unsigned>(std::chrono::steady_clock::now().time_since_epoch().count()))
 	{
-		for (int x = 0; x < 2; ++x)
+		// the TLS context is shared by the sessions
+		_ssl_context.set_verify_mode(ssl::context::verify_peer);
+		boost::certify::enable_native_https_server_verification(_ssl_context);
+		_upload_slots.reserve(_config.max_concurrent_uploads);
+		_idle_upload_slots.reserve(_config.max_concurrent_uploads);
+
+		_update_queue_metrics();
+		_metrics.network_threads = _config.network_threads;
+		_metrics.serialization_threads = _config.serialization_threads;
+		_register_metrics();
+		for (size_t x = 0; x < _config.network_threads; ++x)
 		{
 			_worker_threads.create_thread(
 				boost::bind(&boost::asio::io_service::run, &_io_context)
@@ -18,8 +74,22 @@ namespace ubersniff::api {
 
 	UberBack::~UberBack()
 	{
+		_unregister_metrics();
+		// cancel the pending retries, their uploads are spooled and the uploads in flight are terminated
+		_is_stopping = true;
+		{
+			std::lock_guard<std::mutex> lock(_mutex_timers);
+			for (auto& timer : _timers)
+				timer->cancel();
+		}
+		_serialization_pool.join();
 		_work.reset();
 		_worker_threads.join_all();
+
+		// keep the uploads not sent yet in the spool
+		std::shared_ptr<Upload> upload;
+		while (_spool && _upload_queue.pop(upload))
+			_drop_upload(*upload);
 	}
 
 	void UberBack::analyze_data(collector::DataBatches data_batches)
@@ -27,86 +97,444 @@ namespace ubersniff::api {
 		if (data_batches.size() == 0)
 			return; // no data
 
-		boost::asio::post(_io_context, std::bind(&UberBack::_analyze_data_async, this, std::move(data_batches)));
+		++_metrics.pending_batches;
+		boost::asio::post(_serialization_pool, std::bind(&UberBack::_analyze_data_async, this, std::move(data_batches)));
+	}
+
+	std::unique_ptr<encoder::IEncoder> UberBack::_make_encoder(const UberBack::Config& config)
+	{
+		if (config.format == "delta")
+			return std::make_unique<encoder::DeltaJsonEncoder>(config.userId, config.service, config.dictionary_size);
+		if (config.format == "cbor")
+			return std::make_unique<encoder::CborEncoder>(config.userId, config.service);
+		return std::make_unique<encoder::JsonEncoder>(config.userId, config.service);
+	}
+
+	void UberBack::_register_metrics()
+	{
+		auto& registry = metrics::Registry::get_default();
+		for (const auto& exported_metric : _exported_metrics) {
+			auto callback = [this, value = exported_metric.value]() {
+				return static_cast<double>((_metrics.*value).load());
+			};
+			if (exported_metric.is_counter)
+				registry.counter_callback(exported_metric.name, exported_metric.help, callback);
+			else
+				registry.gauge_callback(exported_metric.name, exported_metric.help, callback);
+		}
+	}
+
+	void UberBack::_unregister_metrics()
+	{
+		for (const auto& exported_metric : _exported_metrics)
+			metrics::Registry::get_default().unregister_callback(exported_metric.name);
+	}
+
+	const UberBack::Metrics& UberBack::get_metrics() const noexcept
+	{
+		return _metrics;
 	}
 
+	/*
+	** Serialize the data batches, run by the serialization threads
+	*/
 	void UberBack::_analyze_data_async(collector::DataBatches data_batches)
 	{
-		std::string body = _convert_data_batch_to_json(data_batches);
+		auto upload = std::make_shared<Upload>();
+		auto started_at = std::chrono::steady_clock::now();
+		_encoder->encode(data_batches, *upload);
+		_serialization_latency.observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - started_at).count());
+		++_metrics.serializations;
+		for (auto& data_batch : data_batches) {
+			auto& traces = data_batch.second.traces;
+			upload->traces.insert(upload->traces.end(), std::make_move_iterator(traces.begin()),
+				std::make_move_iterator(traces.end()));
+			traces.clear();
+		}
+		// a delta upload depends on the dictionary, which may evict its strings before it is sent
+		if (_config.format == "delta")
+			upload->data_batches = std::make_shared<const collector::DataBatches>(std::move(data_batches));
+
+		// back to the network threads to start the upload
+		boost::asio::post(_io_context, [this, upload = std::move(upload)]() mutable {
+			_enqueue_upload(std::move(upload));
+			--_metrics.pending_batches;
+			_pump_uploads();
+		});
+	}
+
+	bool UberBack::flush(std::chrono::steady_clock::time_point deadline)
+	{
+		auto is_flushed = [this]() {
+			// the timers hold the uploads waiting for a retry
+			std::lock_guard<std::mutex> lock(_mutex_timers);
+			return !_metrics.pending_batches && !_metrics.queue_depth && !_metrics.in_flight && _timers.empty();
+		};
+
+		while (!is_flushed()) {
+			// nothing will be sent before the end of the cooldown
+			if (std::chrono::steady_clock::now() >= deadline || _circuit_breaker.get_state() == CircuitBreaker::State::OPEN)
+				return false;
+			std::this_thread::sleep_for(FLUSH_POLL_INTERVAL);
+		}
+		return true;
+	}
+
+	/*
+	** Add an upload in the queue
+	** The uploads dropped to respect the memory limit of the queue are counted in the metrics
+	*/
+	void UberBack::_enqueue_upload(std::shared_ptr<Upload> upload, bool front)
+	{
+		// UberBack is unreachable: spill the upload to the disk
+		if (_circuit_breaker.get_state() != CircuitBreaker::State::CLOSED && _spool_upload(*upload))
+			return;
+
+		auto dropped_uploads = _upload_queue.push(std::move(upload), front);
+		for (auto& dropped_upload : dropped_uploads)
+			_drop_upload(*dropped_upload);
+		_update_queue_metrics();
+	}
+
+	/*
+	** Drop an upload that can't stay in memory
+	** It is written in the spool when it is enabled, otherwise it is lost
+	*/
+	void UberBack::_drop_upload(const Upload& upload)
+	{
+		if (_spool_upload(upload))
+			return;
+		++_metrics.dropped_uploads;
+		_metrics.dropped_bytes += upload.body.size();
+	}
+
+	/*
+	** Rewrite the upload to be readable without the dictionary
+	** When the dictionary has lost its strings, the data batches are encoded again as JSON
+	*/
+	bool UberBack::_make_self_contained(Upload& upload) const
+	{
+		if (_encoder->make_self_contained(upload))
+			return true;
+		if (!upload.data_batches)
+			return false;
+
+		encoder::JsonEncoder(_config.userId, _config.service).encode(*upload.data_batches, upload);
+		upload.dictionary_ids.clear();
+		upload.payload_offset = 0;
+		return true;
+	}
+
+	/*
+	** Write the upload in the spool, prefixed by the version of the record and its content type:
+	** "<version> <content type>\n<body>"
+	** A delta upload is written with all its definitions to be readable without the dictionary
+	*/
+	bool UberBack::_spool_upload(const Upload& upload)
+	{
+		if (!_spool)
+			return false;
+		try {
+			Upload spooled_upload = upload;
+			if (!_make_self_contained(spooled_upload))
+				return false;
+			if (!_spool->append(std::to_string(SPOOL_RECORD_VERSION) + ' ' + spooled_upload.content_type + '\n'
+				+ spooled_upload.body))
+				return false;
+		} catch (std::exception& e) {
+			std::cerr << "spool: " << e.what() << std::endl;
+			return false;
+		}
+		++_metrics.spooled_uploads;
+		_update_queue_metrics();
+		return true;
+	}
+
+	/*
+	** Get the oldest upload of the spool
+	** Only one spooled upload is in flight at a time to replay the spool in order
+	** A record of an unknown version is removed from the spool
+	*/
+	bool UberBack::_pop_spooled_upload(std::shared_ptr<Upload>& upload)
+	{
+		if (!_spool || _is_spool_replaying.exchange(true))
+			return false;
+
+		while (true) {
+			upload = std::make_shared<Upload>();
+			upload->is_spooled = true;
+			if (!_spool->front(upload->body, upload->spool_record_id)) {
+				_is_spool_replaying = false;
+				return false;
+			}
+			if (_parse_spooled_upload(*upload))
+				return true;
+			std::cerr << "spool: unknown record version, the record is removed" << std::endl;
+			++_metrics.dropped_uploads;
+			_metrics.dropped_bytes += upload->body.size();
+			_spool->pop(upload->spool_record_id);
+			_update_queue_metrics();
+		}
+	}
+
+	/*
+	** Split the version and the content type of the record from the body
+	** The records of the first version are the JSON bodies only
+	*/
+	bool UberBack::_parse_spooled_upload(Upload& upload)
+	{
+		if (!upload.body.empty() && upload.body.front() == '{') {
+			upload.content_type = "application/json";
+			return true;
+		}
+
+		auto version_end = upload.body.find(' ');
+		auto content_type_end = upload.body.find('\n');
+		if (version_end == std::string::npos || content_type_end == std::string::npos || version_end > content_type_end
+			|| upload.body.compare(0, version_end, std::to_string(SPOOL_RECORD_VERSION)) != 0)
+			return false;
+		upload.content_type = upload.body.substr(version_end + 1, content_type_end - version_end - 1);
+		upload.body.erase(0, content_type_end + 1);
+		return true;
+	}
+
+	/*
+	** The spooled upload is removed from the spool once it is accepted
+	** Otherwise it stays at the front of the spool and the replay is paused
+	*/
+	void UberBack::_on_spooled_upload_complete(const Upload& upload, bool is_success)
+	{
+		if (is_success) {
+			_spool->pop(upload.spool_record_id);
+			_update_queue_metrics();
+			_is_spool_replaying = false;
+		} else {
+			_schedule(_get_retry_delay(1), [this]() {
+				_is_spool_replaying = false;
+				_pump_uploads();
+			});
+		}
+	}
+
+	void UberBack::_update_queue_metrics() noexcept
+	{
+		_metrics.queue_depth = _upload_queue.depth();
+		_metrics.queue_bytes = _upload_queue.size();
+		if (_spool) {
+			_metrics.spool_depth = _spool->depth();
+			_metrics.spool_bytes = _spool->size();
+			_metrics.spool_evicted_bytes = _spool->evicted_size();
+		}
+	}
+
+	/*
+	** Start the queued uploads while the concurrency limit and the circuit breaker allow it
+	** When the circuit is open, a wake up is scheduled at the end of the cooldown
+	** While the trial upload of the half open circuit is in progress, its completion pumps the uploads again
+	*/
+	void UberBack::_pump_uploads()
+	{
+		while (!_is_stopping && !_circuit_breaker.is_trial_running()) {
+			// reserve a slot for the upload
+			auto in_flight = _metrics.in_flight.load();
+			if (in_flight >= _config.max_concurrent_uploads)
+				return;
+			if (!_metrics.in_flight.compare_exchange_weak(in_flight, in_flight + 1))
+				continue;
+
+			// the uploads in memory go first, then the spool is replayed
+			std::shared_ptr<Upload> upload;
+			if (!_upload_queue.pop(upload) && !_pop_spooled_upload(upload)) {
+				--_metrics.in_flight;
+				return;
+			}
+			if (!_circuit_breaker.allow_request()) {
+				// put back the upload and wait the end of the cooldown
+				--_metrics.in_flight;
+				if (upload->is_spooled)
+					_is_spool_replaying = false;
+				else
+					_enqueue_upload(std::move(upload), true);
+
+				// a trial started meanwhile wakes the pump up on completion
+				if (_circuit_breaker.get_state() == CircuitBreaker::State::OPEN && !_is_wake_up_scheduled.exchange(true)) {
+					auto cooldown = std::max(_circuit_breaker.get_remaining_cooldown(), std::chrono::milliseconds(1));
+					_schedule(cooldown, [this]() {
+						_is_wake_up_scheduled = false;
+						_pump_uploads();
+					});
+				}
+				return;
+			}
+			_update_queue_metrics();
+			_start_upload(std::move(upload));
+		}
+	}
+
+	/*
+	** Get an idle session, a new one is created until the concurrency limit is reached
+	*/
+	UberBack::UploadSlot& UberBack::_acquire_upload_slot()
+	{
+		std::lock_guard<std::mutex> lock(_mutex_upload_slots);
+
+		if (!_idle_upload_slots.empty()) {
+			auto upload_slot = _idle_upload_slots.back();
+			_idle_upload_slots.pop_back();
+			return *upload_slot;
+		}
+		auto upload_slot = std::make_unique<UploadSlot>();
+		auto& slot = *upload_slot;
+		slot.session = std::make_unique<Session>(_io_context, _ssl_context,
+			[this, &slot](Session&, bool is_success, unsigned status) {
+				_on_session_complete(slot, is_success, status);
+			},
+			_metrics.connections, _metrics.handler_heap_allocations);
+		_upload_slots.push_back(std::move(upload_slot));
+		++_metrics.sessions;
+		return slot;
+	}
+
+	void UberBack::_on_session_complete(UploadSlot& upload_slot, bool is_success, unsigned status)
+	{
+		auto upload = std::move(upload_slot.upload);
+		_upload_latency.observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - upload_slot.started_at).count());
+		{
+			std::lock_guard<std::mutex> lock(_mutex_upload_slots);
+			_idle_upload_slots.push_back(&upload_slot);
+		}
+		_on_upload_complete(std::move(upload), is_success, status);
+	}
+
+	void UberBack::_start_upload(std::shared_ptr<Upload> upload)
+	{
 		Session::Request request;
 
 		request.host = _config.host.c_str();
 		request.port = _config.port.c_str();
 		request.token = _config.token.c_str();
 		request.target = "/data";
-		request.content_type = "application/json";
-		request.body = body.c_str();
-		request.content_length = body.size();
-		std::make_shared<Session>(_io_context)->send_post_async(std::move(request));
+		request.content_type = upload->content_type.c_str();
+		request.body = upload->body.c_str();
+		request.content_length = upload->body.size();
+		++upload->attempt;
+
+		auto& upload_slot = _acquire_upload_slot();
+		upload_slot.upload = std::move(upload);
+		upload_slot.started_at = std::chrono::steady_clock::now();
+		_upload_bytes.inc(request.content_length);
+		upload_slot.session->send_post_async(request);
 	}
 
-	void UberBack::_convert_texts_to_json(const std::unordered_map<std::string, int>& texts, std::stringstream& body) const
+	/*
+	** Update the circuit breaker with the result of the upload
+	** A failed upload is retried with an exponential backoff until the maximum number of retries
+	*/
+	void UberBack::_on_upload_complete(std::shared_ptr<Upload> upload, bool is_success, unsigned status)
 	{
-		if (texts.empty())
-			return;
-		bool first_text = true;
-		body << ",\"texts\":[";
-		for (auto& text : texts) {
-			if (first_text)
-				first_text = false;
-			else
-				body << ",";
-			body << "{";
-			body << "\"content\":\"" << text.first << "\",";
-			body << "\"nb\":" << text.second;
-			body << "}";
+		--_metrics.in_flight;
+		if (upload->is_spooled)
+			_on_spooled_upload_complete(*upload, is_success);
+		if (is_success) {
+			++_metrics.uploads;
+			for (auto& record : upload->traces)
+				record->mark(trace::UPLOADED);
+			_circuit_breaker.record_success();
+			if (!upload->is_spooled)
+				_encoder->on_upload_accepted(*upload);
+		} else if (status == 409 && !upload->is_spooled) {
+			// UberBack has lost the state shared with the encoder: send again the upload self contained
+			_circuit_breaker.record_success();
+			_encoder->on_state_lost(*upload);
+			if (upload->attempt <= _config.max_retries && _make_self_contained(*upload)) {
+				++_metrics.retries;
+				_enqueue_upload(upload, true);
+			} else {
+				_drop_upload(*upload);
+			}
+		} else {
+			++_metrics.failures;
+			_circuit_breaker.record_failure();
+
+			if (upload->is_spooled) {
+				// the spool keeps the upload
+			} else if (upload->attempt <= _config.max_retries && !_is_stopping) {
+				++_metrics.retries;
+				_schedule(_get_retry_delay(upload->attempt), [this, upload]() {
+					_enqueue_upload(upload, true);
+					_pump_uploads();
+				}, [this, upload]() {
+					// UberBack is destroyed before the retry
+					_drop_upload(*upload);
+				});
+			} else {
+				_drop_upload(*upload);
+			}
 		}
-		body << "]";
+		_pump_uploads();
 	}
 
-	void UberBack::_convert_images_to_json(const std::unordered_map<std::string, int>& images, std::stringstream& body) const
+	/*
+	** Exponential backoff with jitter: the delay is picked between the half and the full backoff
+	*/
+	std::chrono::milliseconds UberBack::_get_retry_delay(size_t attempt)
 	{
-		if (images.empty())
-			return;
-		bool first_image = true;
-		body << ",\"images\":[";
-		for (auto& image : images) {
-			if (first_image)
-				first_image = false;
-			else
-				body << ",";
-			body << "{";
-			body << "\"content\":\"" << image.first << "\",";
-			body << "\"nb\":" << image.second;
-			body << "}";
-		}
-		body << "]";
+		auto delay = _config.retry_base_delay;
+		for (size_t i = 1; i < attempt && delay < _config.retry_max_delay; ++i)
+			delay *= 2;
+		delay = std::min(delay, _config.retry_max_delay);
+
+		std::lock_guard<std::mutex> lock(_mutex_jitter_generator);
+		std::uniform_int_distribution<long long> jitter(delay.count() / 2, delay.count());
+		return std::chrono::milliseconds(jitter(_jitter_generator));
 	}
 
-	std::string UberBack::_convert_data_batch_to_json(const collector::DataBatches& data_batches) const
+	/*
+	** Call the callback after the delay of the clock in the io context
+	** The timer is kept to be cancelled when UberBack is destroyed, the cancel callback is called instead
+	*/
+	void UberBack::_schedule(std::chrono::milliseconds delay, std::function<void()> callback,
+		std::function<void()> cancel_callback)
 	{
-		std::stringstream body;
-		body << "{";
-		body << "\"userId\": \"" << _config.userId << "\",";
-		body << "\"service\": \"" << _config.service << "\",";
-		body << "\"dataBatches\": [";
-		bool first_batch = true;
-		// convert batches
-		for (auto& data_batch : data_batches) {
-			if (first_batch)
-				first_batch = false;
-			else
-				body << ",";
-			body << "{";
-			body << "\"urlSrc\": \"" << data_batch.first << "\"";
-			// convert texts
-			_convert_texts_to_json(data_batch.second.texts, body);
-			// convert images
-			_convert_images_to_json(data_batch.second.images, body);
-			body << "}";
+		auto timer = std::make_shared<boost::asio::steady_timer>(_io_context);
+		{
+			std::lock_guard<std::mutex> lock(_mutex_timers);
+			_timers.insert(timer);
 		}
-		body << "]";
-		body << "}";
-		return std::move(body.str());
+		_wait_timer(std::move(timer), timing::Clock::get_default().now() + delay, std::move(callback),
+			std::move(cancel_callback));
+	}
+
+	/*
+	** The packet time doesn't go by at the pace of the steady timer: the timer polls the clock until the deadline
+	** A timer armed while UberBack is stopping, after the timers are cancelled, expires right away
+	*/
+	void UberBack::_wait_timer(std::shared_ptr<boost::asio::steady_timer> timer, timing::Clock::TimePoint deadline,
+		std::function<void()> callback, std::function<void()> cancel_callback)
+	{
+		auto& pipeline_clock = timing::Clock::get_default();
+		auto delay = std::max(deadline - pipeline_clock.now(), timing::Clock::Duration::zero());
+		if (pipeline_clock.is_packet_time())
+			delay = std::min<timing::Clock::Duration>(delay, FLUSH_POLL_INTERVAL);
+		if (_is_stopping)
+			delay = timing::Clock::Duration::zero();
+		timer->expires_after(delay);
+		timer->async_wait([this, timer, deadline, callback = std::move(callback),
+			cancel_callback = std::move(cancel_callback)](boost::system::error_code ec) mutable {
+			if (!ec && !_is_stopping && timing::Clock::get_default().now() < deadline) {
+				_wait_timer(std::move(timer), deadline, std::move(callback), std::move(cancel_callback));
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> lock(_mutex_timers);
+				_timers.erase(timer);
+			}
+			if (!ec && !_is_stopping)
+				callback();
+			else if (cancel_callback)
+				cancel_callback();
+		});
 	}
 }
@@ -0,0 +1,58 @@
+#include "api/UploadQueue.hpp"
+
+namespace ubersniff::api {
+	UploadQueue::UploadQueue(size_t max_size) noexcept :
+		_max_size(max_size),
+		_size(0)
+	{}
+
+	std::deque<std::shared_ptr<Upload>> UploadQueue::push(std::shared_ptr<Upload> upload, bool front)
+	{
+		std::deque<std::shared_ptr<Upload>> dropped;
+		std::lock_guard<std::mutex> lock(_mutex_uploads);
+
+		// the upload alone doesn't fit in the queue
+		if (upload->body.size() > _max_size) {
+			dropped.push_back(std::move(upload));
+			return dropped;
+		}
+
+		// drop the oldest uploads until there is enough room
+		while (!_uploads.empty() && _size + upload->body.size() > _max_size) {
+			_size -= _uploads.front()->body.size();
+			dropped.push_back(std::move(_uploads.front()));
+			_uploads.pop_front();
+		}
+
+		_size += upload->body.size();
+		if (front)
+			_uploads.push_front(std::move(upload));
+		else
+			_uploads.push_back(std::move(upload));
+		return dropped;
+	}
+
+	bool UploadQueue::pop(std::shared_ptr<Upload>& upload) noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex_uploads);
+
+		if (_uploads.empty())
+			return false;
+		upload = std::move(_uploads.front());
+		_uploads.pop_front();
+		_size -= upload->body.size();
+		return true;
+	}
+
+	size_t UploadQueue::depth() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex_uploads);
+		return _uploads.size();
+	}
+
+	size_t UploadQueue::size() const noexcept
+	{
+		std::lock_guard<std::mutex> lock(_mutex_uploads);
+		return _size;
+	}
+}
@@ -0,0 +1,99 @@
+#include <cstring>
+#include "api/encoder/CborEncoder.hpp"
+
+namespace ubersniff::api::encoder {
+	CborEncoder::CborEncoder(const std::string& user_id, const std::string& service) :
+		_user_id(user_id),
+		_service(service)
+	{}
+
+	void CborEncoder::encode(const collector::DataBatches& data_batches, Upload& upload)
+	{
+		auto& body = upload.body;
+		upload.content_type = "application/cbor";
+
+		body.clear();
+		_write_head(MajorType::MAP, 3, body);
+		_write_string("userId", body);
+		_write_string(_user_id, body);
+		_write_string("service", body);
+		_write_string(_service, body);
+		_write_string("dataBatches", body);
+		_write_head(MajorType::ARRAY, data_batches.size(), body);
+		for (auto& data_batch : data_batches) {
+			// the empty lists are omitted like in JSON
+			_write_head(MajorType::MAP,
+				1 + !data_batch.second.texts.empty() + !data_batch.second.images.empty(), body);
+			_write_string("urlSrc", body);
+			_write_string(data_batch.first, body);
+			_convert_counts_to_cbor("texts", data_batch.second.texts, body);
+			_convert_counts_to_cbor("images", data_batch.second.images, body);
+		}
+	}
+
+	void CborEncoder::_convert_counts_to_cbor(const char* name, const std::unordered_map<std::string, int>& counts, std::string& body) const
+	{
+		if (counts.empty())
+			return;
+		_write_string(name, body);
+		_write_head(MajorType::ARRAY, counts.size(), body);
+		for (auto& count : counts) {
+			_write_head(MajorType::ARRAY, 2, body);
+			_write_string(count.first, body);
+			_write_integer(count.second, body);
+		}
+	}
+
+	/*
+	** Write the head of a data item: the major type in the 3 high bits,
+	** followed by the value on the smallest number of bytes (big endian)
+	*/
+	void CborEncoder::_write_head(MajorType type, uint64_t value, std::string& body)
+	{
+		auto major_type = static_cast<uint8_t>(static_cast<uint8_t>(type) << 5);
+		size_t nb_bytes;
+
+		if (value < 24) {
+			body += static_cast<char>(major_type | value);
+			return;
+		} else if (value <= 0xff) {
+			body += static_cast<char>(major_type | 24);
+			nb_bytes = 1;
+		} else if (value <= 0xffff) {
+			body += static_cast<char>(major_type | 25);
+			nb_bytes = 2;
+		} else if (value <= 0xffffffff) {
+			body += static_cast<char>(major_type | 26);
+			nb_bytes = 4;
+		} else {
+			body += static_cast<char>(major_type | 27);
+			nb_bytes = 8;
+		}
+		while (nb_bytes--)
+			body += static_cast<char>((value >> (nb_bytes * 8)) & 0xff);
+	}
+
+	void CborEncoder::_write_string(const char* str, size_t size, std::string& body)
+	{
+		_write_head(MajorType::TEXT_STRING, size, body);
+		body.append(str, size);
+	}
+
+	void CborEncoder::_write_string(const char* str, std::string& body)
+	{
+		_write_string(str, std::strlen(str), body);
+	}
+
+	void CborEncoder::_write_string(const std::string& str, std::string& body)
+	{
+		_write_string(str.data(), str.size(), body);
+	}
+
+	void CborEncoder::_write_integer(long long value, std::string& body)
+	{
+		if (value >= 0)
+			_write_head(MajorType::UNSIGNED_INTEGER, static_cast<uint64_t>(value), body);
+		else
+			_write_head(MajorType::NEGATIVE_INTEGER, static_cast<uint64_t>(-1 - value), body);
+	}
+}
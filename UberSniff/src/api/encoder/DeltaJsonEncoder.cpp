@@ -0,0 +1,142 @@
+#include <algorithm>
+#include "api/encoder/DeltaJsonEncoder.hpp"
+#include "api/encoder/JsonEncoder.hpp"
+
+namespace ubersniff::api::encoder {
+	DeltaJsonEncoder::DeltaJsonEncoder(const std::string& user_id, const std::string& service, size_t dictionary_size) :
+		_user_id(user_id),
+		_service(service),
+		_dictionary(dictionary_size)
+	{}
+
+	void DeltaJsonEncoder::encode(const collector::DataBatches& data_batches, Upload& upload)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_encoding);
+		std::vector<uint32_t> definitions;
+		std::string payload;
+
+		// reserve room for all the strings of the upload
+		size_t nb_strings = 0;
+		for (auto& data_batch : data_batches)
+			nb_strings += 1 + data_batch.second.texts.size() + data_batch.second.images.size();
+
+		upload.content_type = "application/vnd.ubersniff.delta+json";
+		upload.dictionary_epoch = _dictionary.prepare(nb_strings);
+		upload.dictionary_ids.clear();
+
+		payload += ",\"dataBatches\":[";
+		bool first_batch = true;
+		for (auto& data_batch : data_batches) {
+			if (first_batch)
+				first_batch = false;
+			else
+				payload += ",";
+			payload += "{\"urlSrc\":";
+			JsonEncoder::write_integer(_intern_string(data_batch.first, definitions, upload), payload);
+			_convert_counts_to_delta_json("texts", data_batch.second.texts, payload, definitions, upload);
+			_convert_counts_to_delta_json("images", data_batch.second.images, payload, definitions, upload);
+			payload += "}";
+		}
+		payload += "]}";
+
+		// a string used several times is defined once
+		for (auto ids : { &definitions, &upload.dictionary_ids }) {
+			std::sort(ids->begin(), ids->end());
+			ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+		}
+		upload.body = _get_header(upload.dictionary_epoch, definitions);
+		upload.payload_offset = upload.body.size();
+		upload.body += payload;
+	}
+
+	void DeltaJsonEncoder::_convert_counts_to_delta_json(const char* name, const std::unordered_map<std::string, int>& counts,
+		std::string& body, std::vector<uint32_t>& definitions, Upload& upload)
+	{
+		if (counts.empty())
+			return;
+		bool first_count = true;
+		body += ",\"";
+		body += name;
+		body += "\":[";
+		for (auto& count : counts) {
+			if (first_count)
+				first_count = false;
+			else
+				body += ",";
+			body += "[";
+			JsonEncoder::write_integer(_intern_string(count.first, definitions, upload), body);
+			body += ",";
+			JsonEncoder::write_integer(count.second, body);
+			body += "]";
+		}
+		body += "]";
+	}
+
+	uint32_t DeltaJsonEncoder::_intern_string(const std::string& str, std::vector<uint32_t>& definitions, Upload& upload)
+	{
+		bool is_defined;
+		auto id = _dictionary.intern(str, is_defined);
+		if (!is_defined)
+			definitions.push_back(id);
+		upload.dictionary_ids.push_back(id);
+		return id;
+	}
+
+	std::string DeltaJsonEncoder::_get_header(uint64_t epoch, const std::vector<uint32_t>& definitions) const
+	{
+		std::string header;
+		header += "{\"userId\":";
+		JsonEncoder::write_string(_user_id, header);
+		header += ",\"service\":";
+		JsonEncoder::write_string(_service, header);
+		header += ",\"dictionary\":{\"epoch\":";
+		header += std::to_string(epoch);
+		header += ",\"strings\":[";
+		std::string str;
+		bool first_definition = true;
+		for (auto id : definitions) {
+			if (!_dictionary.get(epoch, id, str))
+				continue;
+			if (first_definition)
+				first_definition = false;
+			else
+				header += ",";
+			header += "[";
+			JsonEncoder::write_integer(id, header);
+			header += ",";
+			JsonEncoder::write_string(str, header);
+			header += "]";
+		}
+		header += "]}";
+		return header;
+	}
+
+	/*
+	** Returns false if the dictionary of the upload doesn't exist anymore
+	*/
+	bool DeltaJsonEncoder::make_self_contained(Upload& upload)
+	{
+		if (upload.dictionary_ids.empty())
+			return true;
+
+		std::string str;
+		for (auto id : upload.dictionary_ids) {
+			if (!_dictionary.get(upload.dictionary_epoch, id, str))
+				return false;
+		}
+		auto header = _get_header(upload.dictionary_epoch, upload.dictionary_ids);
+		upload.body = header + upload.body.substr(upload.payload_offset);
+		upload.payload_offset = header.size();
+		return true;
+	}
+
+	void DeltaJsonEncoder::on_upload_accepted(const Upload& upload)
+	{
+		_dictionary.acknowledge(upload.dictionary_epoch, upload.dictionary_ids);
+	}
+
+	void DeltaJsonEncoder::on_state_lost(const Upload& upload)
+	{
+		_dictionary.forget_acknowledgements(upload.dictionary_epoch);
+	}
+}
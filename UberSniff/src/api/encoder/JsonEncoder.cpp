@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <charconv>
+#include <vector>
+#include "api/encoder/JsonEncoder.hpp"
+
+namespace ubersniff::api::encoder {
+	/*
+	** Call the function with each entry of the map, in the order of the keys when sorted
+	*/
+	template <typename Map, typename Function>
+	static void for_each_entry(const Map& map, bool is_sorted, Function function)
+	{
+		if (!is_sorted) {
+			for (auto& entry : map)
+				function(entry);
+			return;
+		}
+		std::vector<const typename Map::value_type*> entries;
+		entries.reserve(map.size());
+		for (auto& entry : map)
+			entries.push_back(&entry);
+		std::sort(entries.begin(), entries.end(), [](const auto* left, const auto* right) { return left->first < right->first; });
+		for (auto* entry : entries)
+			function(*entry);
+	}
+
+	JsonEncoder::JsonEncoder(const std::string& user_id, const std::string& service, bool is_sorted) :
+		_user_id(user_id),
+		_service(service),
+		_is_sorted(is_sorted)
+	{}
+
+	void JsonEncoder::encode(const collector::DataBatches& data_batches, Upload& upload)
+	{
+		auto& body = upload.body;
+		upload.content_type = "application/json";
+
+		body.clear();
+		body += "{";
+		body += "\"userId\": ";
+		write_string(_user_id, body);
+		body += ",\"service\": ";
+		write_string(_service, body);
+		body += ",\"dataBatches\": [";
+		bool first_batch = true;
+		// convert batches
+		for_each_entry(data_batches, _is_sorted, [&](const collector::DataBatches::value_type& data_batch) {
+			if (first_batch)
+				first_batch = false;
+			else
+				body += ",";
+			body += "{";
+			body += "\"urlSrc\": ";
+			write_string(data_batch.first, body);
+			// convert texts
+			_convert_counts_to_json("texts", data_batch.second.texts, body);
+			// convert images
+			_convert_counts_to_json("images", data_batch.second.images, body);
+			body += "}";
+		});
+		body += "]";
+		body += "}";
+	}
+
+	void JsonEncoder::_convert_counts_to_json(const char* name, const std::unordered_map<std::string, int>& counts, std::string& body) const
+	{
+		if (counts.empty())
+			return;
+		bool first_count = true;
+		body += ",\"";
+		body += name;
+		body += "\":[";
+		for_each_entry(counts, _is_sorted, [&](const std::pair<const std::string, int>& count) {
+			if (first_count)
+				first_count = false;
+			else
+				body += ",";
+			body += "{";
+			body += "\"content\":";
+			write_string(count.first, body);
+			body += ",\"nb\":";
+			write_integer(count.second, body);
+			body += "}";
+		});
+		body += "]";
+	}
+
+	void JsonEncoder::write_string(const std::string& str, std::string& body)
+	{
+		static const char hex_digits[] = "0123456789abcdef";
+
+		body += '"';
+		// copy the runs of characters that don't need to be escaped at once
+		size_t run_start = 0;
+		for (size_t i = 0; i < str.size(); ++i) {
+			auto c = static_cast<unsigned char>(str[i]);
+			if (c >= 0x20 && c != '"' && c != '\\')
+				continue;
+			body.append(str, run_start, i - run_start);
+			run_start = i + 1;
+			switch (c) {
+			case '"': body += "\\\""; break;
+			case '\\': body += "\\\\"; break;
+			case '\n': body += "\\n"; break;
+			case '\r': body += "\\r"; break;
+			case '\t': body += "\\t"; break;
+			default:
+				body += "\\u00";
+				body += hex_digits[c >> 4];
+				body += hex_digits[c & 0xf];
+			}
+		}
+		body.append(str, run_start, std::string::npos);
+		body += '"';
+	}
+
+	void JsonEncoder::write_integer(long long value, std::string& body)
+	{
+		char buffer[24];
+		auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+		body.append(buffer, result.ptr);
+	}
+}
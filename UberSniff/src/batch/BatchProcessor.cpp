@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include "batch/BatchProcessor.hpp"
+#include "collector/DataCollector.hpp"
+
+namespace ubersniff::batch {
+	BatchProcessor::BatchProcessor(const sniffer::http::Sniffer::Config& sniffer_config,
+		const collector::DataCollector::Config& collector_config, size_t parallelism) :
+		_sniffer_config(sniffer_config),
+		_collector_config(collector_config),
+		_parallelism(parallelism ? parallelism : std::max<size_t>(std::thread::hardware_concurrency(), 1)),
+		_metrics({
+			metrics::Registry::get_default().counter("ubersniff_batch_files_total{result=\"processed\"}",
+				"Capture files processed in batch mode"),
+			metrics::Registry::get_default().counter("ubersniff_batch_files_total{result=\"failed\"}",
+				"Capture files processed in batch mode")
+		})
+	{
+		// the files are processed in parallel instead of the streams of a file,
+		//  the memory budget of the reassembly is shared by the files in progress
+		_sniffer_config.reassembly_threads = 1;
+		_sniffer_config.reassembly.max_buffered_size = std::max(_sniffer_config.reassembly.max_buffered_size / _parallelism,
+			_sniffer_config.reassembly.max_flow_buffered_size);
+	}
+
+	std::vector<std::string> BatchProcessor::find_files(const std::string& pattern)
+	{
+		std::vector<std::string> filenames;
+		std::filesystem::path path(pattern);
+		auto directory = path;
+		std::string name_pattern = "*";
+		if (!std::filesystem::is_directory(path)) {
+			directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+			name_pattern = path.filename().string();
+		}
+
+		for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+			if (entry.is_regular_file()
+				&& sniffer::http::Sniffer::match_pattern(name_pattern, entry.path().filename().string()))
+				filenames.push_back(entry.path().string());
+		}
+		std::sort(filenames.begin(), filenames.end());
+		return filenames;
+	}
+
+	/*
+	** The workers take the next file until all the files are taken, the result of each file has its own place
+	*/
+	collector::DataBatches BatchProcessor::process(const std::vector<std::string>& filenames,
+		const CancellationCheck& is_cancelled)
+	{
+		std::vector<collector::DataBatches> files_data_batches(filenames.size());
+		std::atomic<size_t> next_index(0);
+
+		auto process_files = [&]() {
+			for (auto index = next_index++; index < filenames.size() && !is_cancelled(); index = next_index++) {
+				try {
+					files_data_batches[index] = _process_file(filenames[index], is_cancelled);
+					_metrics.processed_files.inc();
+				} catch (std::exception& e) {
+					std::cout << filenames[index] << ": " << e.what() << std::endl;
+					_metrics.failed_files.inc();
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < std::min(_parallelism, filenames.size()); ++i)
+			workers.emplace_back(process_files);
+		for (auto& worker : workers)
+			worker.join();
+
+		collector::DataBatches data_batches;
+		for (auto& file_data_batches : files_data_batches)
+			merge(data_batches, std::move(file_data_batches));
+		return data_batches;
+	}
+
+	/*
+	** Replay the file like the replay mode: the file is read and reassembled, then the collector is drained
+	*/
+	collector::DataBatches BatchProcessor::_process_file(const std::string& filename, const CancellationCheck& is_cancelled)
+	{
+		collector::DataCollector data_collector(_collector_config);
+		sniffer::http::Sniffer http_sniffer(filename, data_collector, _sniffer_config, sniffer::http::Sniffer::Source::FILE);
+
+		http_sniffer.start_sniffing();
+		while (!is_cancelled()) {
+			bool is_replay_finished = !http_sniffer.is_sniffing();
+			if (!data_collector.process_next_exchanges()) {
+				if (is_replay_finished)
+					break;
+				std::this_thread::sleep_for(POLL_INTERVAL);
+			}
+		}
+		if (is_cancelled()) {
+			http_sniffer.stop_sniffing();
+			return data_collector.extract_data_batches();
+		}
+
+		// the streams still open at the end of the file complete their exchanges
+		http_sniffer.stop_sniffing(std::chrono::steady_clock::time_point::max());
+		while (data_collector.process_next_exchanges());
+		return data_collector.extract_data_batches();
+	}
+
+	void BatchProcessor::merge(collector::DataBatches& merged_data_batches, collector::DataBatches&& data_batches)
+	{
+		for (auto& data_batch : data_batches) {
+			auto& merged_data_batch = merged_data_batches[data_batch.first];
+			for (auto& text : data_batch.second.texts)
+				merged_data_batch.texts[text.first] += text.second;
+			for (auto& image : data_batch.second.images)
+				merged_data_batch.images[image.first] += image.second;
+			std::move(data_batch.second.traces.begin(), data_batch.second.traces.end(),
+				std::back_inserter(merged_data_batch.traces));
+		}
+	}
+}
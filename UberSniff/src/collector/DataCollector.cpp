@@ -1,12 +1,48 @@
+#include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <regex>
 #include "collector/DataCollector.hpp"
 
 namespace ubersniff::collector {
+	DataCollector::DataCollector() :
+		DataCollector(DataCollector::Config())
+	{}
+
+	DataCollector::DataCollector(const DataCollector::Config& config) :
+		_metrics({
+			metrics::Registry::get_default().gauge("ubersniff_collector_queue_depth{type=\"text\"}",
+				"Exchanges waiting to be processed by the collector"),
+			metrics::Registry::get_default().gauge("ubersniff_collector_queue_depth{type=\"image\"}",
+				"Exchanges waiting to be processed by the collector"),
+			metrics::Registry::get_default().histogram("ubersniff_collector_processing_nanoseconds{type=\"text\"}",
+				"Processing time of an exchange by the collector"),
+			metrics::Registry::get_default().histogram("ubersniff_collector_processing_nanoseconds{type=\"image\"}",
+				"Processing time of an exchange by the collector"),
+			metrics::Registry::get_default().counter("ubersniff_collector_skipped_exchanges_total{type=\"text\"}",
+				"Exchanges dropped without extraction to save CPU time")
+		}),
+		_queue_depth(0),
+		_extraction_ratio(1),
+		_text_exchanges_count(0),
+		_batch_window(timing::Clock::Duration::zero()),
+		_extraction_cache(config.extraction_cache_size)
+	{}
+
+	DataCollector::~DataCollector()
+	{
+		// the exchanges left are removed from the gauges
+		_metrics.text_queue_depth.dec(_text_exchanges_queue.size());
+		_metrics.image_queue_depth.dec(_image_exchanges_queue.size());
+	}
+
 	void DataCollector::_push_image_exchange(packet::Exchange exchange)
 	{
 		std::lock_guard<std::mutex> lock(_mutex_image_exchanges_queue);
+		trace::mark(exchange.request.trace, trace::QUEUED);
 		_image_exchanges_queue.push(std::move(exchange));
+		++_queue_depth;
+		_metrics.image_queue_depth.inc();
 	}
 
 	bool DataCollector::_pop_image_exchange(packet::Exchange& exchange) noexcept
@@ -17,13 +53,18 @@ namespace ubersniff::collector {
 			return false;
 		exchange = _image_exchanges_queue.front();
 		_image_exchanges_queue.pop();
+		--_queue_depth;
+		_metrics.image_queue_depth.dec();
 		return true;
 	}
 
 	void DataCollector::_push_text_exchange(packet::Exchange exchange)
 	{
 		std::lock_guard<std::mutex> lock(_mutex_text_exchanges_queue);
+		trace::mark(exchange.request.trace, trace::QUEUED);
 		_text_exchanges_queue.push(std::move(exchange));
+		++_queue_depth;
+		_metrics.text_queue_depth.inc();
 	}
 
 	bool DataCollector::_pop_text_exchange(packet::Exchange& exchange) noexcept
@@ -34,6 +75,8 @@ namespace ubersniff::collector {
 			return false;
 		exchange = _text_exchanges_queue.front();
 		_text_exchanges_queue.pop();
+		--_queue_depth;
+		_metrics.text_queue_depth.dec();
 		return true;
 	}
 
@@ -43,6 +86,7 @@ namespace ubersniff::collector {
 		if (!_pop_image_exchange(exchange))
 			// no exchange to process
 			return false;
+		auto started_at = std::chrono::steady_clock::now();
 
 		std::string referer;
 		// get referer
@@ -58,17 +102,24 @@ namespace ubersniff::collector {
 		auto& uri = exchange.request.uri;
 
 		std::lock_guard<std::mutex> lock(_mutex_data_batches);
+		auto& data_batches = _get_data_batches(exchange);
 		// create the batch if it not exist for the uri
-		if (!_data_batches.count(referer)) {
-			_data_batches[referer] = {};
+		if (!data_batches.count(referer)) {
+			data_batches[referer] = {};
 		}
 
 		// add data in the batches
-		if (!_data_batches[referer].images.count(uri)) {
-			_data_batches[referer].images[uri] = 1;
+		if (!data_batches[referer].images.count(uri)) {
+			data_batches[referer].images[uri] = 1;
 		} else {
-			++_data_batches[referer].images[uri];
+			++data_batches[referer].images[uri];
+		}
+		if (exchange.request.trace) {
+			exchange.request.trace->mark(trace::PROCESSED);
+			data_batches[referer].traces.push_back(std::move(exchange.request.trace));
 		}
+		_metrics.image_latency.observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - started_at).count());
 		return true;
 	}
 
@@ -117,34 +168,68 @@ namespace ubersniff::collector {
 		if (!_pop_text_exchange(exchange))
 			// no exchange to process
 			return false;
+		// the exchange is dropped before the costly cleaning of the html
+		if (++_text_exchanges_count % _extraction_ratio.load(std::memory_order_relaxed)) {
+			_metrics.skipped_text_exchanges.inc();
+			return true;
+		}
+		auto started_at = std::chrono::steady_clock::now();
 
 		auto& uri = exchange.request.host;
 		auto& content = exchange.response.content;
 
-		// clean the html content
-		_remove_html_tag(content);
-		_remove_multiple_space(content);
-		auto content_list = _get_list_of_content(content);
-
-		// quit if no content
-		if (!content_list.size()) {
-			return true;
+		// the lines of a page reloaded unchanged are taken from the cache
+		bool is_cached = _extraction_cache.is_enabled();
+		const ExtractionCache::Lines* content_lines = nullptr;
+		ExtractionCache::Lines extracted_lines;
+		if (exchange.response.status_code == "304") {
+			// not modified: the page is the last one extracted for the URI
+			if (is_cached)
+				content_lines = _extraction_cache.find_by_uri(uri + exchange.request.path);
+		} else {
+			// an empty body (header only) would hide the page of the URI from the 304
+			is_cached = is_cached && !content.empty();
+			auto hash = is_cached ? ExtractionCache::get_hash(uri, exchange.request.path, content) : 0;
+			if (is_cached)
+				content_lines = _extraction_cache.find(hash);
+			if (!content_lines) {
+				// clean the html content
+				_remove_html_tag(content);
+				_remove_multiple_space(content);
+				auto content_list = _get_list_of_content(content);
+				extracted_lines.assign(std::make_move_iterator(content_list.begin()),
+					std::make_move_iterator(content_list.end()));
+				content_lines = is_cached
+					? &_extraction_cache.insert(hash, uri + exchange.request.path, std::move(extracted_lines),
+						std::chrono::steady_clock::now() - started_at)
+					: &extracted_lines;
+			}
 		}
 
-		std::lock_guard<std::mutex> lock(_mutex_data_batches);
-		// create the batch if it not exist for the uri
-		if (!_data_batches.count(uri)) {
-			_data_batches[uri] = {};
-		}
+		trace::mark(exchange.request.trace, trace::PROCESSED);
 
-		// add data in the batches
-		for (auto& it : content_list) {
-			if (!_data_batches[uri].texts.count(it)) {
-				_data_batches[uri].texts[it] = 1;
-			} else {
-				++_data_batches[uri].texts[it];
+		// add the content in the batches
+		if (content_lines && content_lines->size()) {
+			std::lock_guard<std::mutex> lock(_mutex_data_batches);
+			auto& data_batches = _get_data_batches(exchange);
+			// create the batch if it not exist for the uri
+			if (!data_batches.count(uri)) {
+				data_batches[uri] = {};
 			}
+
+			// add data in the batches
+			for (auto& it : *content_lines) {
+				if (!data_batches[uri].texts.count(it)) {
+					data_batches[uri].texts[it] = 1;
+				} else {
+					++data_batches[uri].texts[it];
+				}
+			}
+			if (exchange.request.trace)
+				data_batches[uri].traces.push_back(std::move(exchange.request.trace));
 		}
+		_metrics.text_latency.observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - started_at).count());
 		return true;
 	}
 
@@ -199,9 +284,57 @@ namespace ubersniff::collector {
 		std::cout << std::endl;
 	}
 
+	void DataCollector::set_extraction_ratio(size_t extraction_ratio) noexcept
+	{
+		_extraction_ratio.store(std::max<size_t>(extraction_ratio, 1), std::memory_order_relaxed);
+	}
+
+	size_t DataCollector::get_queue_depth() const noexcept
+	{
+		// without waiting for the queues, the gauges are shared by the collectors of a batch
+		return _queue_depth.load(std::memory_order_relaxed);
+	}
+
+	void DataCollector::set_batch_window(timing::Clock::Duration batch_window) noexcept
+	{
+		_batch_window = batch_window;
+	}
+
+	/*
+	** The data batches of the window of the exchange, or the data batches collected without window
+	*/
+	DataBatches& DataCollector::_get_data_batches(const packet::Exchange& exchange)
+	{
+		if (_batch_window <= timing::Clock::Duration::zero())
+			return _data_batches;
+		auto window_start = exchange.timestamp - exchange.timestamp.time_since_epoch() % _batch_window;
+		return _windows[window_start];
+	}
+
+	static void mark_batched(DataBatches& data_batches)
+	{
+		for (auto& data_batch : data_batches) {
+			for (auto& record : data_batch.second.traces)
+				record->mark(trace::BATCHED);
+		}
+	}
+
+	bool DataCollector::extract_ended_window(timing::Clock::TimePoint now, DataBatches& data_batches)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_data_batches);
+		if (_windows.empty() || now < _windows.begin()->first + _batch_window)
+			return false;
+		data_batches = std::move(_windows.begin()->second);
+		_windows.erase(_windows.begin());
+		mark_batched(data_batches);
+		return true;
+	}
+
 	DataBatches DataCollector::extract_data_batches()
 	{
 		std::lock_guard<std::mutex> lock(_mutex_data_batches);
+		// mark the sampled exchanges
+		mark_batched(_data_batches);
 		// copy dataBatches
 		DataBatches data_batches = _data_batches;
 		// clear dataBatches
@@ -0,0 +1,132 @@
+#include <cstring>
+#include <iterator>
+#include "collector/ExtractionCache.hpp"
+
+namespace ubersniff::collector {
+	ExtractionCache::ExtractionCache(size_t max_size) :
+		_max_size(max_size),
+		_metrics({
+			metrics::Registry::get_default().counter("ubersniff_collector_cache_lookups_total{result=\"hit\"}",
+				"Text pages looked up in the extraction cache"),
+			metrics::Registry::get_default().counter("ubersniff_collector_cache_lookups_total{result=\"miss\"}",
+				"Text pages looked up in the extraction cache"),
+			metrics::Registry::get_default().counter("ubersniff_collector_cache_saved_nanoseconds_total",
+				"Extraction time saved by the hits of the extraction cache"),
+			metrics::Registry::get_default().gauge("ubersniff_collector_cache_hit_ratio_permille",
+				"Hits of the extraction cache, in thousandths of the lookups")
+		})
+	{
+		_entries_by_hash.reserve(max_size);
+		_entries_by_uri.reserve(max_size);
+	}
+
+	/*
+	** Final mix of murmur3, every bit of the input changes half of the bits of the output
+	*/
+	static uint64_t mix(uint64_t value) noexcept
+	{
+		value ^= value >> 33;
+		value *= 0xff51afd7ed558ccdull;
+		value ^= value >> 33;
+		value *= 0xc4ceb9fe1a85ec53ull;
+		value ^= value >> 33;
+		return value;
+	}
+
+	/*
+	** The words are mixed independently of the hash, the chain from a word to the next is a xor and a multiply
+	** The size is mixed first, so the host, the path and the body can't shift into each other
+	*/
+	static uint64_t hash_bytes(const std::string& str, uint64_t hash) noexcept
+	{
+		constexpr uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+		auto* data = reinterpret_cast<const uint8_t*>(str.data());
+		auto size = str.size();
+
+		hash = (hash ^ mix(size)) * multiplier;
+		for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+			uint64_t word;
+			std::memcpy(&word, data, sizeof(word));
+			hash = (hash ^ mix(word)) * multiplier;
+		}
+		if (size) {
+			uint64_t word = 0;
+			std::memcpy(&word, data, size);
+			hash = (hash ^ mix(word)) * multiplier;
+		}
+		return hash;
+	}
+
+	uint64_t ExtractionCache::get_hash(const std::string& host, const std::string& path, const std::string& body) noexcept
+	{
+		return mix(hash_bytes(body, hash_bytes(path, hash_bytes(host, 0))));
+	}
+
+	const ExtractionCache::Lines* ExtractionCache::find(uint64_t hash) noexcept
+	{
+		auto entry = _entries_by_hash.find(hash);
+		if (entry == _entries_by_hash.end()) {
+			_miss();
+			return nullptr;
+		}
+		return _hit(entry->second);
+	}
+
+	const ExtractionCache::Lines* ExtractionCache::find_by_uri(const std::string& uri) noexcept
+	{
+		auto entry = _entries_by_uri.find(uri);
+		if (entry == _entries_by_uri.end()) {
+			_miss();
+			return nullptr;
+		}
+		return _hit(entry->second);
+	}
+
+	const ExtractionCache::Lines* ExtractionCache::_hit(std::list<Entry>::iterator entry) noexcept
+	{
+		// most recently used
+		_entries.splice(_entries.begin(), _entries, entry);
+		_metrics.hits.inc();
+		_metrics.saved_time.inc(entry->extraction_time.count());
+		_update_hit_ratio();
+		return &entry->lines;
+	}
+
+	void ExtractionCache::_miss() noexcept
+	{
+		_metrics.misses.inc();
+		_update_hit_ratio();
+	}
+
+	void ExtractionCache::_update_hit_ratio() noexcept
+	{
+		auto hits = _metrics.hits.value();
+		auto lookups = hits + _metrics.misses.value();
+		_metrics.hit_ratio.set(static_cast<int64_t>(hits * 1000 / lookups));
+	}
+
+	/*
+	** The URI points to its last page, an older page of the URI is still found by its hash
+	*/
+	const ExtractionCache::Lines& ExtractionCache::insert(uint64_t hash, const std::string& uri, Lines lines,
+		std::chrono::nanoseconds extraction_time)
+	{
+		auto entry = _entries_by_hash.find(hash);
+		if (entry != _entries_by_hash.end()) {
+			_entries.splice(_entries.begin(), _entries, entry->second);
+			return entry->second->lines;
+		}
+		if (_entries.size() >= _max_size) {
+			auto& oldest_entry = _entries.back();
+			_entries_by_hash.erase(oldest_entry.hash);
+			auto uri_entry = _entries_by_uri.find(oldest_entry.uri);
+			if (uri_entry != _entries_by_uri.end() && uri_entry->second == std::prev(_entries.end()))
+				_entries_by_uri.erase(uri_entry);
+			_entries.pop_back();
+		}
+		_entries.push_front({ hash, uri, std::move(lines), extraction_time });
+		_entries_by_hash[hash] = _entries.begin();
+		_entries_by_uri[uri] = _entries.begin();
+		return _entries.front().lines;
+	}
+}
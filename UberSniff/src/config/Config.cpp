@@ -1,3 +1,4 @@
+#include <limits>
 #include <stdexcept>
 #include "config/Config.hpp"
 
@@ -37,10 +38,338 @@ namespace ubersniff::config {
             throw std::invalid_argument("Invalid Uberback config: No Token provided");
         if (_uberback_config.userId.empty())
             throw std::invalid_argument("Invalid Uberback config: No UserId provided");
+
+        // get the threads layout (optional)
+        _parse_threads_config(uberback_config.child("Threads"));
+        // get the upload policy (optional)
+        _parse_upload_config(uberback_config.child("Upload"));
+        // get the disk spool (optional)
+        _parse_spool_config(uberback_config.child("Spool"));
+
+        // get the capture settings (optional)
+        _parse_sniffer_config(config.child("Sniffer"));
+        // get the extraction of the exchanges (optional)
+        _parse_collector_config(config.child("Collector"));
+        // get the metrics endpoint (optional)
+        _parse_metrics_config(config.child("Metrics"));
+        // get the exchanges tracing (optional)
+        _parse_trace_config(config.child("Trace"));
+        // get the recorder of the last frames captured (optional)
+        _parse_flight_recorder_config(config.child("FlightRecorder"));
+        // get the CPU budget (optional)
+        _parse_cpu_governor_config(config.child("CpuBudget"));
+        // get the split of the capture in a privileged process (optional)
+        _parse_privilege_separation_config(config.child("PrivilegeSeparation"));
+
+        // get the time given to the shutdown to drain the pipeline (optional)
+        _drain_timeout = std::chrono::milliseconds(config.child("Shutdown").child("DrainTimeout")
+            .text().as_ullong(_drain_timeout.count()));
+        // get the batch windows of a replay (optional)
+        _replay_batch_window = std::chrono::milliseconds(config.child("Replay").child("BatchWindow")
+            .text().as_ullong(_replay_batch_window.count()));
+        if (_replay_batch_window.count() <= 0)
+            throw std::invalid_argument("Invalid Replay config: BatchWindow must be greater than 0");
+    }
+
+    void Config::_parse_threads_config(const pugi::xml_node& threads_config)
+    {
+        auto& uberback_config = _uberback_config;
+
+        uberback_config.network_threads = threads_config.child("Network")
+            .text().as_ullong(uberback_config.network_threads);
+        uberback_config.serialization_threads = threads_config.child("Serialization")
+            .text().as_ullong(uberback_config.serialization_threads);
+
+        // check the threads layout
+        if (!uberback_config.network_threads)
+            throw std::invalid_argument("Invalid Threads config: Network must be greater than 0");
+        if (!uberback_config.serialization_threads)
+            throw std::invalid_argument("Invalid Threads config: Serialization must be greater than 0");
+    }
+
+    void Config::_parse_upload_config(const pugi::xml_node& upload_config)
+    {
+        auto& uberback_config = _uberback_config;
+
+        uberback_config.max_queue_size = upload_config.child("MaxQueueSize")
+            .text().as_ullong(uberback_config.max_queue_size);
+        uberback_config.max_concurrent_uploads = upload_config.child("MaxConcurrentUploads")
+            .text().as_ullong(uberback_config.max_concurrent_uploads);
+        uberback_config.max_retries = upload_config.child("MaxRetries")
+            .text().as_ullong(uberback_config.max_retries);
+        uberback_config.retry_base_delay = std::chrono::milliseconds(upload_config.child("RetryBaseDelay")
+            .text().as_ullong(uberback_config.retry_base_delay.count()));
+        uberback_config.retry_max_delay = std::chrono::milliseconds(upload_config.child("RetryMaxDelay")
+            .text().as_ullong(uberback_config.retry_max_delay.count()));
+        uberback_config.circuit_breaker_threshold = upload_config.child("CircuitBreakerThreshold")
+            .text().as_ullong(uberback_config.circuit_breaker_threshold);
+        uberback_config.circuit_breaker_cooldown = std::chrono::milliseconds(upload_config.child("CircuitBreakerCooldown")
+            .text().as_ullong(uberback_config.circuit_breaker_cooldown.count()));
+
+        uberback_config.format = upload_config.child("Format").text().as_string(uberback_config.format.c_str());
+        uberback_config.dictionary_size = upload_config.child("DictionarySize")
+            .text().as_ullong(uberback_config.dictionary_size);
+
+        // check the upload policy
+        if (!uberback_config.max_queue_size)
+            throw std::invalid_argument("Invalid Upload config: MaxQueueSize must be greater than 0");
+        if (!uberback_config.max_concurrent_uploads)
+            throw std::invalid_argument("Invalid Upload config: MaxConcurrentUploads must be greater than 0");
+        if (uberback_config.retry_base_delay > uberback_config.retry_max_delay)
+            throw std::invalid_argument("Invalid Upload config: RetryBaseDelay is greater than RetryMaxDelay");
+        if (uberback_config.format != "json" && uberback_config.format != "delta" && uberback_config.format != "cbor")
+            throw std::invalid_argument("Invalid Upload config: Format must be json, delta or cbor");
+        if (!uberback_config.dictionary_size)
+            throw std::invalid_argument("Invalid Upload config: DictionarySize must be greater than 0");
+    }
+
+    void Config::_parse_spool_config(const pugi::xml_node& spool_config)
+    {
+        auto& config = _uberback_config.spool;
+
+        config.directory = spool_config.child_value("Directory");
+        config.segment_size = spool_config.child("SegmentSize").text().as_ullong(config.segment_size);
+        config.max_size = spool_config.child("MaxSize").text().as_ullong(config.max_size);
+        config.sync_interval = std::chrono::milliseconds(spool_config.child("SyncInterval")
+            .text().as_ullong(config.sync_interval.count()));
+
+        // check the spool config
+        if (config.directory.empty())
+            return; // spool disabled
+        if (config.segment_size > std::numeric_limits<uint32_t>::max())
+            throw std::invalid_argument("Invalid Spool config: SegmentSize must be lower than 4GB");
+        if (config.max_size < config.segment_size)
+            throw std::invalid_argument("Invalid Spool config: MaxSize is lower than SegmentSize");
+        if (config.sync_interval.count() <= 0)
+            throw std::invalid_argument("Invalid Spool config: SyncInterval must be greater than 0");
+    }
+
+    void Config::_parse_metrics_config(const pugi::xml_node& metrics_config)
+    {
+        _metrics_config.port = metrics_config.child_value("Port");
+        if (metrics_config.child("Address"))
+            _metrics_config.address = metrics_config.child_value("Address");
+
+        // check the metrics config
+        if (_metrics_config.port.empty())
+            return; // metrics endpoint disabled
+        if (_metrics_config.address.empty())
+            throw std::invalid_argument("Invalid Metrics config: No Address provided");
+    }
+
+    void Config::_parse_sniffer_config(const pugi::xml_node& sniffer_config)
+    {
+        auto& reassembly_config = _sniffer_config.reassembly;
+
+        // interfaces captured, the default interface when there is none
+        for (auto interface_config : sniffer_config.child("Interfaces").children("Interface")) {
+            std::string pattern = interface_config.text().as_string();
+            if (pattern.empty())
+                throw std::invalid_argument("Invalid Sniffer config: Interface is empty");
+            _sniffer_config.interfaces.push_back(std::move(pattern));
+        }
+        _sniffer_config.reassembly_threads = sniffer_config.child("ReassemblyThreads")
+            .text().as_ullong(_sniffer_config.reassembly_threads);
+        _sniffer_config.max_queued_packets = sniffer_config.child("MaxQueuedPackets")
+            .text().as_ullong(_sniffer_config.max_queued_packets);
+        if (!_sniffer_config.reassembly_threads)
+            throw std::invalid_argument("Invalid Sniffer config: ReassemblyThreads must be greater than 0");
+        if (!_sniffer_config.max_queued_packets)
+            throw std::invalid_argument("Invalid Sniffer config: MaxQueuedPackets must be greater than 0");
+
+        // reading of the packets by batch, the sizes of pcap in bytes
+        auto capture_config = sniffer_config.child("Capture");
+        auto& capture = _sniffer_config.capture;
+        capture.batch_size = capture_config.child("BatchSize").text().as_ullong(capture.batch_size);
+        capture.buffer_size = capture_config.child("BufferSize").text().as_uint(capture.buffer_size);
+        capture.snap_len = capture_config.child("SnapLength").text().as_uint(capture.snap_len);
+        if (!capture.batch_size || capture.batch_size > static_cast<size_t>(std::numeric_limits<int>::max()))
+            throw std::invalid_argument("Invalid Sniffer config: BatchSize is out of range");
+        if (!capture.snap_len)
+            throw std::invalid_argument("Invalid Sniffer config: SnapLength must be greater than 0");
+
+        // capture filter
+        auto filter_config = sniffer_config.child("Filter");
+        if (filter_config.child("Port"))
+            _sniffer_config.ports.clear();
+        for (auto port_config : filter_config.children("Port")) {
+            auto port = port_config.text().as_uint();
+            if (!port || port > 65535)
+                throw std::invalid_argument("Invalid Sniffer config: Port must be between 1 and 65535");
+            _sniffer_config.ports.push_back(static_cast<uint16_t>(port));
+        }
+        for (auto network_config : filter_config.children("DeniedNetwork"))
+            _sniffer_config.denied_networks.push_back(network_config.text().as_string());
+        _sniffer_config.deny_list_file = filter_config.child_value("DenyListFile");
+        // check the networks before the capture starts
+        ubersniff::sniffer::http::FilterBuilder(_sniffer_config.ports).set_denied_networks(_sniffer_config.denied_networks);
+
+        auto timeouts_config = sniffer_config.child("Timeouts");
+        auto parse_timeout = [&timeouts_config](const char* name, std::chrono::milliseconds& timeout) {
+            timeout = std::chrono::milliseconds(timeouts_config.child(name).text().as_ullong(timeout.count()));
+            if (timeout.count() <= 0)
+                throw std::invalid_argument(std::string("Invalid Sniffer config: ") + name + " must be greater than 0");
+        };
+
+        // inactivity timeouts of the streams in milliseconds
+        parse_timeout("Handshake", reassembly_config.handshake_timeout);
+        parse_timeout("Active", reassembly_config.active_timeout);
+        parse_timeout("Idle", reassembly_config.idle_timeout);
+        parse_timeout("Closing", reassembly_config.closing_timeout);
+
+        // memory budget of the reassembly in bytes, shared by the reassembly threads
+        reassembly_config.max_buffered_size = sniffer_config.child("MaxBufferedSize")
+            .text().as_ullong(reassembly_config.max_buffered_size);
+        reassembly_config.max_flow_buffered_size = sniffer_config.child("MaxFlowBufferedSize")
+            .text().as_ullong(reassembly_config.max_flow_buffered_size);
+        if (!reassembly_config.max_flow_buffered_size)
+            throw std::invalid_argument("Invalid Sniffer config: MaxFlowBufferedSize must be greater than 0");
+        if (reassembly_config.max_buffered_size / _sniffer_config.reassembly_threads < reassembly_config.max_flow_buffered_size)
+            throw std::invalid_argument("Invalid Sniffer config: MaxBufferedSize per reassembly thread is lower than MaxFlowBufferedSize");
+
+        // load shedding when the pipeline is overloaded
+        auto overload_config = sniffer_config.child("Overload");
+        auto& overload = _sniffer_config.overload;
+        overload.high_queue_depth = overload_config.child("HighQueueDepth").text().as_ullong(overload.high_queue_depth);
+        overload.low_queue_depth = overload_config.child("LowQueueDepth").text().as_ullong(overload.low_queue_depth);
+        overload.recovery_intervals = overload_config.child("RecoveryIntervals")
+            .text().as_ullong(overload.recovery_intervals);
+        overload.sampling_ratio = overload_config.child("SamplingRatio").text().as_ullong(overload.sampling_ratio);
+        if (overload.low_queue_depth > overload.high_queue_depth)
+            throw std::invalid_argument("Invalid Sniffer config: LowQueueDepth is greater than HighQueueDepth");
+        if (!overload.recovery_intervals)
+            throw std::invalid_argument("Invalid Sniffer config: RecoveryIntervals must be greater than 0");
+        if (!overload.sampling_ratio)
+            throw std::invalid_argument("Invalid Sniffer config: SamplingRatio must be greater than 0");
+    }
+
+    void Config::_parse_collector_config(const pugi::xml_node& collector_config)
+    {
+        _collector_config.extraction_cache_size = collector_config.child("ExtractionCacheSize")
+            .text().as_ullong(_collector_config.extraction_cache_size);
+    }
+
+    void Config::_parse_trace_config(const pugi::xml_node& trace_config)
+    {
+        _trace_config.sampling_rate = trace_config.child("SamplingRate").text().as_double(_trace_config.sampling_rate);
+        _trace_config.capacity = trace_config.child("Capacity").text().as_ullong(_trace_config.capacity);
+        if (trace_config.child("File"))
+            _trace_config.file = trace_config.child_value("File");
+
+        // check the trace config
+        if (_trace_config.sampling_rate < 0 || _trace_config.sampling_rate > 1)
+            throw std::invalid_argument("Invalid Trace config: SamplingRate must be between 0 and 1");
+        if (!_trace_config.capacity || _trace_config.capacity > (size_t(1) << 24))
+            throw std::invalid_argument("Invalid Trace config: Capacity must be between 1 and 16777216");
+        if (_trace_config.file.empty())
+            throw std::invalid_argument("Invalid Trace config: No File provided");
+    }
+
+    void Config::_parse_flight_recorder_config(const pugi::xml_node& flight_recorder_config)
+    {
+        _flight_recorder_config.size = flight_recorder_config.child("Size").text().as_ullong(_flight_recorder_config.size);
+        _flight_recorder_config.duration = std::chrono::seconds(flight_recorder_config.child("Duration")
+            .text().as_ullong(_flight_recorder_config.duration.count()));
+        if (flight_recorder_config.child("File"))
+            _flight_recorder_config.file = flight_recorder_config.child_value("File");
+
+        // check the flight recorder config
+        if (_flight_recorder_config.size > (size_t(1) << 34))
+            throw std::invalid_argument("Invalid FlightRecorder config: Size must be lower than 16GB");
+        if (_flight_recorder_config.file.empty())
+            throw std::invalid_argument("Invalid FlightRecorder config: No File provided");
+    }
+
+    void Config::_parse_cpu_governor_config(const pugi::xml_node& cpu_governor_config)
+    {
+        auto& governor_config = _cpu_governor_config;
+
+        governor_config.budget = cpu_governor_config.child("Budget").text().as_double(governor_config.budget);
+        governor_config.interval = std::chrono::milliseconds(cpu_governor_config.child("Interval")
+            .text().as_ullong(governor_config.interval.count()));
+        governor_config.max_level = cpu_governor_config.child("MaxLevel").text().as_ullong(governor_config.max_level);
+        governor_config.max_body_size = cpu_governor_config.child("MaxBodySize")
+            .text().as_ullong(governor_config.max_body_size);
+        governor_config.batch_interval_step = std::chrono::milliseconds(cpu_governor_config.child("BatchIntervalStep")
+            .text().as_ullong(governor_config.batch_interval_step.count()));
+
+        // check the CPU budget
+        if (governor_config.budget < 0)
+            throw std::invalid_argument("Invalid CpuBudget config: Budget must be positive");
+        if (governor_config.interval.count() <= 0)
+            throw std::invalid_argument("Invalid CpuBudget config: Interval must be greater than 0");
+        if (governor_config.max_level > 16)
+            throw std::invalid_argument("Invalid CpuBudget config: MaxLevel must be lower than 17");
+        if (!governor_config.max_body_size)
+            throw std::invalid_argument("Invalid CpuBudget config: MaxBodySize must be greater than 0");
+    }
+
+    void Config::_parse_privilege_separation_config(const pugi::xml_node& privilege_separation_config)
+    {
+        auto& separation_config = _privilege_separation_config;
+
+        separation_config.user = privilege_separation_config.child_value("User");
+        separation_config.ring_size = privilege_separation_config.child("RingSize")
+            .text().as_ullong(separation_config.ring_size);
+
+        // check the privilege separation
+        if (separation_config.user.empty())
+            return; // privilege separation disabled
+#ifndef __linux__
+        throw std::invalid_argument("Invalid PrivilegeSeparation config: only supported on Linux");
+#endif // !__linux__
+        // the ring holds several frames of the maximum size
+        if (separation_config.ring_size < 16 * static_cast<size_t>(_sniffer_config.capture.snap_len))
+            throw std::invalid_argument("Invalid PrivilegeSeparation config: RingSize must be at least 16 times SnapLength");
     }
 
     const ubersniff::api::UberBack::Config& Config::get_uberback_config() const noexcept
     {
         return _uberback_config;
     }
+
+    const ubersniff::metrics::MetricsServer::Config& Config::get_metrics_config() const noexcept
+    {
+        return _metrics_config;
+    }
+
+    const ubersniff::sniffer::http::Sniffer::Config& Config::get_sniffer_config() const noexcept
+    {
+        return _sniffer_config;
+    }
+
+    const ubersniff::collector::DataCollector::Config& Config::get_collector_config() const noexcept
+    {
+        return _collector_config;
+    }
+
+    const ubersniff::trace::Tracer::Config& Config::get_trace_config() const noexcept
+    {
+        return _trace_config;
+    }
+
+    const ubersniff::trace::FlightRecorder::Config& Config::get_flight_recorder_config() const noexcept
+    {
+        return _flight_recorder_config;
+    }
+
+    const ubersniff::governor::CpuGovernor::Config& Config::get_cpu_governor_config() const noexcept
+    {
+        return _cpu_governor_config;
+    }
+
+    const ubersniff::ipc::PrivilegeSeparation::Config& Config::get_privilege_separation_config() const noexcept
+    {
+        return _privilege_separation_config;
+    }
+
+    std::chrono::milliseconds Config::get_drain_timeout() const noexcept
+    {
+        return _drain_timeout;
+    }
+
+    std::chrono::milliseconds Config::get_replay_batch_window() const noexcept
+    {
+        return _replay_batch_window;
+    }
 }
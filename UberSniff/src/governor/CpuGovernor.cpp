@@ -0,0 +1,82 @@
+#ifdef _WIN32
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <windows.h>
+#else
+# include <ctime>
+#endif // _WIN32
+#include "governor/CpuGovernor.hpp"
+
+namespace ubersniff::governor {
+	CpuGovernor::CpuGovernor(const CpuGovernor::Config& config) :
+		_config(config),
+		_level(0),
+		_last_update(std::chrono::steady_clock::now()),
+		_last_cpu_time(_get_process_cpu_time()),
+		_level_gauge(metrics::Registry::get_default().gauge("ubersniff_cpu_governor_level",
+			"Throttling level of the CPU governor")),
+		_usage_gauge(metrics::Registry::get_default().gauge("ubersniff_cpu_usage_permille",
+			"CPU time of the process during the last interval, in thousandths of one core"))
+	{}
+
+	/*
+	** User and kernel time of all the threads of the process
+	*/
+	std::chrono::nanoseconds CpuGovernor::_get_process_cpu_time() noexcept
+	{
+#ifdef _WIN32
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+			return std::chrono::nanoseconds(0);
+		auto to_ticks = [](const FILETIME& time) {
+			return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+		};
+		// FILETIME counts 100 nanoseconds
+		return std::chrono::nanoseconds((to_ticks(kernel_time) + to_ticks(user_time)) * 100);
+#else
+		timespec time;
+		if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time))
+			return std::chrono::nanoseconds(0);
+		return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+#endif // _WIN32
+	}
+
+	bool CpuGovernor::update() noexcept
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (now - _last_update < _config.interval)
+			return false;
+
+		auto cpu_time = _get_process_cpu_time();
+		auto usage = std::chrono::duration<double>(cpu_time - _last_cpu_time) / std::chrono::duration<double>(now - _last_update);
+		_last_update = now;
+		_last_cpu_time = cpu_time;
+		_usage_gauge.set(static_cast<int64_t>(usage * 1000));
+
+		if (_config.budget <= 0)
+			return false;
+		auto level = _level;
+		if (usage > _config.budget && _level < _config.max_level)
+			++_level;
+		else if (usage < _config.budget / 2 && _level > 0)
+			--_level;
+		_level_gauge.set(_level);
+		return level != _level;
+	}
+
+	size_t CpuGovernor::get_extraction_ratio() const noexcept
+	{
+		return size_t(1) << _level;
+	}
+
+	size_t CpuGovernor::get_max_body_size() const noexcept
+	{
+		return _config.max_body_size >> _level;
+	}
+
+	std::chrono::milliseconds CpuGovernor::get_batch_interval() const noexcept
+	{
+		return _config.batch_interval_step * static_cast<int64_t>(_level);
+	}
+}
@@ -0,0 +1,203 @@
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include "ipc/FrameRing.hpp"
+#ifdef __linux__
+# include <cerrno>
+# include <poll.h>
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+# include <time.h>
+# include <unistd.h>
+#endif // __linux__
+
+namespace ubersniff::ipc {
+	FrameRing::FrameRing(size_t capacity) :
+		_header(nullptr),
+		_data(nullptr),
+		_mask(0),
+		_event_fd(-1),
+		_cached_tail(0),
+		_cached_head(0)
+	{
+#ifdef __linux__
+		uint64_t ring_capacity = 4096;
+		while (ring_capacity < capacity)
+			ring_capacity <<= 1;
+		// the data starts on its own page after the header
+		size_t header_size = (sizeof(Header) + 4095) & ~size_t(4095);
+
+		int memory_fd = memfd_create("ubersniff-frames", MFD_CLOEXEC);
+		if (memory_fd == -1)
+			throw std::runtime_error(std::string("memfd_create: ") + std::strerror(errno));
+		void* memory = MAP_FAILED;
+		if (ftruncate(memory_fd, header_size + ring_capacity) == 0)
+			memory = mmap(nullptr, header_size + ring_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+		auto error = errno;
+		// the mapping keeps the memory, it is shared with the processes forked
+		::close(memory_fd);
+		if (memory == MAP_FAILED)
+			throw std::runtime_error(std::string("Can not map the frame ring: ") + std::strerror(error));
+
+		_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (_event_fd == -1) {
+			error = errno;
+			munmap(memory, header_size + ring_capacity);
+			throw std::runtime_error(std::string("eventfd: ") + std::strerror(error));
+		}
+
+		_header = new (memory) Header();
+		_header->magic = MAGIC;
+		_header->capacity = ring_capacity;
+		_data = static_cast<uint8_t*>(memory) + header_size;
+		_mask = ring_capacity - 1;
+#else
+		(void)capacity;
+		throw std::runtime_error("The frame ring is only supported on Linux");
+#endif // __linux__
+	}
+
+	FrameRing::~FrameRing()
+	{
+#ifdef __linux__
+		size_t header_size = (sizeof(Header) + 4095) & ~size_t(4095);
+		munmap(_header, header_size + _header->capacity);
+		::close(_event_fd);
+#endif // __linux__
+	}
+
+	uint64_t FrameRing::_get_record_size(uint32_t frame_size) noexcept
+	{
+		// the frames are aligned on their header
+		return (sizeof(Frame) + frame_size + alignof(Frame) - 1) & ~uint64_t(alignof(Frame) - 1);
+	}
+
+	int64_t FrameRing::_get_monotonic_time() noexcept
+	{
+		// the clock of steady_clock, shared by the processes
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void FrameRing::_notify() noexcept
+	{
+#ifdef __linux__
+		_header->notified_at.store(_get_monotonic_time(), std::memory_order_relaxed);
+		uint64_t value = 1;
+		(void)write(_event_fd, &value, sizeof(value));
+#endif // __linux__
+	}
+
+	/*
+	** A frame which doesn't fit before the end of the ring is written at its beginning, after a padding mark
+	** The eventfd is only written when the consumer is waiting, a busy consumer costs no system call
+	*/
+	bool FrameRing::push(int link_type, int64_t timestamp, const uint8_t* data, uint32_t size, uint32_t length)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_producer);
+		auto record_size = _get_record_size(size);
+		auto head = _header->head.load(std::memory_order_relaxed);
+		auto offset = head & _mask;
+		auto contiguous_size = _header->capacity - offset;
+		auto padding_size = contiguous_size < record_size ? contiguous_size : 0;
+
+		if (record_size + padding_size > _header->capacity - (head - _cached_tail)) {
+			_cached_tail = _header->tail.load(std::memory_order_acquire);
+			if (record_size + padding_size > _header->capacity - (head - _cached_tail)) {
+				_header->ring_drops.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+		if (padding_size) {
+			reinterpret_cast<Frame*>(_data + offset)->size = PADDING;
+			head += padding_size;
+			offset = 0;
+		}
+		auto* frame = reinterpret_cast<Frame*>(_data + offset);
+		frame->size = size;
+		frame->link_type = link_type;
+		frame->timestamp = timestamp;
+		frame->length = length;
+		std::memcpy(frame + 1, data, size);
+
+		// the store of the head and the load of the flag are ordered against the consumer going to sleep
+		_header->head.store(head + record_size, std::memory_order_seq_cst);
+		if (_header->is_consumer_waiting.load(std::memory_order_seq_cst))
+			_notify();
+		return true;
+	}
+
+	void FrameRing::close() noexcept
+	{
+		_header->is_closed.store(1, std::memory_order_seq_cst);
+		_notify();
+	}
+
+	void FrameRing::set_stats(const FrameRing::Stats& stats) noexcept
+	{
+		_header->kernel_accepted.store(stats.kernel_accepted, std::memory_order_relaxed);
+		_header->kernel_drops.store(stats.kernel_drops, std::memory_order_relaxed);
+		_header->interface_drops.store(stats.interface_drops, std::memory_order_relaxed);
+	}
+
+	const FrameRing::Frame* FrameRing::front() noexcept
+	{
+		auto tail = _header->tail.load(std::memory_order_relaxed);
+		while (tail != _cached_head || tail != (_cached_head = _header->head.load(std::memory_order_acquire))) {
+			auto offset = tail & _mask;
+			auto* frame = reinterpret_cast<const Frame*>(_data + offset);
+			if (frame->size != PADDING)
+				return frame;
+			// skip the end of the ring
+			tail += _header->capacity - offset;
+			_header->tail.store(tail, std::memory_order_release);
+		}
+		return nullptr;
+	}
+
+	void FrameRing::pop() noexcept
+	{
+		auto tail = _header->tail.load(std::memory_order_relaxed);
+		auto* frame = reinterpret_cast<const Frame*>(_data + (tail & _mask));
+		_header->tail.store(tail + _get_record_size(frame->size), std::memory_order_release);
+	}
+
+	std::chrono::nanoseconds FrameRing::wait(std::chrono::milliseconds timeout) noexcept
+	{
+		std::chrono::nanoseconds wake_up_latency(-1);
+#ifdef __linux__
+		_header->is_consumer_waiting.store(1, std::memory_order_seq_cst);
+		if (_header->head.load(std::memory_order_seq_cst) == _header->tail.load(std::memory_order_relaxed)
+			&& !_header->is_closed.load(std::memory_order_relaxed)) {
+			pollfd event_poll = { _event_fd, POLLIN, 0 };
+			if (poll(&event_poll, 1, static_cast<int>(timeout.count())) > 0) {
+				wake_up_latency = std::chrono::nanoseconds(_get_monotonic_time()
+					- _header->notified_at.load(std::memory_order_relaxed));
+				uint64_t value;
+				(void)read(_event_fd, &value, sizeof(value));
+			}
+		}
+		_header->is_consumer_waiting.store(0, std::memory_order_relaxed);
+#else
+		(void)timeout;
+#endif // __linux__
+		return wake_up_latency;
+	}
+
+	bool FrameRing::is_finished() const noexcept
+	{
+		return _header->is_closed.load(std::memory_order_acquire)
+			&& _header->head.load(std::memory_order_acquire) == _header->tail.load(std::memory_order_relaxed);
+	}
+
+	FrameRing::Stats FrameRing::get_stats() const noexcept
+	{
+		FrameRing::Stats stats;
+		stats.kernel_accepted = _header->kernel_accepted.load(std::memory_order_relaxed);
+		stats.kernel_drops = _header->kernel_drops.load(std::memory_order_relaxed);
+		stats.interface_drops = _header->interface_drops.load(std::memory_order_relaxed);
+		stats.ring_drops = _header->ring_drops.load(std::memory_order_relaxed);
+		return stats;
+	}
+}
@@ -0,0 +1,100 @@
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "ipc/PrivilegeSeparation.hpp"
+#ifdef __linux__
+# include <cerrno>
+# include <csignal>
+# include <grp.h>
+# include <pwd.h>
+# include <sys/prctl.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif // __linux__
+
+namespace ubersniff::ipc {
+	PrivilegeSeparation::PrivilegeSeparation(const PrivilegeSeparation::Config& config) :
+		_config(config),
+		_frame_ring(config.ring_size),
+		_worker_pid(0),
+		_worker_status(EXIT_SUCCESS)
+	{}
+
+	PrivilegeSeparation::~PrivilegeSeparation()
+	{
+		if (_worker_pid)
+			stop_worker();
+	}
+
+	bool PrivilegeSeparation::fork_worker()
+	{
+#ifdef __linux__
+		auto capture_pid = getpid();
+		auto pid = fork();
+		if (pid == -1)
+			throw std::runtime_error(std::string("fork: ") + std::strerror(errno));
+		if (pid) {
+			_worker_pid = pid;
+			return true;
+		}
+
+		// the worker doesn't survive the capture process
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		if (getppid() != capture_pid)
+			_exit(EXIT_FAILURE);
+		_drop_privileges();
+		return false;
+#else
+		throw std::runtime_error("The privilege separation is only supported on Linux");
+#endif // __linux__
+	}
+
+	/*
+	** Change to the user of the configuration, the capabilities are lost with the root user
+	** Throws if the privileges can't be dropped or could be taken back
+	*/
+	void PrivilegeSeparation::_drop_privileges() const
+	{
+#ifdef __linux__
+		auto* user = getpwnam(_config.user.c_str());
+		if (!user)
+			throw std::runtime_error("Unknown user " + _config.user);
+		if (setgroups(0, nullptr) != 0 || setgid(user->pw_gid) != 0 || setuid(user->pw_uid) != 0)
+			throw std::runtime_error("Can not change to the user " + _config.user + ": " + std::strerror(errno));
+		if (user->pw_uid != 0 && setuid(0) == 0)
+			throw std::runtime_error("The privileges of the worker process could be taken back");
+		prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+#endif // __linux__
+	}
+
+	bool PrivilegeSeparation::is_worker_running()
+	{
+#ifdef __linux__
+		if (!_worker_pid)
+			return false;
+		int status;
+		if (waitpid(_worker_pid, &status, WNOHANG) != _worker_pid)
+			return true;
+		_worker_status = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+		_worker_pid = 0;
+#endif // __linux__
+		return false;
+	}
+
+	int PrivilegeSeparation::stop_worker()
+	{
+		_frame_ring.close();
+#ifdef __linux__
+		if (_worker_pid) {
+			// the worker quits like on a signal: it drains its pipeline within its drain timeout
+			kill(_worker_pid, SIGTERM);
+			int status = 0;
+			pid_t pid;
+			while ((pid = waitpid(_worker_pid, &status, 0)) == -1 && errno == EINTR);
+			_worker_status = pid == _worker_pid && WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+			_worker_pid = 0;
+		}
+#endif // __linux__
+		return _worker_status;
+	}
+}
@@ -0,0 +1,88 @@
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "metrics/Metric.hpp"
+
+namespace ubersniff::metrics {
+	size_t get_shard_index() noexcept
+	{
+		static std::atomic<size_t> next_index{ 0 };
+		thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % Counter::NB_SHARDS;
+		return index;
+	}
+
+	uint64_t Counter::value() const noexcept
+	{
+		uint64_t value = 0;
+		for (auto& shard : _shards)
+			value += shard.value.load(std::memory_order_relaxed);
+		return value;
+	}
+
+	Histogram::Histogram() noexcept
+	{
+		for (auto& shard : _shards) {
+			for (auto& bucket : shard.buckets)
+				bucket.store(0, std::memory_order_relaxed);
+			shard.sum.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	/*
+	** The count is the total of the buckets read, so the +Inf bucket and the count always match the buckets
+	*/
+	Histogram::Snapshot Histogram::snapshot() const
+	{
+		Snapshot snapshot;
+		snapshot.buckets.assign(NB_BUCKETS, 0);
+		for (auto& shard : _shards) {
+			for (size_t i = 0; i < NB_BUCKETS; ++i) {
+				auto bucket_count = shard.buckets[i].load(std::memory_order_relaxed);
+				snapshot.buckets[i] += bucket_count;
+				snapshot.count += bucket_count;
+			}
+			snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+		}
+		return snapshot;
+	}
+
+	/*
+	** Index of the highest bit set, the value is not 0
+	*/
+	static size_t get_highest_bit(uint64_t value) noexcept
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return index;
+#else
+		return 63 - __builtin_clzll(value);
+#endif
+	}
+
+	/*
+	** The values lower than SUB_BUCKETS have their own bucket,
+	** the others are indexed by their highest bit and the SUB_BUCKETS_BITS bits following it
+	*/
+	size_t Histogram::get_bucket_index(uint64_t value) noexcept
+	{
+		if (value < SUB_BUCKETS)
+			return static_cast<size_t>(value);
+
+		size_t highest_bit = get_highest_bit(value);
+		auto shift = highest_bit - SUB_BUCKETS_BITS;
+		auto sub_bucket = static_cast<size_t>((value >> shift) & (SUB_BUCKETS - 1));
+		return (shift + 1) * SUB_BUCKETS + sub_bucket;
+	}
+
+	uint64_t Histogram::get_bucket_upper_bound(size_t index) noexcept
+	{
+		if (index < SUB_BUCKETS)
+			return index;
+
+		auto shift = index / SUB_BUCKETS - 1;
+		auto sub_bucket = static_cast<uint64_t>(index % SUB_BUCKETS);
+		auto lower_bound = (SUB_BUCKETS + sub_bucket) << shift;
+		return lower_bound + ((uint64_t(1) << shift) - 1);
+	}
+}
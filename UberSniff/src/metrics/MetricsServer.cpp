@@ -0,0 +1,138 @@
+#include <iostream>
+#include <memory>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include "metrics/MetricsServer.hpp"
+
+namespace ubersniff::metrics {
+	using tcp = boost::asio::ip::tcp;
+	namespace http = boost::beast::http;
+
+	/*
+	* Connection of a client: read one request, write the response and close
+	*/
+	class MetricsServer::Connection : public std::enable_shared_from_this<MetricsServer::Connection> {
+		MetricsServer& _server;
+		boost::beast::tcp_stream _stream;
+		boost::beast::flat_buffer _buffer;
+		http::request<http::string_body> _request;
+		http::response<http::string_body> _response;
+
+	public:
+		Connection(MetricsServer& server, tcp::socket socket) :
+			_server(server),
+			_stream(std::move(socket))
+		{}
+
+		void start()
+		{
+			_stream.expires_after(std::chrono::seconds(5));
+			http::async_read(_stream, _buffer, _request,
+				std::bind(&Connection::on_read, shared_from_this(), std::placeholders::_1));
+		}
+
+		void on_read(boost::system::error_code ec)
+		{
+			if (ec)
+				return;
+
+			_response.version(_request.version());
+			_response.keep_alive(false);
+			http::verb allowed_method;
+			_response.result(_server._handle(_request.method(), std::string(_request.target()), _response.body(),
+				allowed_method));
+			if (_response.result() == http::status::ok)
+				_response.set(http::field::content_type, "text/plain; version=0.0.4");
+			else if (_response.result() == http::status::method_not_allowed)
+				_response.set(http::field::allow, http::to_string(allowed_method));
+			_response.prepare_payload();
+			http::async_write(_stream, _response,
+				std::bind(&Connection::on_write, shared_from_this(), std::placeholders::_1));
+		}
+
+		void on_write(boost::system::error_code)
+		{
+			boost::system::error_code ec;
+			_stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+		}
+	};
+
+	MetricsServer::MetricsServer(const MetricsServer::Config& config, Registry& registry) :
+		_registry(registry),
+		_io_context(),
+		_acceptor(_io_context, tcp::endpoint(boost::asio::ip::make_address(config.address),
+			static_cast<unsigned short>(std::stoul(config.port)))),
+		_accept_timer(_io_context)
+	{
+		add_handler("/metrics", [this]() {
+			return _registry.serialize();
+		});
+		_accept();
+		_thread = std::thread([this]() {
+			_io_context.run();
+		});
+	}
+
+	MetricsServer::~MetricsServer()
+	{
+		_io_context.stop();
+		_thread.join();
+	}
+
+	void MetricsServer::add_handler(const std::string& target, Handler handler, http::verb method)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_handlers);
+		_handlers[target] = Route{ method, std::move(handler) };
+	}
+
+	/*
+	** A target requested with another method than the method of its handler is not allowed
+	** A handler which throws is an internal error, its message is the body
+	*/
+	http::status MetricsServer::_handle(http::verb method, const std::string& target, std::string& body,
+		http::verb& allowed_method)
+	{
+		Handler handler;
+		{
+			std::lock_guard<std::mutex> lock(_mutex_handlers);
+			auto it = _handlers.find(target);
+			if (it == _handlers.end())
+				return http::status::not_found;
+			if (it->second.method != method) {
+				allowed_method = it->second.method;
+				return http::status::method_not_allowed;
+			}
+			handler = it->second.handler;
+		}
+		try {
+			body = handler();
+		} catch (std::exception& e) {
+			body = std::string("error: ") + e.what() + "\n";
+			return http::status::internal_server_error;
+		}
+		return http::status::ok;
+	}
+
+	/*
+	** An error of accept is retried after a short delay: out of file descriptors (EMFILE),
+	**  accepting again at once fails at once and the server thread spins
+	*/
+	void MetricsServer::_accept()
+	{
+		_acceptor.async_accept([this](boost::system::error_code ec, tcp::socket socket) {
+			if (ec == boost::asio::error::operation_aborted)
+				return;
+			if (!ec) {
+				std::make_shared<Connection>(*this, std::move(socket))->start();
+				_accept();
+				return;
+			}
+			std::cerr << "metrics: " << ec.message() << std::endl;
+			_accept_timer.expires_after(std::chrono::milliseconds(100));
+			_accept_timer.async_wait([this](boost::system::error_code ec) {
+				if (ec != boost::asio::error::operation_aborted)
+					_accept();
+			});
+		});
+	}
+}
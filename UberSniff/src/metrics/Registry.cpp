@@ -0,0 +1,164 @@
+#include <sstream>
+#include <stdexcept>
+#include "metrics/Registry.hpp"
+
+namespace ubersniff::metrics {
+	bool Registry::FamilyLess::operator()(const std::string& lhs, const std::string& rhs) const
+	{
+		auto lhs_family = lhs.substr(0, lhs.find('{'));
+		auto rhs_family = rhs.substr(0, rhs.find('{'));
+		if (lhs_family != rhs_family)
+			return lhs_family < rhs_family;
+		return lhs < rhs;
+	}
+
+	Registry& Registry::get_default()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	Registry::Entry& Registry::_get_entry(const std::string& name, Type type, const std::string& help)
+	{
+		auto& entry = _entries[name];
+		if (!entry.counter && !entry.gauge && !entry.histogram && !entry.callback) {
+			// new entry
+			entry.type = type;
+			entry.help = help;
+		} else if (entry.type != type) {
+			throw std::invalid_argument("The metric " + name + " is already registered with an other type");
+		}
+		return entry;
+	}
+
+	Counter& Registry::counter(const std::string& name, const std::string& help)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_entries);
+		auto& entry = _get_entry(name, Type::COUNTER, help);
+		if (!entry.counter)
+			entry.counter = std::make_unique<Counter>();
+		return *entry.counter;
+	}
+
+	Gauge& Registry::gauge(const std::string& name, const std::string& help)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_entries);
+		auto& entry = _get_entry(name, Type::GAUGE, help);
+		if (!entry.gauge)
+			entry.gauge = std::make_unique<Gauge>();
+		return *entry.gauge;
+	}
+
+	Histogram& Registry::histogram(const std::string& name, const std::string& help)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_entries);
+		auto& entry = _get_entry(name, Type::HISTOGRAM, help);
+		if (!entry.histogram)
+			entry.histogram = std::make_unique<Histogram>();
+		return *entry.histogram;
+	}
+
+	void Registry::counter_callback(const std::string& name, const std::string& help, std::function<double()> callback)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_entries);
+		_get_entry(name, Type::COUNTER, help).callback = std::move(callback);
+	}
+
+	void Registry::gauge_callback(const std::string& name, const std::string& help, std::function<double()> callback)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_entries);
+		_get_entry(name, Type::GAUGE, help).callback = std::move(callback);
+	}
+
+	void Registry::unregister_callback(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex_entries);
+		auto it = _entries.find(name);
+		if (it != _entries.end() && it->second.callback)
+			_entries.erase(it);
+	}
+
+	/*
+	** Export the metrics in the Prometheus text format
+	*/
+	std::string Registry::serialize() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex_entries);
+		std::string output;
+		std::string previous_family;
+
+		for (auto& it : _entries) {
+			auto& name = it.first;
+			auto& entry = it.second;
+
+			auto family = _get_family(name);
+			if (family != previous_family) {
+				output += "# HELP " + family + " " + entry.help + "\n";
+				output += "# TYPE " + family + " " + _get_type_name(entry.type) + "\n";
+				previous_family = family;
+			}
+
+			std::stringstream value;
+			if (entry.callback)
+				value << entry.callback();
+			else if (entry.counter)
+				value << entry.counter->value();
+			else if (entry.gauge)
+				value << entry.gauge->value();
+			else if (entry.histogram) {
+				_serialize_histogram(name, *entry.histogram, output);
+				continue;
+			}
+			output += name + " " + value.str() + "\n";
+		}
+		return output;
+	}
+
+	/*
+	** Only the non-empty buckets are exported, the cumulative counts stay exact without the empty ones
+	*/
+	void Registry::_serialize_histogram(const std::string& name, const Histogram& histogram, std::string& output) const
+	{
+		auto family = _get_family(name);
+		auto labels = name.substr(family.size());
+		auto snapshot = histogram.snapshot();
+
+		uint64_t cumulative_count = 0;
+		for (size_t i = 0; i < Histogram::NB_BUCKETS; ++i) {
+			if (!snapshot.buckets[i])
+				continue;
+			cumulative_count += snapshot.buckets[i];
+			output += _add_label(family + "_bucket" + labels,
+				"le=\"" + std::to_string(Histogram::get_bucket_upper_bound(i)) + "\"");
+			output += " " + std::to_string(cumulative_count) + "\n";
+		}
+		output += _add_label(family + "_bucket" + labels, "le=\"+Inf\"") + " " + std::to_string(snapshot.count) + "\n";
+		output += family + "_sum" + labels + " " + std::to_string(snapshot.sum) + "\n";
+		output += family + "_count" + labels + " " + std::to_string(snapshot.count) + "\n";
+	}
+
+	std::string Registry::_get_family(const std::string& name)
+	{
+		return name.substr(0, name.find('{'));
+	}
+
+	std::string Registry::_add_label(const std::string& name, const std::string& label)
+	{
+		if (name.back() == '}')
+			return name.substr(0, name.size() - 1) + "," + label + "}";
+		return name + "{" + label + "}";
+	}
+
+	const char* Registry::_get_type_name(Type type) noexcept
+	{
+		switch (type) {
+		case Type::COUNTER:
+			return "counter";
+		case Type::GAUGE:
+			return "gauge";
+		case Type::HISTOGRAM:
+			return "histogram";
+		}
+		return "untyped";
+	}
+}
@@ -1,10 +1,14 @@
+#include <algorithm>
 #include "packet/HTTPReassembler.hpp"
+#include "timing/Clock.hpp"
+#include "trace/Tracer.hpp"
 
 namespace ubersniff::packet {
 	const boost::regex HTTPReassembler::_http_request_regex =
 		boost::regex("^([\\w]+) ([^ ]+) HTTP/[^ ]+\r\n");
 	const boost::regex HTTPReassembler::_http_response_regex =
 		boost::regex("^HTTP/[^ ]+ ([\\d]+) ([\\w\\s]+)\r\n");
+	std::atomic<size_t> HTTPReassembler::_max_body_size{ 30000 };
 
 	HTTPReassembler::HTTPReassembler(collector::DataCollector& data_collector, const std::string& scheme) :
 		_data_collector(data_collector),
@@ -15,24 +19,98 @@ namespace ubersniff::packet {
 		_response_is_chunked(true)
 	{}
 
+	HTTPReassembler::~HTTPReassembler()
+	{
+		_get_metrics().buffered_bytes.dec(_buffered_size);
+	}
+
+	HTTPReassembler::Metrics& HTTPReassembler::_get_metrics()
+	{
+		static Metrics metrics{
+			metrics::Registry::get_default().counter("ubersniff_http_exchanges_total", "HTTP exchanges reassembled"),
+			metrics::Registry::get_default().counter("ubersniff_http_parse_errors_total", "Malformed HTTP headers"),
+			metrics::Registry::get_default().gauge("ubersniff_http_buffered_bytes", "Bytes waiting in the HTTP reassembly buffers")
+		};
+		return metrics;
+	}
+
+	void HTTPReassembler::_update_buffered_size() noexcept
+	{
+		size_t buffered_size = _request_buffer.size() + _response_buffer.size() + _response.content.size();
+		_get_metrics().buffered_bytes.inc(static_cast<int64_t>(buffered_size) - static_cast<int64_t>(_buffered_size));
+		_buffered_size = buffered_size;
+	}
+
 	/*
 	** Push the client payload to the request data buffer
 	**  and start the reassembling of the request packet
 	*/
-	void HTTPReassembler::push_client_payload(std::vector<uint8_t>& client_payload)
+	void HTTPReassembler::push_client_payload(std::vector<uint8_t>& client_payload, std::chrono::microseconds timestamp)
 	{
+		_packet_timestamp = timestamp;
 		_request_buffer.insert(_request_buffer.end(), client_payload.begin(), client_payload.end());
 		_reassemble_request();
+		_update_buffered_size();
 	}
 
 	/*
 	** Push the server payload to the response data buffer
 	**  and start the reassembling of the response packet
 	*/
-	void HTTPReassembler::push_server_payload(std::vector<uint8_t>& server_payload)
+	void HTTPReassembler::push_server_payload(std::vector<uint8_t>& server_payload, std::chrono::microseconds timestamp)
 	{
+		_packet_timestamp = timestamp;
 		_response_buffer.insert(_response_buffer.end(), server_payload.begin(), server_payload.end());
 		_reassemble_response();
+		_update_buffered_size();
+	}
+
+	bool HTTPReassembler::is_idle() const noexcept
+	{
+		return _request_state == ReassembleState::NEXT && _response_state == ReassembleState::NEXT &&
+			_request_buffer.empty() && _response_buffer.empty() && !_response_skipped_size &&
+			_reassembled_request.empty() && _reassembled_response.empty();
+	}
+
+	void HTTPReassembler::reset() noexcept
+	{
+		_request_buffer.clear();
+		_response_buffer.clear();
+		_request = {};
+		_response = {};
+		_response_content_length = 0;
+		_response_skipped_size = 0;
+		_response_is_chunked = true;
+		_reassembled_request = {};
+		_reassembled_response = {};
+		_request_state = ReassembleState::NEXT;
+		_response_state = ReassembleState::NEXT;
+		_is_header_only = false;
+		_update_buffered_size();
+	}
+
+	void HTTPReassembler::finish()
+	{
+		if (_response_state == ReassembleState::BODY || _response_state == ReassembleState::FINISHED) {
+			_finish_response_reassembling();
+			_response_state = ReassembleState::NEXT;
+		}
+		_update_buffered_size();
+	}
+
+	void HTTPReassembler::set_header_only()
+	{
+		_is_header_only = true;
+		_response.content.clear();
+		_response.content.shrink_to_fit();
+		if (_response_state == ReassembleState::BODY || _response_state == ReassembleState::FINISHED) {
+			// send the response with its headers only
+			_finish_response_reassembling();
+			_response_state = ReassembleState::NEXT;
+		}
+		if (_response_state != ReassembleState::HEADERS)
+			_response_buffer.clear();
+		_update_buffered_size();
 	}
 
 	/*
@@ -87,6 +165,7 @@ namespace ubersniff::packet {
 			_request.request = std::move(std::string(matchs[0].begin(), matchs[0].end()));
 			_request.method = std::move(std::string(matchs[1].begin(), matchs[1].end()));
 			_init_http_request_uri(_request, std::move(std::string(matchs[2].begin(), matchs[2].end())));
+			_request.trace = trace::Tracer::get_default().start();
 
 			// remove datas before the end of the http request message
 			_request_buffer.erase(_request_buffer.begin(),
@@ -151,6 +230,7 @@ namespace ubersniff::packet {
 				auto pos = std::search(header.begin(), header.end(), _header_value_delimiter.begin(), _header_value_delimiter.end());
 				if (pos == header.end()) {
 					// error whth the implementation of the protocol from the client
+					_get_metrics().parse_errors.inc();
 					return true;
 				} else {
 					std::string header_name(header.begin(), pos);
@@ -218,26 +298,36 @@ namespace ubersniff::packet {
 	*/
 	void HTTPReassembler::_reassemble_response()
 	{
-		// Loop until the buffer or the exchange queue is empty
-		while (!_response_buffer.empty()) {
+		// Loop until the buffer is empty, a body received completely is finished without waiting for the next data
+		while (!_response_buffer.empty()
+			|| _response_state == ReassembleState::BODY || _response_state == ReassembleState::FINISHED) {
 			switch (_response_state) {
 			case ReassembleState::NEXT:
-				if (_search_http_response())
+				if (_response_skipped_size) {
+					auto skipped_size = std::min(_response_skipped_size, _response_buffer.size());
+					_response_buffer.erase(_response_buffer.begin(), _response_buffer.begin() + skipped_size);
+					_response_skipped_size -= skipped_size;
+				} else if (_search_http_response()) {
 					_response_state = ReassembleState::HEADERS;
-				else
+				} else {
 					return;
+				}
 				break;
 			case ReassembleState::HEADERS:
-				if (_reassemble_response_headers())
+				if (_reassemble_response_headers()) {
+					trace::mark(_get_response_trace(), trace::HEADERS_COMPLETE);
 					_response_state = ReassembleState::BODY;
-				else
+				} else {
 					return;
+				}
 				break;
 			case ReassembleState::BODY:
-				if (_reassemble_response_body())
+				if (_reassemble_response_body()) {
+					trace::mark(_get_response_trace(), trace::BODY_COMPLETE);
 					_response_state = ReassembleState::FINISHED;
-				else
+				} else {
 					return;
+				}
 				break;
 			case ReassembleState::FINISHED:
 				_finish_response_reassembling();
@@ -298,6 +388,7 @@ namespace ubersniff::packet {
 				auto pos = std::search(header.begin(), header.end(), _header_value_delimiter.begin(), _header_value_delimiter.end());
 				if (pos == header.end()) {
 					// error whth the implementation of the protocol from the client
+					_get_metrics().parse_errors.inc();
 					return true;
 				} else {
 					std::string header_name(header.begin(), pos);
@@ -346,6 +437,14 @@ namespace ubersniff::packet {
 	*/
 	bool HTTPReassembler::_reassemble_response_body()
 	{
+		if (_is_header_only) {
+			// skip the body, its length is known without Transfer-Encoding chunked
+			if (_response_is_chunked)
+				_response_buffer.clear();
+			else
+				_response_skipped_size = _response.content_length;
+			return true;
+		}
 		if (_response_is_chunked) {
 			// Chunked body
 			return _reassemble_response_body_chunked();
@@ -374,55 +473,72 @@ namespace ubersniff::packet {
 		// erase in _response_buffer the inserted data in body
 		_response_buffer.erase(_response_buffer.begin(), _response_buffer.begin() + content_size);
 
-		// return true if the body is reassembled or if content is > 30000
-		return _response_content_length == _response.content_length
-			|| _response_content_length >= 30000;
+		// return true if the body is reassembled or if content reached the cap
+		if (_response_content_length == _response.content_length)
+			return true;
+		if (_response_content_length >= _max_body_size.load(std::memory_order_relaxed)) {
+			// the rest of the body is not searched for the next response
+			_response_skipped_size = _response.content_length - _response_content_length;
+			return true;
+		}
+		return false;
 	}
  
 	/*
 	** Reassemble the body of the http response with chunked body
-	** It will erase (in _response_buffer) the data corresponding to headers
+	** It will erase (in _response_buffer) the chunks reassembled and the end of line closing each chunk
 	**
-	** Returns true when it finishes the reassembling of headers otherwise it returns false
+	** Returns true when it finishes the reassembling of the body otherwise it returns false
 	*/
 	bool HTTPReassembler::_reassemble_response_body_chunked()
 	{
-		auto position = std::search(_response_buffer.begin(), _response_buffer.end(),
-			_eol_delimiter.begin(), _eol_delimiter.end());
-		if (position == _response_buffer.end())
-			return false;
-
-		// get chunk size
-		std::string chunk_size_s = std::string(_response_buffer.begin(), position);
-		size_t chunk_size;
-		try {
-			chunk_size = std::stoul(chunk_size_s, nullptr, 16);
-		}
-		catch (std::exception&) {
-			return true;
-		}
+		// all the chunks received are reassembled
+		while (true) {
+			auto position = std::search(_response_buffer.begin(), _response_buffer.end(),
+				_eol_delimiter.begin(), _eol_delimiter.end());
+			if (position == _response_buffer.end())
+				return false;
 
-		if (chunk_size == 0) {
-			// end of chunked body, erase the chunk size in the buffer
-			_response_buffer.erase(_response_buffer.begin(), position + _eol_delimiter.size());
-			return true;
-		} else {
-			// check the buffer size
-			if (_response_buffer.size() < chunk_size_s.size() + _eol_delimiter.size() + chunk_size) {
+			// get chunk size
+			std::string chunk_size_s = std::string(_response_buffer.begin(), position);
+			size_t chunk_size;
+			try {
+				chunk_size = std::stoul(chunk_size_s, nullptr, 16);
+			}
+			catch (std::exception&) {
+				return true;
+			}
+			size_t chunk_start = chunk_size_s.size() + _eol_delimiter.size();
+
+			if (chunk_size == 0) {
+				// end of chunked body, erase the chunk size and the empty line closing the body
+				_response_buffer.erase(_response_buffer.begin(), _response_buffer.begin() + chunk_start);
+				if (_response_buffer.size() >= _eol_delimiter.size()
+					&& std::equal(_eol_delimiter.begin(), _eol_delimiter.end(), _response_buffer.begin()))
+					_response_buffer.erase(_response_buffer.begin(), _response_buffer.begin() + _eol_delimiter.size());
+				return true;
+			}
+			// check the buffer size: the chunk and its end of line
+			if (_response_buffer.size() < chunk_start + chunk_size + _eol_delimiter.size()) {
 				// wait missing data
 				return false;
 			}
 			// get chunk and add in response
-			std::string chunk(position + _eol_delimiter.size(), position + _eol_delimiter.size() + chunk_size);
-			_response.content += chunk;
+			_response.content.append(_response_buffer.begin() + chunk_start, _response_buffer.begin() + chunk_start + chunk_size);
 			_response_content_length += chunk_size;
 			// remove chunk in buffer
-			_response_buffer.erase(_response_buffer.begin(), position + _eol_delimiter.size() + chunk_size);
-			// return false if the current content length is < 30000
-			return _response_content_length >= 30000;
+			_response_buffer.erase(_response_buffer.begin(), _response_buffer.begin() + chunk_start + chunk_size + _eol_delimiter.size());
+			// the body is finished when the current content length reaches the cap
+			if (_response_content_length >= _max_body_size.load(std::memory_order_relaxed))
+				return true;
 		}
 	}
 
+	void HTTPReassembler::set_max_body_size(size_t max_body_size) noexcept
+	{
+		_max_body_size.store(max_body_size, std::memory_order_relaxed);
+	}
+
 	/*
 	** Add the reassembled exchange to response queue
 	*/
@@ -439,6 +555,16 @@ namespace ubersniff::packet {
 		_send_exchange_to_collector();
 	}
 
+	/*
+	** Returns the trace of the request answered by the response being reassembled
+	*/
+	trace::Record* HTTPReassembler::_get_response_trace() noexcept
+	{
+		if (!_reassembled_request.empty())
+			return _reassembled_request.front().trace.get();
+		return _request.trace.get();
+	}
+
 	/*
 	** Send a reassembled exchange to the data_collector
 	** If an exchange is reassembled send it
@@ -453,14 +579,18 @@ namespace ubersniff::packet {
 		// create exchange
 		Exchange exchange = {
 			std::move(_reassembled_request.front()),
-			std::move(_reassembled_response.front())
+			std::move(_reassembled_response.front()),
+			// the window of the exchange doesn't depend on the progress of the other reassembly threads
+			timing::Clock::get_default().at(_packet_timestamp)
 		};
 
 		// remove request and response from queue
 		_reassembled_request.pop();
 		_reassembled_response.pop();
+		_get_metrics().exchanges.inc();
 
-		if (exchange.response.content_type == ContentType::TEXT) {
+		// a 304 Not Modified has no body, the collector counts the page it has cached for the URI
+		if (exchange.response.content_type == ContentType::TEXT || exchange.response.status_code == "304") {
 			_data_collector.collect_text_exchange(std::move(exchange));
 		} else if (exchange.response.content_type == ContentType::IMAGE) {
 			_data_collector.collect_image_exchange(std::move(exchange));
@@ -0,0 +1,49 @@
+#include "packet/HTTPReassemblerPool.hpp"
+
+namespace ubersniff::packet {
+	HTTPReassemblerPool::HTTPReassemblerPool(collector::DataCollector& data_collector, const std::string& scheme,
+		size_t max_idle_reassemblers) :
+		_data_collector(data_collector),
+		_scheme(scheme),
+		_max_idle_reassemblers(max_idle_reassemblers),
+		_active_reassemblers(metrics::Registry::get_default().gauge("ubersniff_http_reassemblers{state=\"active\"}",
+			"HTTP reassemblers allocated")),
+		_pooled_reassemblers(metrics::Registry::get_default().gauge("ubersniff_http_reassemblers{state=\"pooled\"}",
+			"HTTP reassemblers allocated"))
+	{
+		_idle_reassemblers.reserve(_max_idle_reassemblers);
+	}
+
+	HTTPReassemblerPool::~HTTPReassemblerPool()
+	{
+		_pooled_reassemblers.dec(_idle_reassemblers.size());
+	}
+
+	std::unique_ptr<HTTPReassembler> HTTPReassemblerPool::acquire()
+	{
+		std::unique_ptr<HTTPReassembler> reassembler;
+
+		if (_idle_reassemblers.empty()) {
+			reassembler = std::make_unique<HTTPReassembler>(_data_collector, _scheme);
+		} else {
+			reassembler = std::move(_idle_reassemblers.back());
+			_idle_reassemblers.pop_back();
+			_pooled_reassemblers.dec();
+		}
+		_active_reassemblers.inc();
+		return reassembler;
+	}
+
+	void HTTPReassemblerPool::release(std::unique_ptr<HTTPReassembler> reassembler) noexcept
+	{
+		if (!reassembler)
+			return;
+
+		_active_reassemblers.dec();
+		if (_idle_reassemblers.size() < _max_idle_reassemblers) {
+			reassembler->reset();
+			_idle_reassemblers.push_back(std::move(reassembler));
+			_pooled_reassemblers.inc();
+		}
+	}
+}
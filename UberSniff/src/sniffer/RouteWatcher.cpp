@@ -0,0 +1,149 @@
+#include <tins/network_interface.h>
+#include "sniffer/RouteWatcher.hpp"
+#ifdef __linux__
+# include <linux/netlink.h>
+# include <linux/rtnetlink.h>
+# include <poll.h>
+# include <sys/eventfd.h>
+# include <sys/socket.h>
+# include <unistd.h>
+#endif // __linux__
+
+namespace ubersniff::sniffer {
+	RouteWatcher::RouteWatcher(std::chrono::milliseconds poll_interval) :
+		_poll_interval(poll_interval),
+		_interface_name(_get_default_interface_name()),
+		_has_changed(false),
+		_is_stopping(false)
+#ifdef __linux__
+		, _netlink_fd(-1),
+		_stop_fd(-1)
+#endif // __linux__
+	{
+		// the sockets are opened before the thread, to be closed by the destructor
+		_watcher_thread = std::thread(_open_netlink() ? &RouteWatcher::_watch_netlink : &RouteWatcher::_watch_polling, this);
+	}
+
+	RouteWatcher::~RouteWatcher()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex_stop);
+			_is_stopping = true;
+		}
+		_stop_condition.notify_all();
+#ifdef __linux__
+		if (_stop_fd != -1) {
+			uint64_t value = 1;
+			(void)write(_stop_fd, &value, sizeof(value));
+		}
+#endif // __linux__
+		_watcher_thread.join();
+#ifdef __linux__
+		if (_netlink_fd != -1)
+			close(_netlink_fd);
+		if (_stop_fd != -1)
+			close(_stop_fd);
+#endif // __linux__
+	}
+
+	std::string RouteWatcher::_get_default_interface_name()
+	{
+		return Tins::NetworkInterface::default_interface().name();
+	}
+
+	std::string RouteWatcher::get_interface_name()
+	{
+		std::lock_guard<std::mutex> lock(_mutex_interface_name);
+		return _interface_name;
+	}
+
+	bool RouteWatcher::poll_change(std::string& interface_name)
+	{
+		if (!_has_changed.load(std::memory_order_acquire))
+			return false;
+
+		std::lock_guard<std::mutex> lock(_mutex_interface_name);
+		_has_changed = false;
+		interface_name = _interface_name;
+		return true;
+	}
+
+	/*
+	** Read the routing table and post the default interface if it changed
+	** The interface is kept while there is no default route
+	*/
+	void RouteWatcher::_check_default_interface()
+	{
+		std::string interface_name;
+		try {
+			interface_name = _get_default_interface_name();
+		} catch (std::exception&) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(_mutex_interface_name);
+		if (interface_name == _interface_name)
+			return;
+		_interface_name = std::move(interface_name);
+		_has_changed.store(true, std::memory_order_release);
+	}
+
+	/*
+	** Subscribe to the notifications of the links and of the routes
+	*/
+	bool RouteWatcher::_open_netlink() noexcept
+	{
+#ifdef __linux__
+		_stop_fd = eventfd(0, EFD_CLOEXEC);
+		_netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+		if (_stop_fd == -1 || _netlink_fd == -1)
+			return false;
+
+		sockaddr_nl address = {};
+		address.nl_family = AF_NETLINK;
+		address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+		return bind(_netlink_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+#else
+		return false;
+#endif // __linux__
+	}
+
+	/*
+	** Wait for the notifications, the content of the messages is not parsed:
+	**  a burst of notifications is read at once, then the routing table is read again
+	*/
+	void RouteWatcher::_watch_netlink()
+	{
+#ifdef __linux__
+		char buffer[8192];
+		pollfd fds[2] = {
+			{ _netlink_fd, POLLIN, 0 },
+			{ _stop_fd, POLLIN, 0 }
+		};
+
+		while (!_is_stopping) {
+			if (poll(fds, 2, -1) < 0)
+				continue;
+			if (fds[1].revents)
+				break;
+			if (!fds[0].revents)
+				continue;
+
+			// drain the socket, an overflow (ENOBUFS) only means that a check is needed too
+			while (recv(_netlink_fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+			}
+			_check_default_interface();
+		}
+#endif // __linux__
+	}
+
+	void RouteWatcher::_watch_polling()
+	{
+		std::unique_lock<std::mutex> lock(_mutex_stop);
+		while (!_stop_condition.wait_for(lock, _poll_interval, [this]() { return _is_stopping.load(); })) {
+			lock.unlock();
+			_check_default_interface();
+			lock.lock();
+		}
+	}
+}
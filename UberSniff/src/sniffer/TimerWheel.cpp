@@ -0,0 +1,125 @@
+#include <algorithm>
+#include "sniffer/TimerWheel.hpp"
+
+namespace ubersniff::sniffer {
+	void TimerWheel::Timer::cancel() noexcept
+	{
+		if (!_wheel)
+			return;
+		_previous->_next = _next;
+		_next->_previous = _previous;
+		--_wheel->_size;
+		_wheel = nullptr;
+		_previous = nullptr;
+		_next = nullptr;
+	}
+
+	TimerWheel::TimerWheel(Duration resolution) noexcept :
+		_resolution(std::max(resolution, Duration(1))),
+		_current_tick(0),
+		_is_started(false),
+		_size(0)
+	{
+		for (auto& level : _slots) {
+			for (auto& sentinel : level) {
+				sentinel._previous = &sentinel;
+				sentinel._next = &sentinel;
+			}
+		}
+	}
+
+	TimerWheel::~TimerWheel()
+	{
+		// detach the timers still scheduled
+		for (auto& level : _slots) {
+			for (auto& sentinel : level) {
+				while (sentinel._next != &sentinel)
+					sentinel._next->cancel();
+			}
+		}
+	}
+
+	/*
+	** Put the timer in the slot of the lowest level covering its expiration
+	** A timer beyond the range of the wheel is put in the last slot reachable and moved again when it is reached
+	*/
+	void TimerWheel::_link(Timer& timer) noexcept
+	{
+		constexpr uint64_t max_delta = (uint64_t(1) << (LEVEL_BITS * LEVELS)) - 1;
+		auto delta = std::min(timer._expiration_tick - _current_tick, max_delta);
+		auto tick = _current_tick + delta;
+
+		size_t level = 0;
+		while (delta >= (uint64_t(1) << (LEVEL_BITS * (level + 1))))
+			++level;
+		auto& sentinel = _slots[level][(tick >> (LEVEL_BITS * level)) & (SLOTS - 1)];
+
+		timer._next = &sentinel;
+		timer._previous = sentinel._previous;
+		sentinel._previous->_next = &timer;
+		sentinel._previous = &timer;
+	}
+
+	/*
+	** Move the timers of the current slot of the level to the lower levels
+	*/
+	void TimerWheel::_cascade(size_t level) noexcept
+	{
+		auto& sentinel = _slots[level][(_current_tick >> (LEVEL_BITS * level)) & (SLOTS - 1)];
+
+		while (sentinel._next != &sentinel) {
+			auto& timer = *sentinel._next;
+			sentinel._next = timer._next;
+			timer._next->_previous = &sentinel;
+			_link(timer);
+		}
+	}
+
+	void TimerWheel::schedule(Timer& timer, Duration delay) noexcept
+	{
+		timer.cancel();
+		auto ticks = static_cast<uint64_t>((std::max(delay, Duration(0)) + _resolution - Duration(1)) / _resolution);
+		timer._expiration_tick = _current_tick + std::max<uint64_t>(ticks, 1);
+		timer._wheel = this;
+		++_size;
+		_link(timer);
+	}
+
+	void TimerWheel::advance(Duration now, const ExpirationCallback& on_expired)
+	{
+		auto target_tick = static_cast<uint64_t>(std::max(now, Duration(0)) / _resolution);
+		if (!_is_started) {
+			_current_tick = target_tick;
+			_is_started = true;
+			return;
+		}
+
+		while (_current_tick < target_tick) {
+			if (!_size) {
+				// nothing to expire: jump to the time
+				_current_tick = target_tick;
+				return;
+			}
+			++_current_tick;
+			for (size_t level = 1; level < LEVELS; ++level) {
+				if (_current_tick & ((uint64_t(1) << (LEVEL_BITS * level)) - 1))
+					break;
+				_cascade(level);
+			}
+
+			auto& sentinel = _slots[0][_current_tick & (SLOTS - 1)];
+			while (sentinel._next != &sentinel) {
+				auto& timer = *sentinel._next;
+				if (timer._expiration_tick > _current_tick) {
+					// timer beyond the range of the wheel
+					sentinel._next = timer._next;
+					timer._next->_previous = &sentinel;
+					_link(timer);
+					continue;
+				}
+				timer.cancel();
+				on_expired(timer);
+			}
+		}
+	}
+}
@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <iostream>
+#include <pcap.h>
+#include <stdexcept>
+#include <tins/detail/pdu_helpers.h>
+#include <tins/exceptions.h>
+#include "sniffer/http/Capture.hpp"
+#include "sniffer/http/ReassemblyShard.hpp"
+#include "trace/FlightRecorder.hpp"
+
+namespace ubersniff::sniffer::http {
+	Capture::Capture(const std::string& name, Source source, const Capture::Config& config, const std::string& filter,
+		BatchHandler batch_handler) :
+		_name(name),
+		_source(source),
+		_config(config),
+		_batch_handler(std::move(batch_handler)),
+		_sniffer_config(),
+		_sniffer((_sniffer_config.set_filter(filter),
+			_sniffer_config.set_timeout(TIMEOUT),
+			_sniffer_config.set_immediate_mode(true),
+			_sniffer_config.set_promisc_mode(true),
+			_sniffer_config.set_snap_len(config.snap_len),
+			config.buffer_size ? _sniffer_config.set_buffer_size(config.buffer_size) : void(),
+			_make_sniffer())),
+		_link_type(_sniffer->link_type()),
+		_ring(nullptr),
+		_is_capturing(false),
+		_received_packets(0),
+		_has_pending_filter(false),
+		_ring_wake_up_latency(nullptr)
+	{}
+
+	Capture::Capture(ipc::FrameRing& ring, const Capture::Config& config, BatchHandler batch_handler) :
+		_name("frame ring"),
+		_source(Source::RING),
+		_config(config),
+		_batch_handler(std::move(batch_handler)),
+		_sniffer_config(),
+		_sniffer(),
+		_link_type(0),
+		_ring(&ring),
+		_is_capturing(false),
+		_received_packets(0),
+		_has_pending_filter(false),
+		_ring_wake_up_latency(&metrics::Registry::get_default().histogram("ubersniff_ring_wake_up_nanoseconds",
+			"Time from the wake up of the worker by the capture process to the read of the frame ring"))
+	{}
+
+	Capture::~Capture()
+	{
+		stop();
+	}
+
+	std::unique_ptr<Tins::BaseSniffer> Capture::_make_sniffer()
+	{
+		if (_source == Source::FILE)
+			return std::make_unique<Tins::FileSniffer>(_name, _sniffer_config);
+		return std::make_unique<Tins::Sniffer>(_name, _sniffer_config);
+	}
+
+	void Capture::start()
+	{
+		if (_is_capturing)
+			return;
+		// join the thread of a finished replay
+		if (_capture_thread.joinable())
+			_capture_thread.join();
+
+		_is_capturing = true;
+		_capture_thread = std::thread(&Capture::_capture, this);
+	}
+
+	/*
+	** Interrupt the capture thread without waiting for the pcap timeout
+	*/
+	void Capture::stop()
+	{
+		if (_is_capturing.exchange(false)) {
+			if (!_sniffer) {
+				_ring->interrupt();
+			} else {
+				// pcap_breakloop, the read in progress returns at once
+				_sniffer->stop_sniff();
+#ifdef _WIN32 // wake up the thread waiting for the pcap event
+				SetEvent(pcap_getevent(_sniffer->get_pcap_handle()));
+#endif // _WIN32
+			}
+		}
+		// the thread of a replay can be finished already
+		if (_capture_thread.joinable())
+			_capture_thread.join();
+	}
+
+	void Capture::_capture()
+	{
+		_batch.reserve(std::max<size_t>(_config.batch_size, 1));
+		if (_source == Source::RING) {
+			while (_is_capturing && _read_ring_batch());
+			_batch.clear();
+			_is_capturing = false;
+			return;
+		}
+		try {
+#ifdef _WIN32 // get pcap event handler of the sniffer for windows
+			auto event_h = pcap_getevent(_sniffer->get_pcap_handle());
+#endif // _WIN32
+			while (_is_capturing) {
+				if (_has_pending_filter)
+					_apply_pending_filter();
+				if (_source == Source::FILE) {
+					// replay as fast as possible until the end of the file
+					if (!_read_batch())
+						break;
+					continue;
+				}
+#ifdef _WIN32 // Set timeout for the sniffer for windows
+				if (WaitForSingleObject(event_h, (DWORD)TIMEOUT) == WAIT_OBJECT_0) {
+#endif // _WIN32
+					if (!_read_batch())
+						break;
+#ifdef _WIN32
+				}
+#endif // _WIN32
+			}
+		} catch (std::exception& e) {
+			std::cout << _name << ": " << e.what() << std::endl;
+		}
+		_batch.clear();
+		_is_capturing = false;
+	}
+
+	/*
+	** Read the packets available, up to the batch size, and give them to the handler in one call
+	** Returns false at the end of the capture file, on an error or when the capture is interrupted
+	*/
+	bool Capture::_read_batch()
+	{
+		auto result = pcap_dispatch(_sniffer->get_pcap_handle(), static_cast<int>(std::max<size_t>(_config.batch_size, 1)),
+			&Capture::_on_packet, reinterpret_cast<u_char*>(this));
+		if (result == PCAP_ERROR)
+			throw std::runtime_error(pcap_geterr(_sniffer->get_pcap_handle()));
+
+		if (result > 0)
+			_received_packets.fetch_add(result, std::memory_order_relaxed);
+		if (!_batch.empty()) {
+			_batch_handler(_batch);
+			_batch.clear();
+		}
+		// 0 is the timeout of a live capture but the end of a capture file
+		return result > 0 || (result == 0 && _source == Source::INTERFACE);
+	}
+
+	/*
+	** pcap callback: build the packet from the frame of the pcap buffer, the frame is only valid during the call
+	** A forwarded frame is copied from the pcap buffer to the ring without being decoded
+	*/
+	void Capture::_on_packet(u_char* user, const pcap_pkthdr* header, const u_char* data)
+	{
+		auto& capture = *reinterpret_cast<Capture*>(user);
+		// microseconds since epoch
+		auto timestamp = static_cast<int64_t>(header->ts.tv_sec) * 1000000 + header->ts.tv_usec;
+		if (capture._ring) {
+			capture._ring->push(capture._link_type, timestamp, data, header->caplen, header->len);
+			return;
+		}
+		try {
+			auto* pdu = Tins::Internals::pdu_from_dlt_flag(capture._link_type, data, header->caplen);
+			if (pdu) {
+				capture._batch.emplace_back(pdu, Tins::Timestamp(header->ts), Tins::Packet::own_pdu());
+				_record_frame(*pdu, capture._link_type, timestamp, data, header->caplen, header->len);
+			}
+		} catch (Tins::malformed_packet&) {
+			// skipped like next_packet does
+		}
+	}
+
+	/*
+	** Copy the raw frame in the flight recorder, once decoded to find its stream
+	*/
+	void Capture::_record_frame(const Tins::PDU& pdu, int link_type, int64_t timestamp, const uint8_t* data, uint32_t size,
+		uint32_t length)
+	{
+		auto& flight_recorder = trace::FlightRecorder::get_default();
+		if (flight_recorder.is_enabled())
+			flight_recorder.record(ReassemblyShard::get_flow_hash(pdu), link_type, timestamp, data, size, length);
+	}
+
+	/*
+	** Build the packets from the frames in place in the ring, the frames are released once decoded
+	** Returns false once the capture process closed the ring and all its frames are read
+	*/
+	bool Capture::_read_ring_batch()
+	{
+		auto batch_size = std::max<size_t>(_config.batch_size, 1);
+		while (_batch.size() < batch_size) {
+			auto* frame = _ring->front();
+			if (!frame)
+				break;
+			try {
+				auto* pdu = Tins::Internals::pdu_from_dlt_flag(frame->link_type, frame->data(), frame->size);
+				if (pdu) {
+					_batch.emplace_back(pdu, Tins::Timestamp(std::chrono::microseconds(frame->timestamp)),
+						Tins::Packet::own_pdu());
+					_record_frame(*pdu, frame->link_type, frame->timestamp, frame->data(), frame->size, frame->length);
+				}
+			} catch (Tins::malformed_packet&) {
+				// skipped like next_packet does
+			}
+			_ring->pop();
+		}
+
+		if (_batch.empty()) {
+			if (_ring->is_finished())
+				return false;
+			auto wake_up_latency = _ring->wait(std::chrono::milliseconds(TIMEOUT));
+			if (wake_up_latency.count() >= 0)
+				_ring_wake_up_latency->observe(wake_up_latency.count());
+			return true;
+		}
+		_received_packets.fetch_add(_batch.size(), std::memory_order_relaxed);
+		_batch_handler(_batch);
+		_batch.clear();
+		return true;
+	}
+
+	void Capture::set_filter(const std::string& filter)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex_filter);
+			_pending_filter = filter;
+			_has_pending_filter = true;
+		}
+		if (!_is_capturing)
+			_apply_pending_filter();
+	}
+
+	/*
+	** Compiled for Ethernet without an interface, the filter only tests the IP and TCP headers
+	*/
+	void Capture::check_filter(const std::string& filter)
+	{
+		auto* handle = pcap_open_dead(DLT_EN10MB, 65535);
+		if (!handle)
+			throw std::runtime_error("Can not check the filter");
+		bpf_program program;
+		bool is_compiled = pcap_compile(handle, &program, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) == 0;
+		std::string error = is_compiled ? "" : pcap_geterr(handle);
+		if (is_compiled)
+			pcap_freecode(&program);
+		pcap_close(handle);
+		if (!is_compiled)
+			throw std::invalid_argument("Invalid filter: " + error);
+	}
+
+	/*
+	** pcap_setfilter swaps the filter in the kernel at once, it is called by the thread reading the handle
+	** The previous filter is kept if the new one can't be compiled
+	*/
+	void Capture::_apply_pending_filter()
+	{
+		std::lock_guard<std::mutex> lock(_mutex_filter);
+		// the frames of a ring are filtered by the capture process
+		if (!_has_pending_filter.exchange(false) || !_sniffer)
+			return;
+		if (!_sniffer->set_filter(_pending_filter))
+			std::cout << _name << ": invalid filter " << _pending_filter << std::endl;
+	}
+
+	bool Capture::get_stats(Capture::Stats& stats)
+	{
+		if (_source == Source::RING) {
+			auto ring_stats = _ring->get_stats();
+			stats.received = ring_stats.kernel_accepted;
+			// the frames which didn't fit in the ring are lost like the frames dropped by the kernel
+			stats.kernel_drops = ring_stats.kernel_drops + ring_stats.ring_drops;
+			stats.interface_drops = ring_stats.interface_drops;
+			return true;
+		}
+		pcap_stat pcap_stats_value;
+		if (_source != Source::INTERFACE || pcap_stats(_sniffer->get_pcap_handle(), &pcap_stats_value) != 0)
+			return false;
+		stats.received = pcap_stats_value.ps_recv;
+		stats.kernel_drops = pcap_stats_value.ps_drop;
+		stats.interface_drops = pcap_stats_value.ps_ifdrop;
+		return true;
+	}
+}
@@ -0,0 +1,77 @@
+#include <stdexcept>
+#include <tins/ip_address.h>
+#include <tins/ipv6_address.h>
+#include "sniffer/http/FilterBuilder.hpp"
+
+namespace ubersniff::sniffer::http {
+	FilterBuilder::FilterBuilder(const std::vector<uint16_t>& ports) :
+		_ports(ports)
+	{
+		if (_ports.empty())
+			throw std::invalid_argument("The capture filter needs at least one port");
+	}
+
+	/*
+	** pcap rejects a network with the bits of the host set (10.1.2.3/8), the prefix must be the network address
+	*/
+	void FilterBuilder::_check_network(const std::string& network)
+	{
+		auto slash = network.find('/');
+		auto address = network.substr(0, slash);
+		bool is_ipv6 = address.find(':') != std::string::npos;
+
+		try {
+			if (is_ipv6)
+				Tins::IPv6Address{ address };
+			else
+				Tins::IPv4Address{ address };
+		} catch (std::exception&) {
+			throw std::invalid_argument("Invalid network " + network + ": invalid address");
+		}
+		if (slash == std::string::npos)
+			return;
+
+		auto prefix_length = network.substr(slash + 1);
+		if (prefix_length.empty() || prefix_length.size() > 3
+			|| prefix_length.find_first_not_of("0123456789") != std::string::npos
+			|| std::stoul(prefix_length) > (is_ipv6 ? 128u : 32u))
+			throw std::invalid_argument("Invalid network " + network + ": invalid prefix length");
+
+		auto prefix = static_cast<uint32_t>(std::stoul(prefix_length));
+		bool has_host_bits = is_ipv6
+			? !((Tins::IPv6Address(address) & Tins::IPv6Address::from_prefix_length(prefix)) == Tins::IPv6Address(address))
+			: !((Tins::IPv4Address(address) & Tins::IPv4Address::from_prefix_length(prefix)) == Tins::IPv4Address(address));
+		if (has_host_bits)
+			throw std::invalid_argument("Invalid network " + network + ": host bits set");
+	}
+
+	void FilterBuilder::set_denied_networks(const std::vector<std::string>& denied_networks)
+	{
+		for (const auto& network : denied_networks)
+			_check_network(network);
+		_denied_networks = denied_networks;
+	}
+
+	std::string FilterBuilder::build() const
+	{
+		std::string ports;
+		for (auto port : _ports)
+			ports += (ports.empty() ? "(port " : " or port ") + std::to_string(port);
+		ports += ')';
+
+		// IPv4: SYN, FIN, RST or a payload (total length - IP header - TCP header)
+		auto filter = "((ip and tcp and " + ports + " and (tcp[tcpflags] & (tcp-syn|tcp-fin|tcp-rst) != 0"
+			" or ip[2:2] - ((ip[0] & 0xf) << 2) - ((tcp[12] & 0xf0) >> 2) != 0))"
+			" or (ip6 and tcp and " + ports + "))";
+
+		if (_denied_networks.empty())
+			return filter;
+		std::string denied_networks;
+		for (const auto& network : _denied_networks) {
+			if (!denied_networks.empty())
+				denied_networks += " or ";
+			denied_networks += (network.find('/') == std::string::npos ? "host " : "net ") + network;
+		}
+		return filter + " and not (" + denied_networks + ")";
+	}
+}
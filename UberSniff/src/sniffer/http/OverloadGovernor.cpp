@@ -0,0 +1,63 @@
+#include "sniffer/http/OverloadGovernor.hpp"
+
+namespace ubersniff::sniffer::http {
+	OverloadGovernor::OverloadGovernor(const OverloadGovernor::Config& config) :
+		_config(config),
+		_mode(Mode::NORMAL),
+		_calm_intervals(0),
+		_dropped_packets(0),
+		_mode_gauge(metrics::Registry::get_default().gauge("ubersniff_overload_mode",
+			"Overload mode: 0 normal, 1 header only, 2 sampling of the streams")),
+		_escalations(metrics::Registry::get_default().counter("ubersniff_overload_mode_changes_total{direction=\"escalation\"}",
+			"Changes of the overload mode")),
+		_recoveries(metrics::Registry::get_default().counter("ubersniff_overload_mode_changes_total{direction=\"recovery\"}",
+			"Changes of the overload mode")),
+		_sampled_out_flows(metrics::Registry::get_default().counter("ubersniff_overload_sampled_out_flows_total",
+			"New streams not followed in sampling mode"))
+	{
+		_mode_gauge.set(static_cast<int64_t>(get_mode()));
+	}
+
+	void OverloadGovernor::_set_mode(Mode mode) noexcept
+	{
+		if (mode > get_mode())
+			_escalations.inc();
+		else
+			_recoveries.inc();
+		_mode = mode;
+		_calm_intervals = 0;
+		_mode_gauge.set(static_cast<int64_t>(mode));
+	}
+
+	bool OverloadGovernor::update(size_t queue_depth, uint64_t dropped_packets) noexcept
+	{
+		bool has_dropped = dropped_packets > _dropped_packets;
+		_dropped_packets = dropped_packets;
+
+		if (has_dropped || queue_depth > _config.high_queue_depth) {
+			// one more level at each interval under pressure
+			_calm_intervals = 0;
+			if (get_mode() == Mode::SAMPLING)
+				return false;
+			_set_mode(static_cast<Mode>(static_cast<int>(get_mode()) + 1));
+			return true;
+		}
+		if (queue_depth >= _config.low_queue_depth) {
+			// between the thresholds: keep the mode
+			_calm_intervals = 0;
+			return false;
+		}
+		if (get_mode() == Mode::NORMAL || ++_calm_intervals < _config.recovery_intervals)
+			return false;
+		_set_mode(static_cast<Mode>(static_cast<int>(get_mode()) - 1));
+		return true;
+	}
+
+	bool OverloadGovernor::is_admitted(uint64_t flow_hash) noexcept
+	{
+		if (get_mode() != Mode::SAMPLING || (flow_hash >> 32) % _config.sampling_ratio == 0)
+			return true;
+		_sampled_out_flows.inc();
+		return false;
+	}
+}
@@ -2,23 +2,91 @@
 #include "sniffer/http/PacketReassembler.hpp"
 
 namespace ubersniff::sniffer::http {
-	PacketReassembler::PacketReassembler(Tins::TCPIP::Stream& stream, collector::DataCollector& data_collector):
-		_http_reassembler(data_collector, "http://")
+	PacketReassembler::PacketReassembler(Tins::TCPIP::Stream& stream, const std::chrono::microseconds& packet_timestamp,
+		packet::HTTPReassemblerPool& http_reassembler_pool, ReassemblyBudget& reassembly_budget):
+		_stream(stream),
+		_packet_timestamp(packet_timestamp),
+		_http_reassembler_pool(http_reassembler_pool),
+		_reassembly_budget(reassembly_budget)
 	{
+		_reassembly_budget.touch(*this);
 		stream.client_data_callback(std::bind(&PacketReassembler::_on_client_data, this, std::placeholders::_1));
 		stream.server_data_callback(std::bind(&PacketReassembler::_on_server_data, this, std::placeholders::_1));
 	}
 
 	PacketReassembler::~PacketReassembler()
-	{}
+	{
+		_reassembly_budget.remove(*this);
+		_http_reassembler_pool.release(std::move(_http_reassembler));
+	}
+
+	size_t PacketReassembler::get_buffered_size() const noexcept
+	{
+		size_t buffered_size = _stream.client_flow().total_buffered_bytes() + _stream.server_flow().total_buffered_bytes();
+		if (_http_reassembler)
+			buffered_size += _http_reassembler->get_buffered_size();
+		return buffered_size;
+	}
+
+	void PacketReassembler::set_header_only()
+	{
+		_is_header_only = true;
+		if (_http_reassembler) {
+			_http_reassembler->set_header_only();
+			_release_idle_http_reassembler();
+		}
+	}
+
+	void PacketReassembler::finish()
+	{
+		if (!_http_reassembler)
+			return;
+		_http_reassembler->finish();
+		_release_idle_http_reassembler();
+	}
+
+	PacketReassembler::State PacketReassembler::get_state() const noexcept
+	{
+		auto is_closing = [](const Tins::TCPIP::Flow& flow) {
+			return flow.state() == Tins::TCPIP::Flow::FIN_SENT || flow.state() == Tins::TCPIP::Flow::RST_SENT;
+		};
+
+		if (is_closing(_stream.client_flow()) || is_closing(_stream.server_flow()))
+			return State::CLOSING;
+		if (_http_reassembler)
+			return State::ACTIVE;
+		return _has_data ? State::IDLE : State::HANDSHAKE;
+	}
+
+	packet::HTTPReassembler& PacketReassembler::_get_http_reassembler()
+	{
+		_has_data = true;
+		if (!_http_reassembler) {
+			_http_reassembler = _http_reassembler_pool.acquire();
+			if (_is_header_only)
+				_http_reassembler->set_header_only();
+		}
+		return *_http_reassembler;
+	}
+
+	/*
+	** Give back the reassembler between two exchanges
+	*/
+	void PacketReassembler::_release_idle_http_reassembler() noexcept
+	{
+		if (_http_reassembler->is_idle())
+			_http_reassembler_pool.release(std::move(_http_reassembler));
+	}
 
 	void PacketReassembler::_on_client_data(Tins::TCPIP::Stream& stream)
 	{
-		_http_reassembler.push_client_payload(stream.client_payload());
+		_get_http_reassembler().push_client_payload(stream.client_payload(), _packet_timestamp);
+		_release_idle_http_reassembler();
 	}
 
 	void PacketReassembler::_on_server_data(Tins::TCPIP::Stream& stream)
 	{
-		_http_reassembler.push_server_payload(stream.server_payload());
+		_get_http_reassembler().push_server_payload(stream.server_payload(), _packet_timestamp);
+		_release_idle_http_reassembler();
 	}
 }
@@ -0,0 +1,48 @@
+#include "sniffer/http/PacketReassembler.hpp"
+#include "sniffer/http/ReassemblyBudget.hpp"
+
+namespace ubersniff::sniffer::http {
+	ReassemblyBudget::ReassemblyBudget() noexcept :
+		_size(0),
+		_least_recent(nullptr),
+		_most_recent(nullptr)
+	{}
+
+	void ReassemblyBudget::_unlink(PacketReassembler& packet_reassembler) noexcept
+	{
+		auto* previous = packet_reassembler._less_recent;
+		auto* next = packet_reassembler._more_recent;
+
+		(previous ? previous->_more_recent : _least_recent) = next;
+		(next ? next->_less_recent : _most_recent) = previous;
+		packet_reassembler._less_recent = nullptr;
+		packet_reassembler._more_recent = nullptr;
+	}
+
+	void ReassemblyBudget::touch(PacketReassembler& packet_reassembler) noexcept
+	{
+		if (_most_recent == &packet_reassembler)
+			return;
+		if (packet_reassembler._more_recent)
+			_unlink(packet_reassembler);
+
+		packet_reassembler._less_recent = _most_recent;
+		(_most_recent ? _most_recent->_more_recent : _least_recent) = &packet_reassembler;
+		_most_recent = &packet_reassembler;
+	}
+
+	void ReassemblyBudget::update(PacketReassembler& packet_reassembler) noexcept
+	{
+		auto buffered_size = packet_reassembler.get_buffered_size();
+		_size = _size + buffered_size - packet_reassembler._accounted_size;
+		packet_reassembler._accounted_size = buffered_size;
+	}
+
+	void ReassemblyBudget::remove(PacketReassembler& packet_reassembler) noexcept
+	{
+		if (_least_recent == &packet_reassembler || packet_reassembler._less_recent)
+			_unlink(packet_reassembler);
+		_size -= packet_reassembler._accounted_size;
+		packet_reassembler._accounted_size = 0;
+	}
+}
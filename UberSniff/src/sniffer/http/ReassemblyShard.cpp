@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <tins/tcp.h>
+#include "sniffer/http/ReassemblyShard.hpp"
+#include "trace/FlightRecorder.hpp"
+
+namespace ubersniff::sniffer::http {
+	ReassemblyShard::ReassemblyShard(collector::DataCollector& data_collector, const ReassemblyShard::Config& config,
+		OverloadGovernor& overload_governor, size_t max_queued_packets, bool is_replay) :
+		_config(config),
+		_overload_governor(overload_governor),
+		_is_replay(is_replay),
+		_max_queued_packets(max_queued_packets),
+		_stream_follower(),
+		_http_reassembler_pool(data_collector, "http://", MAX_IDLE_HTTP_REASSEMBLERS),
+		_reassembly_budget(),
+		_packet_reassemblers(),
+		_flow_timers(TIMER_RESOLUTION),
+		_packet_timestamp(0),
+		_packet_time(0),
+		_reported_buffered_size(0),
+		_pending_packets(0),
+		_is_header_only_requested(false),
+		_drain_deadline(),
+		_is_running(false),
+		_metrics({
+			metrics::Registry::get_default().gauge("ubersniff_flows", "TCP streams followed"),
+			metrics::Registry::get_default().counter("ubersniff_flows_opened_total", "TCP streams opened"),
+			metrics::Registry::get_default().counter("ubersniff_flows_closed_total", "TCP streams closed properly"),
+			metrics::Registry::get_default().counter("ubersniff_flows_evicted_total{reason=\"timeout\"}",
+				"TCP streams evicted before they closed, by reason"),
+			metrics::Registry::get_default().counter("ubersniff_flows_evicted_total{reason=\"buffered_data\"}",
+				"TCP streams evicted before they closed, by reason"),
+			metrics::Registry::get_default().counter("ubersniff_flows_evicted_total{reason=\"sacked_segments\"}",
+				"TCP streams evicted before they closed, by reason"),
+			metrics::Registry::get_default().counter("ubersniff_flows_evicted_total{reason=\"handshake_timeout\"}",
+				"TCP streams evicted before they closed, by reason"),
+			metrics::Registry::get_default().counter("ubersniff_flows_evicted_total{reason=\"active_timeout\"}",
+				"TCP streams evicted before they closed, by reason"),
+			metrics::Registry::get_default().counter("ubersniff_flows_evicted_total{reason=\"idle_timeout\"}",
+				"TCP streams evicted before they closed, by reason"),
+			metrics::Registry::get_default().counter("ubersniff_flows_evicted_total{reason=\"closing_timeout\"}",
+				"TCP streams evicted before they closed, by reason"),
+			metrics::Registry::get_default().gauge("ubersniff_reassembly_buffered_bytes",
+				"Bytes buffered by the reassembly of the streams"),
+			metrics::Registry::get_default().counter("ubersniff_reassembly_header_only_total",
+				"Streams switched to header only mode to respect the reassembly budget"),
+			metrics::Registry::get_default().counter("ubersniff_flows_evicted_total{reason=\"budget\"}",
+				"TCP streams evicted before they closed, by reason"),
+			metrics::Registry::get_default().counter("ubersniff_flows_evicted_total{reason=\"flow_cap\"}",
+				"TCP streams evicted before they closed, by reason"),
+			metrics::Registry::get_default().histogram("ubersniff_capture_packet_processing_nanoseconds",
+				"Reassembly time of a packet (replay only)")
+		})
+	{
+		_init_stream_follower();
+	}
+
+	ReassemblyShard::~ReassemblyShard()
+	{
+		stop();
+	}
+
+	void ReassemblyShard::_init_stream_follower()
+	{
+		_stream_follower.new_stream_callback(std::bind(&ReassemblyShard::_on_new_connection, this, std::placeholders::_1));
+		// erase PacketReassembler when the stream closed with an error
+		_stream_follower.stream_termination_callback(std::bind(&ReassemblyShard::_on_connection_terminated, this,
+			std::placeholders::_1, std::placeholders::_2));
+		// the streams are expired by the flow timers, the stream follower only forgets the streams expired
+		_stream_follower.stream_keep_alive(std::max({ _config.handshake_timeout, _config.active_timeout,
+			_config.idle_timeout, _config.closing_timeout }));
+	}
+
+	void ReassemblyShard::start()
+	{
+		if (_is_running)
+			return;
+		_is_running = true;
+		_reassembly_thread = std::thread(&ReassemblyShard::_reassemble, this);
+	}
+
+	void ReassemblyShard::stop(std::chrono::steady_clock::time_point drain_deadline)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex_packets);
+			if (_is_running)
+				_drain_deadline = drain_deadline;
+			_is_running = false;
+		}
+		_packets_condition.notify_all();
+		_space_condition.notify_all();
+		if (_reassembly_thread.joinable())
+			_reassembly_thread.join();
+
+		std::lock_guard<std::mutex> lock(_mutex_packets);
+		_pending_packets -= _packets.size();
+		_packets.clear();
+	}
+
+	size_t ReassemblyShard::push_packets(std::vector<Tins::Packet>& packets)
+	{
+		size_t pushed_packets = 0;
+		{
+			std::unique_lock<std::mutex> lock(_mutex_packets);
+			while (pushed_packets < packets.size()) {
+				if (_packets.size() >= _max_queued_packets) {
+					if (!_is_replay)
+						break;
+					// let the reassembly thread take the packets already published
+					_packets_condition.notify_one();
+					_space_condition.wait(lock, [this]() { return _packets.size() < _max_queued_packets || !_is_running; });
+				}
+				if (!_is_running)
+					break;
+				auto count = std::min(packets.size() - pushed_packets, _max_queued_packets - _packets.size());
+				std::move(packets.begin() + pushed_packets, packets.begin() + pushed_packets + count,
+					std::back_inserter(_packets));
+				pushed_packets += count;
+				_pending_packets += count;
+			}
+		}
+		if (pushed_packets)
+			_packets_condition.notify_one();
+		return pushed_packets;
+	}
+
+	uint64_t ReassemblyShard::get_flow_hash(const Tins::PDU& pdu) noexcept
+	{
+		if (!pdu.find_pdu<Tins::TCP>())
+			return 0;
+		try {
+			return decltype(_packet_reassemblers)::get_hash(Tins::TCPIP::StreamIdentifier::make_identifier(pdu));
+		} catch (std::exception&) {
+			// not an IP packet
+			return 0;
+		}
+	}
+
+	timing::Clock::TimePoint ReassemblyShard::get_packet_time() const noexcept
+	{
+		return timing::Clock::get_default().at(std::chrono::microseconds(_packet_time.load(std::memory_order_acquire)));
+	}
+
+	void ReassemblyShard::request_header_only() noexcept
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex_packets);
+			_is_header_only_requested = true;
+		}
+		_packets_condition.notify_one();
+	}
+
+	/*
+	** Take the packets published by batch and reassemble them
+	** On stop, the last packets are reassembled and the streams are completed until the drain deadline
+	*/
+	void ReassemblyShard::_reassemble()
+	{
+		std::vector<Tins::Packet> packets;
+		bool is_stopping = false;
+		std::chrono::steady_clock::time_point drain_deadline;
+
+		while (!is_stopping) {
+			{
+				std::unique_lock<std::mutex> lock(_mutex_packets);
+				_packets_condition.wait(lock, [this]() {
+					return !_packets.empty() || _is_header_only_requested || !_is_running;
+				});
+				is_stopping = !_is_running;
+				drain_deadline = _drain_deadline;
+				std::swap(packets, _packets);
+			}
+			_space_condition.notify_all();
+
+			if (_is_header_only_requested.exchange(false))
+				_switch_to_header_only();
+			for (auto& packet : packets) {
+				if (is_stopping && std::chrono::steady_clock::now() >= drain_deadline)
+					break;
+				try {
+					if (_is_replay) {
+						auto started_at = std::chrono::steady_clock::now();
+						_follow_packet(packet);
+						_metrics.packet_processing.observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+							std::chrono::steady_clock::now() - started_at).count());
+					} else {
+						_follow_packet(packet);
+					}
+				} catch (std::exception& e) {
+					std::cout << e.what() << std::endl;
+				}
+			}
+			_pending_packets -= packets.size();
+			packets.clear();
+		}
+
+		// the streams won't receive more data: send the responses in progress
+		if (std::chrono::steady_clock::now() < drain_deadline) {
+			_packet_reassemblers.for_each([](std::unique_ptr<PacketReassembler>& packet_reassembler) {
+				packet_reassembler->finish();
+			});
+		}
+
+		// clear buffers
+		_metrics.flows.dec(_packet_reassemblers.size());
+		_packet_reassemblers.clear();
+		_update_buffered_bytes();
+	}
+
+	void ReassemblyShard::_on_new_connection(Tins::TCPIP::Stream& stream)
+	{
+		auto stream_id = Tins::TCPIP::StreamIdentifier::make_identifier(stream);
+		// the stream is not followed when it is not sampled, its data is not buffered (a replay follows all the streams)
+		auto flow_hash = decltype(_packet_reassemblers)::get_hash(stream_id);
+		if (!_is_replay && !_overload_governor.is_admitted(flow_hash)) {
+			stream.ignore_client_data();
+			stream.ignore_server_data();
+			trace::FlightRecorder::get_default().ignore_flow(flow_hash);
+			return;
+		}
+		trace::FlightRecorder::get_default().follow_flow(flow_hash);
+
+		auto& packet_reassembler = _packet_reassemblers.insert(stream_id,
+			std::unique_ptr<PacketReassembler>(new PacketReassembler(stream, _packet_timestamp, _http_reassembler_pool, _reassembly_budget)));
+		if (_overload_governor.get_mode() != OverloadGovernor::Mode::NORMAL)
+			packet_reassembler->set_header_only();
+		_flow_timers.schedule(*packet_reassembler, _get_flow_timeout(*packet_reassembler));
+		_metrics.opened_flows.inc();
+		_metrics.flows.inc();
+
+		// erase PacketReassembler when the stream closed properly
+		stream.stream_closed_callback([&](Tins::TCPIP::Stream& stream) {
+			if (_erase_flow(Tins::TCPIP::StreamIdentifier::make_identifier(stream)))
+				_metrics.closed_flows.inc();
+		});
+	}
+
+	void ReassemblyShard::_on_connection_terminated(Tins::TCPIP::Stream& stream,
+		Tins::TCPIP::StreamFollower::TerminationReason reason)
+	{
+		// the streams already forgotten by the flow timers, the budget or the cap, or sampled out, are counted already
+		if (!_erase_flow(Tins::TCPIP::StreamIdentifier::make_identifier(stream)))
+			return;
+
+		switch (reason) {
+		case Tins::TCPIP::StreamFollower::TIMEOUT:
+			_metrics.timeout_evictions.inc();
+			break;
+		case Tins::TCPIP::StreamFollower::BUFFERED_DATA:
+			_metrics.buffered_data_evictions.inc();
+			break;
+		case Tins::TCPIP::StreamFollower::SACKED_SEGMENTS:
+			_metrics.sacked_segments_evictions.inc();
+			break;
+		}
+	}
+
+	bool ReassemblyShard::_erase_flow(const Tins::TCPIP::StreamIdentifier& stream_id)
+	{
+		if (!_packet_reassemblers.erase(stream_id))
+			return false;
+		_metrics.flows.dec();
+		return true;
+	}
+
+	std::chrono::milliseconds ReassemblyShard::_get_flow_timeout(const PacketReassembler& packet_reassembler) const noexcept
+	{
+		switch (packet_reassembler.get_state()) {
+		case PacketReassembler::State::HANDSHAKE:
+			return _config.handshake_timeout;
+		case PacketReassembler::State::ACTIVE:
+			return _config.active_timeout;
+		case PacketReassembler::State::IDLE:
+			return _config.idle_timeout;
+		default:
+			return _config.closing_timeout;
+		}
+	}
+
+	/*
+	** Forget a stream inactive for longer than the timeout of its state
+	** The stream follower keeps the stream until its keep alive, without following or buffering its data
+	*/
+	void ReassemblyShard::_on_flow_expired(TimerWheel::Timer& timer)
+	{
+		auto& packet_reassembler = static_cast<PacketReassembler&>(timer);
+
+		switch (packet_reassembler.get_state()) {
+		case PacketReassembler::State::HANDSHAKE:
+			_metrics.handshake_expirations.inc();
+			break;
+		case PacketReassembler::State::ACTIVE:
+			_metrics.active_expirations.inc();
+			break;
+		case PacketReassembler::State::IDLE:
+			_metrics.idle_expirations.inc();
+			break;
+		case PacketReassembler::State::CLOSING:
+			_metrics.closing_expirations.inc();
+			break;
+		}
+		_forget_flow(packet_reassembler);
+	}
+
+	/*
+	** Skip the flow past its out of order data: the data tracker of libtins frees the chunks skipped
+	*/
+	static void release_flow_buffers(Tins::TCPIP::Flow& flow)
+	{
+		auto end = flow.sequence_number();
+		for (auto& chunk : flow.buffered_payload()) {
+			auto chunk_end = chunk.first + static_cast<uint32_t>(chunk.second.size());
+			if (static_cast<int32_t>(chunk_end - end) > 0)
+				end = chunk_end;
+		}
+		flow.advance_sequence(end);
+		Tins::TCPIP::Flow::payload_type().swap(flow.payload());
+	}
+
+	void ReassemblyShard::_forget_flow(PacketReassembler& packet_reassembler)
+	{
+		auto& stream = packet_reassembler.get_stream();
+
+		auto stream_id = Tins::TCPIP::StreamIdentifier::make_identifier(stream);
+		stream.ignore_client_data();
+		stream.ignore_server_data();
+		// the stream follower keeps the stream until its keep alive, without its buffers
+		release_flow_buffers(stream.client_flow());
+		release_flow_buffers(stream.server_flow());
+		trace::FlightRecorder::get_default().ignore_flow(decltype(_packet_reassemblers)::get_hash(stream_id));
+		_erase_flow(stream_id);
+	}
+
+	/*
+	** A stream buffering more than its cap stops the reassembly of the bodies,
+	**  it is forgotten if the out of order data of the stream still exceed the cap
+	*/
+	void ReassemblyShard::_enforce_flow_cap(PacketReassembler& packet_reassembler)
+	{
+		if (!packet_reassembler.is_header_only()) {
+			packet_reassembler.set_header_only();
+			_reassembly_budget.update(packet_reassembler);
+			_metrics.header_only_downgrades.inc();
+		}
+		if (packet_reassembler.get_buffered_size() > _config.max_flow_buffered_size) {
+			_metrics.flow_cap_evictions.inc();
+			_forget_flow(packet_reassembler);
+		}
+	}
+
+	/*
+	** Release the buffers of the least recently active streams until 90% of the budget is used
+	** A stream is first switched to header only mode, then forgotten when it is reached again
+	*/
+	void ReassemblyShard::_enforce_budget()
+	{
+		auto low_watermark = _config.max_buffered_size / 10 * 9;
+
+		while (_reassembly_budget.size() > low_watermark) {
+			auto* packet_reassembler = _reassembly_budget.get_least_recent();
+			if (!packet_reassembler)
+				break;
+
+			if (!packet_reassembler->is_header_only()) {
+				packet_reassembler->set_header_only();
+				_reassembly_budget.update(*packet_reassembler);
+				_reassembly_budget.touch(*packet_reassembler);
+				_metrics.header_only_downgrades.inc();
+			} else {
+				_metrics.budget_evictions.inc();
+				_forget_flow(*packet_reassembler);
+			}
+		}
+	}
+
+	/*
+	** The streams followed stop the reassembly of the bodies when the overload governor leaves the normal mode,
+	**  they stay in header only mode when it comes back
+	*/
+	void ReassemblyShard::_switch_to_header_only()
+	{
+		_packet_reassemblers.for_each([this](std::unique_ptr<PacketReassembler>& packet_reassembler) {
+			if (packet_reassembler->is_header_only())
+				return;
+			packet_reassembler->set_header_only();
+			_reassembly_budget.update(*packet_reassembler);
+			_metrics.header_only_downgrades.inc();
+		});
+		_update_buffered_bytes();
+	}
+
+	void ReassemblyShard::_update_buffered_bytes() noexcept
+	{
+		auto buffered_size = _reassembly_budget.size();
+		_metrics.buffered_bytes.inc(static_cast<int64_t>(buffered_size) - static_cast<int64_t>(_reported_buffered_size));
+		_reported_buffered_size = buffered_size;
+	}
+
+	/*
+	** Expire the inactive streams, then reassemble the packet and refresh the timer of its stream
+	** The time of the timers is the time of the packets, so a replay expires the streams like the live capture
+	*/
+	void ReassemblyShard::_follow_packet(Tins::Packet& packet)
+	{
+		// the exchanges completed by the packet are stamped with its time
+		_packet_timestamp = std::chrono::microseconds(packet.timestamp());
+		_packet_time.store(_packet_timestamp.count(), std::memory_order_release);
+		timing::Clock::get_default().advance(_packet_timestamp);
+		// the wheel is at the time of the packet before the new streams of the packet are scheduled
+		auto now = std::chrono::duration_cast<TimerWheel::Duration>(_packet_timestamp);
+		_flow_timers.advance(now, [this](TimerWheel::Timer& timer) { _on_flow_expired(timer); });
+		_stream_follower.process_packet(packet);
+
+		auto* pdu = packet.pdu();
+		if (pdu->find_pdu<Tins::TCP>()) {
+			auto* packet_reassembler = _packet_reassemblers.find(Tins::TCPIP::StreamIdentifier::make_identifier(*pdu));
+			if (packet_reassembler) {
+				auto& flow = **packet_reassembler;
+				_flow_timers.schedule(flow, _get_flow_timeout(flow));
+				_reassembly_budget.touch(flow);
+				_reassembly_budget.update(flow);
+				if (flow.get_buffered_size() > _config.max_flow_buffered_size)
+					_enforce_flow_cap(flow);
+			}
+		}
+		if (_reassembly_budget.size() > _config.max_buffered_size)
+			_enforce_budget();
+		_update_buffered_bytes();
+	}
+}
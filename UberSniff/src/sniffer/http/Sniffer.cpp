@@ -1,101 +1,460 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
-#include <pcap.h>
+#include <set>
+#include <tins/network_interface.h>
 #include "sniffer/http/Sniffer.hpp"
 
 namespace ubersniff::sniffer::http {
-	Sniffer::Sniffer(const std::string& interface_name, collector::DataCollector& data_collector) :
+	Sniffer::Sniffer(const std::string& source_name, collector::DataCollector& data_collector, const Sniffer::Config& config,
+		Source source) :
+		Sniffer(source_name, &data_collector, nullptr, config, source)
+	{}
+
+	Sniffer::Sniffer(ipc::FrameRing& input_ring, collector::DataCollector& data_collector, const Sniffer::Config& config) :
+		Sniffer("frame ring", &data_collector, &input_ring, config, Source::RING)
+	{}
+
+	Sniffer::Sniffer(const std::string& source_name, ipc::FrameRing& output_ring, const Sniffer::Config& config) :
+		Sniffer(source_name, nullptr, &output_ring, config, Source::INTERFACE)
+	{}
+
+	Sniffer::Sniffer(const std::string& source_name, collector::DataCollector* data_collector, ipc::FrameRing* ring,
+		const Sniffer::Config& config, Source source) :
 		_data_collector(data_collector),
-		_sniffer_config(),
-		_sniffer(interface_name,
-			(_sniffer_config.set_filter("tcp port 80"),
-				_sniffer_config.set_timeout(TIMEOUT),
-				_sniffer_config.set_immediate_mode(true),
-				_sniffer_config.set_promisc_mode(true),
-				_sniffer_config)),
-		_stream_follower()
+		_ring(ring),
+		_config(config),
+		_source(source),
+		_source_name(source_name),
+		_overload_governor(config.overload),
+		_filter_builder(config.ports),
+		_is_sniffing(false),
+		_metrics({
+			metrics::Registry::get_default().counter("ubersniff_capture_packets_total", "Packets processed in user space"),
+			metrics::Registry::get_default().counter("ubersniff_capture_bytes_total", "Bytes captured"),
+			metrics::Registry::get_default().gauge("ubersniff_capture_kernel_accepted_packets",
+				"Packets accepted by the capture filters in the kernel (pcap_stats)"),
+			metrics::Registry::get_default().gauge("ubersniff_capture_dropped_packets{source=\"kernel\"}",
+				"Packets dropped before the capture (pcap_stats)"),
+			metrics::Registry::get_default().gauge("ubersniff_capture_dropped_packets{source=\"interface\"}",
+				"Packets dropped before the capture (pcap_stats)"),
+			metrics::Registry::get_default().counter("ubersniff_capture_queue_dropped_packets_total",
+				"Packets dropped because a reassembly thread is late"),
+			metrics::Registry::get_default().gauge("ubersniff_capture_interfaces", "Interfaces captured"),
+			metrics::Registry::get_default().counter("ubersniff_capture_interface_switches_total",
+				"Changes of the default interface captured"),
+			metrics::Registry::get_default().gauge("ubersniff_reassembly_max_buffered_bytes",
+				"Budget of the bytes buffered by the reassembly of the streams")
+		})
 	{
-		_stream_follower.new_stream_callback(std::bind(&Sniffer::_on_new_connection, this, std::placeholders::_1));
+		// the budget is split between the reassembly threads, the capture process forwarding to a ring has none
+		if (_data_collector) {
+			auto shard_config = _config.reassembly;
+			auto nb_shards = std::max<size_t>(_config.reassembly_threads, 1);
+			shard_config.max_buffered_size /= nb_shards;
+			for (size_t i = 0; i < nb_shards; ++i) {
+				_shards.push_back(std::make_unique<ReassemblyShard>(*_data_collector, shard_config, _overload_governor,
+					_config.max_queued_packets, _source == Source::FILE));
+			}
+		}
+		_metrics.max_buffered_bytes.set(_config.reassembly.max_buffered_size);
+
+		_filter_builder.set_denied_networks(_config.denied_networks);
+		_filter = _filter_builder.build();
+		if (_source != Source::RING && !_config.deny_list_file.empty())
+			_reload_deny_list();
+
+		// the configured interfaces are captured when they are found
+		if (_source != Source::INTERFACE || _config.interfaces.empty()) {
+			_captures[_source_name] = _make_capture(_source_name);
+			_metrics.interfaces.set(_captures.size());
+		}
 	}
 
 	Sniffer::~Sniffer()
 	{
 		// stop the sniffer if it is running
-		if (_is_sniffing) {
-			_is_sniffing = false;
-			_sniffer_thread.join();
+		stop_sniffing();
+	}
+
+	/*
+	** Give each packet of a batch to the shard of its stream, called by the capture threads
+	** The packets are grouped by shard so each shard is published to once per batch
+	*/
+	void Sniffer::_dispatch_packets(std::vector<Tins::Packet>& packets)
+	{
+		size_t bytes = 0;
+		for (const auto& packet : packets)
+			bytes += packet.pdu()->size();
+		_metrics.packets.inc(packets.size());
+		_metrics.bytes.inc(bytes);
+
+		if (_shards.size() == 1) {
+			_metrics.queue_drops.inc(packets.size() - _shards.front()->push_packets(packets));
+			return;
+		}
+
+		// the groups of the capture thread, kept between the batches to keep their capacity
+		thread_local std::vector<std::vector<Tins::Packet>> shard_packets;
+		shard_packets.resize(_shards.size());
+		for (auto& packet : packets) {
+			// the high bits pick the shard: the low bits index the flow table of the shard,
+			//  they would be the same for all the flows of a shard
+			auto shard_index = (ReassemblyShard::get_flow_hash(*packet.pdu()) >> 48) % _shards.size();
+			shard_packets[shard_index].push_back(std::move(packet));
+		}
+		for (size_t shard_index = 0; shard_index < _shards.size(); ++shard_index) {
+			auto& group = shard_packets[shard_index];
+			if (group.empty())
+				continue;
+			_metrics.queue_drops.inc(group.size() - _shards[shard_index]->push_packets(group));
+			group.clear();
 		}
 	}
 
-	void Sniffer::_on_new_connection(Tins::TCPIP::Stream& stream)
+	std::unique_ptr<Capture> Sniffer::_make_capture(const std::string& name)
 	{
-		auto stream_id = Tins::TCPIP::StreamIdentifier::make_identifier(stream);
-		_packet_reassemblers[stream_id] = std::unique_ptr<PacketReassembler>(new PacketReassembler(stream, _data_collector));
+		std::string filter;
+		{
+			std::lock_guard<std::mutex> lock(_mutex_filter);
+			filter = _filter;
+		}
+		auto batch_handler = [this](std::vector<Tins::Packet>& packets) { _dispatch_packets(packets); };
+		if (_source == Source::RING)
+			return std::make_unique<Capture>(*_ring, _config.capture, batch_handler);
 
-		// erase PacketReassembler when the stream closed properly
-		stream.stream_closed_callback([&](Tins::TCPIP::Stream& stream) {
-			_packet_reassemblers.erase(Tins::TCPIP::StreamIdentifier::make_identifier(stream));
-		});
-		// erase PacketReassembler when the stream closed with an error
-		_stream_follower.stream_termination_callback([&](Tins::TCPIP::Stream& stream, Tins::TCPIP::StreamFollower::TerminationReason) {
-			_packet_reassemblers.erase(Tins::TCPIP::StreamIdentifier::make_identifier(stream));
-		});
+		auto capture = std::make_unique<Capture>(name, _source, _config.capture, filter, batch_handler);
+		if (!_data_collector)
+			capture->forward_to(*_ring);
+		return capture;
 	}
 
-	void Sniffer::start_sniffing()
+	void Sniffer::set_denied_networks(const std::vector<std::string>& denied_networks)
 	{
-		if (_is_sniffing) {
-			return;
+		std::string filter;
+		{
+			std::lock_guard<std::mutex> lock(_mutex_filter);
+			auto filter_builder = _filter_builder;
+			filter_builder.set_denied_networks(denied_networks);
+			filter = filter_builder.build();
+			// the filter in place is kept for the next captures if pcap can't compile the new one
+			Capture::check_filter(filter);
+			_filter_builder = std::move(filter_builder);
+			_filter = filter;
 		}
 
-		_is_sniffing = true;
-		// run the sniffer in other thread
-		_sniffer_thread = std::thread([&]() {
-			try {
-#ifdef _WIN32 // get pcap event handler of the sniffer for windows
-				auto event_h = pcap_getevent(_sniffer.get_pcap_handle());
-#endif // _WIN32
-				while (_is_sniffing) {
-#ifdef _WIN32 // Set timeout for the sniffer for windows
-					if (WaitForSingleObject(event_h, (DWORD)TIMEOUT) == WAIT_OBJECT_0) {
+		std::lock_guard<std::mutex> lock(_mutex_captures);
+		for (auto& capture : _captures)
+			capture.second->set_filter(filter);
+	}
+
+	/*
+	** Read the deny list file when it changed, one network per line, # starts a comment
+	** The list in place is kept if the file can't be read or contains an invalid network
+	*/
+	void Sniffer::_reload_deny_list()
+	{
+		try {
+			auto write_time = std::filesystem::last_write_time(_config.deny_list_file);
+			if (write_time == _deny_list_write_time)
+				return;
+			_deny_list_write_time = write_time;
+
+			std::ifstream file(_config.deny_list_file);
+			if (!file)
+				throw std::runtime_error("Can not open the file");
+			// the networks of the configuration are always denied
+			auto denied_networks = _config.denied_networks;
+			std::string line;
+			while (std::getline(file, line)) {
+				line = line.substr(0, line.find('#'));
+				auto begin = line.find_first_not_of(" \t\r");
+				if (begin == std::string::npos)
+					continue;
+				auto end = line.find_last_not_of(" \t\r");
+				denied_networks.push_back(line.substr(begin, end - begin + 1));
+			}
+			set_denied_networks(denied_networks);
+			std::cout << "Deny list loaded: " << denied_networks.size() << " networks" << std::endl;
+		} catch (std::exception& e) {
+			std::cout << _config.deny_list_file << ": " << e.what() << std::endl;
+		}
+	}
+
+	/*
+	** Open the capture of an interface, called with _mutex_captures locked
+	** An interface which can't be opened is tried again at the next refresh
+	*/
+	void Sniffer::_add_capture(const std::string& name)
+	{
+		try {
+			auto capture = _make_capture(name);
+			if (_is_sniffing)
+				capture->start();
+			_captures[name] = std::move(capture);
+			std::cout << "Capture on interface " << name << std::endl;
+		} catch (std::exception& e) {
+			std::cout << name << ": " << e.what() << std::endl;
+		}
+	}
+
+	/*
+	** Glob matching, * matches any sequence of characters and ? one character
+	*/
+	bool Sniffer::match_pattern(const std::string& pattern, const std::string& name) noexcept
+	{
+		size_t pattern_index = 0;
+		size_t name_index = 0;
+		// position after the last * and the character of the name it is matched with
+		size_t star_index = std::string::npos;
+		size_t star_name_index = 0;
+
+		while (name_index < name.size()) {
+			if (pattern_index < pattern.size() && (pattern[pattern_index] == '?' || pattern[pattern_index] == name[name_index])) {
+				++pattern_index;
+				++name_index;
+			} else if (pattern_index < pattern.size() && pattern[pattern_index] == '*') {
+				star_index = ++pattern_index;
+				star_name_index = name_index;
+			} else if (star_index != std::string::npos) {
+				// the last * matches one more character
+				pattern_index = star_index;
+				name_index = ++star_name_index;
+			} else {
+				return false;
+			}
+		}
+		while (pattern_index < pattern.size() && pattern[pattern_index] == '*')
+			++pattern_index;
+		return pattern_index == pattern.size();
+	}
+
+	/*
+	** Capture the interfaces up matching the configuration and stop the captures of the interfaces gone
+	** The captures of the other interfaces and the streams are not touched
+	*/
+	void Sniffer::_refresh_interfaces()
+	{
+		std::set<std::string> names;
+		try {
+			for (const auto& network_interface : Tins::NetworkInterface::all()) {
+				if (!network_interface.is_up())
+					continue;
+				auto name = network_interface.name();
+				std::vector<std::string> aliases = { name };
+#ifdef _WIN32 // the name is a GUID, the patterns can also match the name displayed
+				auto friendly_name = network_interface.friendly_name();
+				aliases.emplace_back(friendly_name.begin(), friendly_name.end());
 #endif // _WIN32
-						Tins::Packet packet(_sniffer.next_packet());
-						_stream_follower.process_packet(packet);
-#ifdef _WIN32
+				for (const auto& pattern : _config.interfaces) {
+					if (std::any_of(aliases.begin(), aliases.end(),
+						[&pattern](const std::string& alias) { return match_pattern(pattern, alias); })) {
+						names.insert(name);
+						break;
 					}
-#endif // _WIN32
 				}
-			} catch (std::exception& e) {
-				std::cout << e.what() << std::endl;
 			}
+		} catch (std::exception& e) {
+			std::cout << "interfaces: " << e.what() << std::endl;
+			return;
+		}
 
-			// clear buffers
-			_packet_reassemblers.clear();
-		});
+		std::lock_guard<std::mutex> lock(_mutex_captures);
+		for (auto it = _captures.begin(); it != _captures.end();) {
+			// a capture stopped by an error is opened again
+			if (!names.count(it->first) || (_is_sniffing && !it->second->is_capturing())) {
+				std::cout << "Stop capture on interface " << it->first << std::endl;
+				it = _captures.erase(it);
+			} else {
+				++it;
+			}
+		}
+		for (const auto& name : names) {
+			if (!_captures.count(name))
+				_add_capture(name);
+		}
+		_metrics.interfaces.set(_captures.size());
 	}
 
-	void Sniffer::stop_sniffing()
+	void Sniffer::_monitor()
 	{
-		if (!_is_sniffing) {
+		auto next_refresh_time = std::chrono::steady_clock::now() + INTERFACES_REFRESH_INTERVAL;
+		std::unique_lock<std::mutex> lock(_mutex_monitor);
+
+		while (!_monitor_condition.wait_for(lock, STATS_INTERVAL, [this]() { return !_is_sniffing; })) {
+			lock.unlock();
+			_update_capture_stats();
+			if (std::chrono::steady_clock::now() >= next_refresh_time) {
+				if (_source == Source::INTERFACE && !_config.interfaces.empty())
+					_refresh_interfaces();
+				if (_source != Source::RING && !_config.deny_list_file.empty())
+					_reload_deny_list();
+				next_refresh_time += INTERFACES_REFRESH_INTERVAL;
+			}
+			lock.lock();
+		}
+	}
+
+	/*
+	** Read the counters of pcap: packets accepted by the filters and dropped
+	*/
+	void Sniffer::_update_capture_stats()
+	{
+		Capture::Stats total_stats;
+		{
+			std::lock_guard<std::mutex> lock(_mutex_captures);
+			for (auto& capture : _captures) {
+				Capture::Stats stats;
+				if (capture.second->get_stats(stats)) {
+					total_stats.received += stats.received;
+					total_stats.kernel_drops += stats.kernel_drops;
+					total_stats.interface_drops += stats.interface_drops;
+				}
+			}
+		}
+		_metrics.kernel_accepted.set(total_stats.received);
+		_metrics.kernel_drops.set(total_stats.kernel_drops);
+		_metrics.interface_drops.set(total_stats.interface_drops);
+		if (!_data_collector) {
+			// exported and given to the overload governor by the worker process
+			ipc::FrameRing::Stats ring_stats;
+			ring_stats.kernel_accepted = total_stats.received;
+			ring_stats.kernel_drops = total_stats.kernel_drops;
+			ring_stats.interface_drops = total_stats.interface_drops;
+			_ring->set_stats(ring_stats);
 			return;
 		}
-		_is_sniffing = false;
-		_sniffer_thread.join();
+		// the pressure of a replay depends on the speed of the host: its load is never shed, like the CPU governor
+		if (_source != Source::FILE)
+			_update_overload_mode();
 	}
 
+	/*
+	** Give the pressure of the last interval to the governor
+	** The reassembly threads switch their streams to header only mode when the governor leaves the normal mode
+	*/
+	void Sniffer::_update_overload_mode()
+	{
+		auto dropped_packets = static_cast<uint64_t>(_metrics.kernel_drops.value() + _metrics.interface_drops.value())
+			+ _metrics.queue_drops.value();
+		if (!_overload_governor.update(_data_collector->get_queue_depth(), dropped_packets)
+			|| _overload_governor.get_mode() != OverloadGovernor::Mode::HEADER_ONLY)
+			return;
+
+		for (auto& shard : _shards)
+			shard->request_header_only();
+	}
+
+	/*
+	** A shard without packets to reassemble receives the next packets of the file after the packets of the busy shards
+	*/
+	timing::Clock::TimePoint Sniffer::get_packet_time() const noexcept
+	{
+		auto packet_time = timing::Clock::get_default().now();
+		for (auto& shard : _shards) {
+			if (!shard->is_idle())
+				packet_time = std::min(packet_time, shard->get_packet_time());
+		}
+		return packet_time;
+	}
+
+	bool Sniffer::is_sniffing()
+	{
+		if (!_is_sniffing)
+			return false;
+		if (_source != Source::FILE)
+			return true;
+
+		// the replay is finished once the file is read and its packets are reassembled
+		{
+			std::lock_guard<std::mutex> lock(_mutex_captures);
+			for (auto& capture : _captures) {
+				if (capture.second->is_capturing())
+					return true;
+			}
+		}
+		return std::any_of(_shards.begin(), _shards.end(), [](const auto& shard) { return !shard->is_idle(); });
+	}
+
+	void Sniffer::start_sniffing()
+	{
+		if (_is_sniffing) {
+			return;
+		}
+
+		_is_sniffing = true;
+		for (auto& shard : _shards)
+			shard->start();
+		if (_source == Source::INTERFACE && !_config.interfaces.empty())
+			_refresh_interfaces();
+		{
+			std::lock_guard<std::mutex> lock(_mutex_captures);
+			for (auto& capture : _captures)
+				capture.second->start();
+		}
+		_monitor_thread = std::thread(&Sniffer::_monitor, this);
+	}
+
+	void Sniffer::stop_sniffing()
+	{
+		stop_sniffing(std::chrono::steady_clock::time_point::min());
+	}
+
+	void Sniffer::stop_sniffing(std::chrono::steady_clock::time_point drain_deadline)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex_monitor);
+			_is_sniffing = false;
+		}
+		_monitor_condition.notify_all();
+		if (_monitor_thread.joinable()) {
+			_monitor_thread.join();
+		}
+
+		// the captures are interrupted before the reassembly threads they feed
+		{
+			std::lock_guard<std::mutex> lock(_mutex_captures);
+			for (auto& capture : _captures)
+				capture.second->stop();
+		}
+		for (auto& shard : _shards)
+			shard->stop(drain_deadline);
+	}
+
+	/*
+	** Replace the capture of the default interface, make before break:
+	**  the new capture runs until it receives a packet (or the warm up timeout) before the old one is closed,
+	**  the packets received meanwhile on both interfaces go to the same shards, which drop the duplicates
+	** The streams are reassembled by the shards: those which keep their 4-tuple on the new interface are not lost
+	*/
 	void Sniffer::change_interface(const std::string& interface_name)
 	{
-		bool was_sniffing = _is_sniffing;
-		if (was_sniffing) {
-			stop_sniffing();
+		if (_source != Source::INTERFACE || !_config.interfaces.empty())
+			return;
+
+		// opened outside of the lock, an invalid interface throws before the old capture is touched
+		auto capture = _make_capture(interface_name);
+		if (_is_sniffing) {
+			capture->start();
+			auto warm_up_deadline = std::chrono::steady_clock::now() + WARM_UP_TIMEOUT;
+			while (capture->is_capturing() && !capture->get_received_packets()
+				&& std::chrono::steady_clock::now() < warm_up_deadline)
+				std::this_thread::sleep_for(WARM_UP_POLL_INTERVAL);
 		}
 
-		// change the sniffer
-		_sniffer = Tins::Sniffer(interface_name, _sniffer_config);
-		_stream_follower = Tins::TCPIP::StreamFollower();
-		_stream_follower.new_stream_callback(std::bind(&Sniffer::_on_new_connection, this, std::placeholders::_1));
-		if (was_sniffing) {
-			// restart the sniffing
-			start_sniffing();
+		std::map<std::string, std::unique_ptr<Capture>> old_captures;
+		{
+			std::lock_guard<std::mutex> lock(_mutex_captures);
+			std::swap(old_captures, _captures);
+			_source_name = interface_name;
+			_captures[_source_name] = std::move(capture);
+			_metrics.interfaces.set(_captures.size());
+			// the sniffing was stopped during the warm up
+			if (!_is_sniffing)
+				_captures[_source_name]->stop();
 		}
+		_metrics.interface_switches.inc();
+		// the old captures are stopped once the new one is in place
+		old_captures.clear();
 	}
 }
@@ -0,0 +1,61 @@
+#include "timing/Clock.hpp"
+
+namespace ubersniff::timing {
+	Clock::Clock() noexcept :
+		_source(Source::SYSTEM),
+		_packet_time(0),
+		_released_at(0)
+	{}
+
+	Clock& Clock::get_default()
+	{
+		static Clock clock;
+		return clock;
+	}
+
+	void Clock::configure(Source source) noexcept
+	{
+		_source = source;
+		_packet_time = 0;
+		_released_at = 0;
+	}
+
+	Clock::TimePoint Clock::now() const noexcept
+	{
+		if (!is_packet_time())
+			return std::chrono::steady_clock::now();
+
+		auto time = TimePoint(Duration(_packet_time.load(std::memory_order_acquire)));
+		auto released_at = _released_at.load(std::memory_order_relaxed);
+		if (released_at)
+			time += std::chrono::steady_clock::now().time_since_epoch() - Duration(released_at);
+		return time;
+	}
+
+	Clock::TimePoint Clock::at(std::chrono::microseconds timestamp) const noexcept
+	{
+		if (!is_packet_time())
+			return std::chrono::steady_clock::now();
+		return TimePoint(std::chrono::duration_cast<Duration>(timestamp));
+	}
+
+	/*
+	** The reassembly threads publish the exchanges of the previous packets before moving the time
+	*/
+	void Clock::advance(std::chrono::microseconds timestamp) noexcept
+	{
+		if (!is_packet_time() || _released_at.load(std::memory_order_relaxed))
+			return;
+		auto packet_time = std::chrono::duration_cast<Duration>(timestamp).count();
+		auto current_time = _packet_time.load(std::memory_order_relaxed);
+		while (packet_time > current_time
+			&& !_packet_time.compare_exchange_weak(current_time, packet_time, std::memory_order_release));
+	}
+
+	void Clock::release() noexcept
+	{
+		auto released_at = std::chrono::steady_clock::now().time_since_epoch().count();
+		Duration::rep not_released = 0;
+		_released_at.compare_exchange_strong(not_released, released_at ? released_at : 1);
+	}
+}
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <pcap.h>
+#include "trace/FlightRecorder.hpp"
+
+namespace ubersniff::trace {
+	FlightRecorder::FlightRecorder() :
+		_mask(0),
+		_head(0),
+		_dropped(0)
+	{}
+
+	FlightRecorder& FlightRecorder::get_default()
+	{
+		static FlightRecorder flight_recorder;
+		return flight_recorder;
+	}
+
+	void FlightRecorder::configure(const FlightRecorder::Config& config)
+	{
+		_config = config;
+		if (!config.size) {
+			_slots.reset();
+			_ignored_flows.reset();
+			return;
+		}
+		size_t capacity = 1;
+		while (capacity * SLOT_SIZE < config.size)
+			capacity <<= 1;
+		// allocated and zeroed at once, the capture never allocates
+		_slots = std::make_unique<Slot[]>(capacity);
+		_mask = capacity - 1;
+		_head = 0;
+		_ignored_flows = std::make_unique<std::atomic<uint64_t>[]>(IGNORED_FLOWS);
+	}
+
+	const FlightRecorder::Config& FlightRecorder::get_config() const noexcept
+	{
+		return _config;
+	}
+
+	void FlightRecorder::ignore_flow(uint64_t flow_hash) noexcept
+	{
+		if (_ignored_flows)
+			_ignored_flows[flow_hash & (IGNORED_FLOWS - 1)].store(flow_hash, std::memory_order_relaxed);
+	}
+
+	/*
+	** A stream reusing the 4-tuple of a stream ignored is recorded again
+	*/
+	void FlightRecorder::follow_flow(uint64_t flow_hash) noexcept
+	{
+		if (!_ignored_flows)
+			return;
+		auto& ignored_flow = _ignored_flows[flow_hash & (IGNORED_FLOWS - 1)];
+		ignored_flow.compare_exchange_strong(flow_hash, 0, std::memory_order_relaxed);
+	}
+
+	/*
+	** Write the frame in the next slot
+	** The frame is dropped if a writer which has lapped the ring is still writing in the slot
+	*/
+	void FlightRecorder::record(uint64_t flow_hash, int link_type, int64_t timestamp, const uint8_t* data,
+		uint32_t size, uint32_t length) noexcept
+	{
+		if (flow_hash && _ignored_flows[flow_hash & (IGNORED_FLOWS - 1)].load(std::memory_order_relaxed) == flow_hash)
+			return;
+
+		auto index = _head.fetch_add(1, std::memory_order_relaxed);
+		auto& slot = _slots[index & _mask];
+
+		auto sequence = slot.sequence.load(std::memory_order_relaxed);
+		if ((sequence & 1) || !slot.sequence.compare_exchange_strong(sequence, 2 * index + 1, std::memory_order_acquire)) {
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.timestamp = timestamp;
+		slot.size = std::min<uint32_t>(size, MAX_FRAME_SIZE);
+		slot.length = std::max(length, size);
+		slot.link_type = link_type;
+		std::memcpy(slot.data, data, slot.size);
+		slot.sequence.store(2 * (index + 1), std::memory_order_release);
+	}
+
+	uint64_t FlightRecorder::dropped() const noexcept
+	{
+		return _dropped.load(std::memory_order_relaxed);
+	}
+
+	/*
+	** Read the slots from the oldest index still in the ring, a slot overwritten meanwhile is skipped
+	** The frames are written with pcap directly: the header of a frame keeps its captured size and its length
+	*/
+	size_t FlightRecorder::dump(const std::string& filename) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex_dump);
+		struct Frame {
+			int64_t timestamp;
+			uint32_t size;
+			uint32_t length;
+			int32_t link_type;
+			uint8_t data[MAX_FRAME_SIZE];
+		};
+		auto frame = std::make_unique<Frame>();
+
+		auto read_slot = [&](uint64_t index) {
+			auto& slot = _slots[index & _mask];
+			if (slot.sequence.load(std::memory_order_acquire) != 2 * (index + 1))
+				return false;
+			frame->timestamp = slot.timestamp;
+			frame->size = slot.size;
+			frame->length = slot.length;
+			frame->link_type = slot.link_type;
+			std::memcpy(frame->data, slot.data, frame->size);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return slot.sequence.load(std::memory_order_relaxed) == 2 * (index + 1);
+		};
+
+		std::unique_ptr<pcap_t, decltype(&pcap_close)> handle(nullptr, &pcap_close);
+		std::unique_ptr<pcap_dumper_t, decltype(&pcap_dump_close)> dumper(nullptr, &pcap_dump_close);
+		auto open_file = [&](int32_t link_type) {
+			handle.reset(pcap_open_dead(link_type, 65535));
+			if (!handle)
+				throw std::runtime_error("Cannot open a pcap handle for the link type " + std::to_string(link_type));
+			dumper.reset(pcap_dump_open(handle.get(), filename.c_str()));
+			if (!dumper)
+				throw std::runtime_error(pcap_geterr(handle.get()));
+		};
+
+		// a pcap file has one link type, the frames of the other interfaces are skipped
+		int32_t link_type = 0;
+		size_t written_frames = 0;
+		auto head = _slots ? _head.load(std::memory_order_acquire) : 0;
+		auto first_index = head > _mask ? head - _mask - 1 : 0;
+
+		// the frames older than the duration before the newest frame are skipped
+		auto min_timestamp = std::numeric_limits<int64_t>::min();
+		if (_config.duration.count() > 0) {
+			for (auto index = head; index > first_index; --index) {
+				if (read_slot(index - 1)) {
+					min_timestamp = frame->timestamp
+						- std::chrono::duration_cast<std::chrono::microseconds>(_config.duration).count();
+					break;
+				}
+			}
+		}
+
+		for (auto index = first_index; index < head; ++index) {
+			if (!read_slot(index) || frame->timestamp < min_timestamp)
+				continue;
+			if (!dumper) {
+				link_type = frame->link_type;
+				open_file(link_type);
+			} else if (frame->link_type != link_type) {
+				continue;
+			}
+			// the raw bytes of the frame are written as they were captured
+			pcap_pkthdr header{};
+			header.ts.tv_sec = static_cast<decltype(header.ts.tv_sec)>(frame->timestamp / 1000000);
+			header.ts.tv_usec = static_cast<decltype(header.ts.tv_usec)>(frame->timestamp % 1000000);
+			header.caplen = frame->size;
+			header.len = frame->length;
+			pcap_dump(reinterpret_cast<u_char*>(dumper.get()), &header, frame->data);
+			++written_frames;
+		}
+		// an empty capture is still written
+		if (!dumper)
+			open_file(DLT_EN10MB);
+		return written_frames;
+	}
+}
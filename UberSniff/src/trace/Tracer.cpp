@@ -0,0 +1,173 @@
+#include <fstream>
+#include <stdexcept>
+#include "trace/Tracer.hpp"
+
+namespace ubersniff::trace {
+	// Name of the span ending at each stage
+	static constexpr const char* STAGE_NAMES[NB_STAGES] = {
+		"first segment",
+		"headers",
+		"body",
+		"enqueue",
+		"processing",
+		"batching",
+		"upload"
+	};
+
+	Tracer::Tracer() :
+		_sampling_threshold(0),
+		_next_id(1),
+		_mask(0),
+		_head(0),
+		_dropped(0)
+	{}
+
+	Tracer& Tracer::get_default()
+	{
+		static Tracer tracer;
+		return tracer;
+	}
+
+	void Tracer::configure(const Tracer::Config& config)
+	{
+		_config = config;
+		size_t capacity = 1;
+		while (capacity < config.capacity)
+			capacity <<= 1;
+		_slots = std::make_unique<Slot[]>(capacity);
+		_mask = capacity - 1;
+		_head = 0;
+		_sampling_threshold = static_cast<uint64_t>(config.sampling_rate * 4294967296.0);
+	}
+
+	const Tracer::Config& Tracer::get_config() const noexcept
+	{
+		return _config;
+	}
+
+	/*
+	** Draw from a xorshift generator per thread
+	*/
+	bool Tracer::_should_sample() noexcept
+	{
+		auto threshold = _sampling_threshold.load(std::memory_order_relaxed);
+		if (!threshold)
+			return false;
+
+		thread_local uint64_t state = 0x9E3779B97F4A7C15ull ^ reinterpret_cast<uintptr_t>(&state);
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return (state & 0xFFFFFFFF) < threshold;
+	}
+
+	RecordPtr Tracer::start()
+	{
+		if (!_should_sample())
+			return nullptr;
+
+		auto record = RecordPtr(new Record(), [this](Record* record) {
+			_commit(*record);
+			delete record;
+		});
+		record->id = _next_id.fetch_add(1, std::memory_order_relaxed);
+		record->mark(FIRST_SEGMENT);
+		return record;
+	}
+
+	/*
+	** Write the record in the next slot
+	** The record is dropped if a writer which has lapped the ring is still writing in the slot
+	*/
+	void Tracer::_commit(const Record& record) noexcept
+	{
+		auto index = _head.fetch_add(1, std::memory_order_relaxed);
+		auto& slot = _slots[index & _mask];
+
+		auto sequence = slot.sequence.load(std::memory_order_relaxed);
+		if ((sequence & 1) || !slot.sequence.compare_exchange_strong(sequence, 2 * index + 1, std::memory_order_acquire)) {
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.id.store(record.id, std::memory_order_relaxed);
+		for (size_t stage = 0; stage < NB_STAGES; ++stage)
+			slot.timestamps[stage].store(record.timestamps[stage], std::memory_order_relaxed);
+		slot.sequence.store(2 * (index + 1), std::memory_order_release);
+	}
+
+	uint64_t Tracer::dropped() const noexcept
+	{
+		return _dropped.load(std::memory_order_relaxed);
+	}
+
+	void Tracer::_write_microseconds(std::string& output, int64_t nanoseconds)
+	{
+		auto fraction = std::to_string(nanoseconds % 1000);
+		output += std::to_string(nanoseconds / 1000);
+		output += '.';
+		output.append(3 - fraction.size(), '0');
+		output += fraction;
+	}
+
+	/*
+	** Export the records as complete events: one span for the exchange
+	**  and one nested span for each stage reached, on a track per exchange
+	*/
+	std::string Tracer::serialize() const
+	{
+		std::string output = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool is_first_event = true;
+
+		auto write_event = [&](const char* name, uint64_t id, int64_t begin, int64_t end) {
+			if (!is_first_event)
+				output += ',';
+			is_first_event = false;
+			output += "{\"name\":\"";
+			output += name;
+			output += "\",\"cat\":\"exchange\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+			output += std::to_string(id);
+			output += ",\"ts\":";
+			_write_microseconds(output, begin);
+			output += ",\"dur\":";
+			_write_microseconds(output, end - begin);
+			output += '}';
+		};
+
+		for (size_t index = 0; _slots && index <= _mask; ++index) {
+			auto& slot = _slots[index];
+			Record record;
+
+			// read the slot, skip it if it is written meanwhile
+			auto sequence = slot.sequence.load(std::memory_order_acquire);
+			if (!sequence || (sequence & 1))
+				continue;
+			record.id = slot.id.load(std::memory_order_relaxed);
+			for (size_t stage = 0; stage < NB_STAGES; ++stage)
+				record.timestamps[stage] = slot.timestamps[stage].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+				continue;
+
+			auto begin = record.timestamps[FIRST_SEGMENT];
+			auto previous = begin;
+			for (size_t stage = FIRST_SEGMENT + 1; stage < NB_STAGES; ++stage) {
+				if (!record.timestamps[stage])
+					continue;
+				write_event(STAGE_NAMES[stage], record.id, previous, record.timestamps[stage]);
+				previous = record.timestamps[stage];
+			}
+			write_event("exchange", record.id, begin, previous);
+		}
+		output += "]}";
+		return output;
+	}
+
+	void Tracer::dump(const std::string& filename) const
+	{
+		std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+		if (!file)
+			throw std::runtime_error("Can not create the trace file " + filename);
+		file << serialize();
+	}
+}
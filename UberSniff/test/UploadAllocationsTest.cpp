@@ -0,0 +1,111 @@
+// Heap allocations of the uploads of a recycled session:
+//  once the session is warm, an upload on the kept-alive connection must not allocate
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include "api/Session.hpp"
+
+static constexpr size_t NB_WARMUP_UPLOADS = 10;
+static constexpr size_t NB_UPLOADS = 1000;
+
+// only the allocations of the client thread are counted, the server runs in the same process
+static thread_local bool t_is_counted = false;
+static std::atomic<size_t> g_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+	if (t_is_counted)
+		++g_allocations;
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+using namespace ubersniff::api;
+namespace beast = boost::beast;
+
+/*
+** Local UberBack: answers every upload of a single keep-alive TLS connection
+*/
+static void serve_uploads(tcp::acceptor& acceptor, ssl::context& ctx)
+{
+	try {
+		ssl::stream<tcp::socket> stream(acceptor.accept(), ctx);
+		stream.handshake(ssl::stream_base::server);
+		beast::flat_buffer buffer;
+		for (;;) {
+			http::request<http::string_body> request;
+			http::read(stream, buffer, request);
+			http::response<http::string_body> response(http::status::ok, request.version());
+			response.keep_alive(request.keep_alive());
+			response.body() = "ok";
+			response.prepare_payload();
+			http::write(stream, response);
+		}
+	}
+	catch (const std::exception&) {
+		// the client is gone
+	}
+}
+
+int main()
+{
+	boost::asio::io_context server_ioc;
+	ssl::context server_ctx(ssl::context::tls_server);
+	server_ctx.use_certificate_chain_file(UBERSNIFF_TEST_DATA_DIR "/cert.pem");
+	server_ctx.use_private_key_file(UBERSNIFF_TEST_DATA_DIR "/key.pem", ssl::context::pem);
+	tcp::acceptor acceptor(server_ioc, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	std::thread server([&acceptor, &server_ctx]() { serve_uploads(acceptor, server_ctx); });
+
+	boost::asio::io_context ioc;
+	ssl::context ctx(ssl::context::tls_client);
+	ctx.set_verify_mode(ssl::context::verify_none);
+	const std::string port = std::to_string(acceptor.local_endpoint().port());
+	const std::string body(8000, 'x');
+	const Session::Request request{ "127.0.0.1", port.c_str(), "/data", "token", "application/json", body.c_str(), body.size() };
+
+	std::atomic<size_t> connections{ 0 };
+	std::atomic<size_t> handler_heap_allocations{ 0 };
+	size_t nb_done = 0;
+	size_t nb_failures = 0;
+	size_t warm_allocations = 0;
+	size_t steady_allocations = 0;
+	{
+		Session session(ioc, ctx, [&](Session& s, bool is_success, unsigned) {
+			nb_failures += !is_success;
+			if (++nb_done == NB_WARMUP_UPLOADS)
+				warm_allocations = g_allocations.load();
+			if (nb_done < NB_UPLOADS)
+				s.send_post_async(request);
+		}, connections, handler_heap_allocations);
+
+		t_is_counted = true;
+		session.send_post_async(request);
+		ioc.run();
+		t_is_counted = false;
+		steady_allocations = g_allocations.load() - warm_allocations;
+	}
+	// the session closed the connection: the server is over
+	server.join();
+
+	std::printf("%zu uploads, %zu failures, %zu connections, %zu handler heap allocations, %zu allocations after the warm-up\n",
+		nb_done, nb_failures, connections.load(), handler_heap_allocations.load(), steady_allocations);
+	if (nb_done != NB_UPLOADS || nb_failures != 0 || connections.load() != 1 || steady_allocations != 0) {
+		std::fprintf(stderr, "FAILED: the uploads of a recycled session allocate\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}